@@ -25,6 +25,12 @@
 // 10 milliseconds read timeout
 #define READ_TIMEOUT 10
 
+// 1 second to receive a complete request
+#define REQUEST_TIMEOUT 1000
+
+// 1 second for more of a request's body to arrive
+#define BODY_TIMEOUT 1000
+
 #include "Arduino.h"
 
 extern "C" {
@@ -44,619 +50,3377 @@ extern "C" {
 // Temporary buffer.
 static char buffer[160];
 
-FLASH_STRING(mime_types,
-  "HTM*text/html|"
-  "TXT*text/plain|"
-  "CSS*text/css|"
-  "XML*text/xml|"
-  "JS*text/javascript|"
+#if TWS_STATS
+static TinyWebStats stats;
+
+#define COUNT(counter) (stats.counter++)
+
+// Adds a duration, in microseconds, to `h'.
+static void record_time(TinyWebHistogram& h, uint32_t duration) {
+  if (duration > h.max) {
+    h.max = duration;
+  }
+  uint8_t i = 0;
+  for (uint32_t limit = 16; i < TWS_STATS_BUCKETS - 1 && duration >= limit;
+       limit <<= 2) {
+    i++;
+  }
+  if (h.buckets[i] != 0xFFFF) {
+    h.buckets[i]++;
+  }
+}
+#else
+#define COUNT(counter)
+#endif
+
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(addr) ((void*)pgm_read_word(addr))
+#endif
+
+// The MIME types known by default. A MimeType is an index in
+// `mime_types', or MIME_TYPE_CUSTOM plus an index in the array given
+// to set_custom_mime_types().
+static const char mime_htm[] PROGMEM = "text/html";
+static const char mime_txt[] PROGMEM = "text/plain";
+static const char mime_css[] PROGMEM = "text/css";
+static const char mime_xml[] PROGMEM = "text/xml";
+static const char mime_js[] PROGMEM = "text/javascript";
+static const char mime_gif[] PROGMEM = "image/gif";
+static const char mime_jpg[] PROGMEM = "image/jpeg";
+static const char mime_png[] PROGMEM = "image/png";
+static const char mime_ico[] PROGMEM = "image/vnd.microsoft.icon";
+static const char mime_mp3[] PROGMEM = "audio/mpeg";
+static const char mime_json[] PROGMEM = "application/json";
+static const char mime_svg[] PROGMEM = "image/svg+xml";
+static const char mime_pdf[] PROGMEM = "application/pdf";
+static const char mime_woff[] PROGMEM = "font/woff";
+static const char mime_woff2[] PROGMEM = "font/woff2";
+static const char mime_wasm[] PROGMEM = "application/wasm";
+
+static const char* const mime_types[] PROGMEM = {
+  mime_htm, mime_txt, mime_css, mime_xml, mime_js,
+  mime_gif, mime_jpg, mime_png, mime_ico,
+  mime_mp3,
+  mime_json, mime_svg, mime_pdf, mime_woff, mime_woff2, mime_wasm,
+};
+
+enum {
+  MIME_HTM, MIME_TXT, MIME_CSS, MIME_XML, MIME_JS,
+  MIME_GIF, MIME_JPG, MIME_PNG, MIME_ICO,
+  MIME_MP3,
+  MIME_JSON, MIME_SVG, MIME_PDF, MIME_WOFF, MIME_WOFF2, MIME_WASM,
+  MIME_TYPE_COUNT,
+};
+
+#define MAX_EXTENSION_LENGTH 5
+
+typedef struct {
+  char extension[MAX_EXTENSION_LENGTH + 1];
+  uint8_t type;
+} MimeExtension;
 
-  "GIF*image/gif|"
-  "JPG*image/jpeg|"
-  "PNG*image/png|"
-  "ICO*image/vnd.microsoft.icon|"
+// The extensions of the MIME types above, in upper case.
+//
+// NOTE: Keep this array sorted, get_mime_type_from_filename() does a
+// binary search on it. The unit tests check the order.
+static const MimeExtension mime_extensions[] PROGMEM = {
+  {"CSS", MIME_CSS},
+  {"GIF", MIME_GIF},
+  {"HTM", MIME_HTM},
+  {"HTML", MIME_HTM},
+  {"ICO", MIME_ICO},
+  {"JPEG", MIME_JPG},
+  {"JPG", MIME_JPG},
+  {"JS", MIME_JS},
+  {"JSON", MIME_JSON},
+  {"MP3", MIME_MP3},
+  {"PDF", MIME_PDF},
+  {"PNG", MIME_PNG},
+  {"SVG", MIME_SVG},
+  {"TXT", MIME_TXT},
+  {"WASM", MIME_WASM},
+  {"WOFF", MIME_WOFF},
+  {"WOFF2", MIME_WOFF2},
+  {"XML", MIME_XML},
+};
 
-  "MP3*audio/mpeg|"
-);
+// The MIME types registered by the application.
+static const TinyWebServer::MimeTypeMapping* custom_mime_types = NULL;
 
 void *malloc_check(size_t size) {
   void* r = malloc(size);
-#if DEBUG
   if (!r) {
+    COUNT(alloc_failures);
+#if DEBUG
     Serial << F("TWS:No space for malloc: " ); Serial.println(size, DEC);
+#endif
+  }
+  return r;
+}
+
+// Allocates from `arena' when one is given, from the heap otherwise.
+static void* alloc_from(TinyWebArena* arena, size_t size) {
+  return arena ? arena->alloc(size) : malloc_check(size);
+}
+
+TinyWebArena::TinyWebArena(size_t size)
+  : size_(size),
+    used_(0),
+    high_water_mark_(0) {
+  base_ = (char*)malloc_check(size);
+  if (!base_) {
+    size_ = 0;
   }
+}
+
+TinyWebArena::~TinyWebArena() {
+  free(base_);
+}
+
+void* TinyWebArena::alloc(size_t size) {
+  // Keep the returned blocks aligned for any type.
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  if (size > size_ - used_) {
+    COUNT(alloc_failures);
+#if DEBUG
+    Serial << F("TWS:No space in arena: "); Serial.println(size, DEC);
 #endif
+    return NULL;
+  }
+  void* r = base_ + used_;
+  used_ += size;
+  if (used_ > high_water_mark_) {
+    high_water_mark_ = used_;
+  }
+  return r;
+}
+
+char* TinyWebArena::strndup(const char* s, size_t len) {
+  char* r = (char*)alloc(len + 1);
+  if (r) {
+    memcpy(r, s, len);
+    r[len] = 0;
+  }
   return r;
 }
 
-// Offset for text/html in `mime_types' above.
-static const TinyWebServer::MimeType text_html_content_type = 4;
+// The headers TinyWebServer needs for itself, in addition to the ones
+// requested by the handlers.
+static const char* const internal_headers[] = {
+  "Connection",
+  "Content-Length",
+  "Accept-Encoding",
+  "If-Modified-Since",
+  "If-None-Match",
+  "If-Range",
+  "Range",
+  "Content-Type",
+#if TWS_WEBSOCKETS
+  "Upgrade",
+  "Sec-WebSocket-Key",
+  "Sec-WebSocket-Version",
+#endif
+  NULL
+};
+
+// Adds the character `ch' of a header name to its hash `h'. Header
+// names are case insensitive, and so is the hash.
+static inline uint16_t header_hash_char(uint16_t h, char ch) {
+  return (h << 5) + h + tolower(ch);
+}
+
+static uint16_t header_hash(const char* name) {
+  uint16_t h = 0;
+  while (*name) {
+    h = header_hash_char(h, *name++);
+  }
+  return h;
+}
+
+// Returns true if `name' is in the NULL terminated `headers' array.
+static boolean contains_header(const char* const* headers, const char* name) {
+  for (int i = 0; headers && headers[i]; i++) {
+    if (!strcasecmp(headers[i], name)) {
+      return true;
+    }
+  }
+  return false;
+}
 
 TinyWebServer::TinyWebServer(PathHandler handlers[],
 			     const char** headers,
-                             const int port)
+                             const int port,
+                             size_t arena_size)
   : handlers_(handlers),
+    headers_(NULL),
     server_(EthernetServer(port)),
     path_(NULL),
+    query_(NULL),
     request_type_(UNKNOWN_REQUEST),
-    client_(EthernetClient(255)) {
-  if (headers) {
-    int size = 0;
-    for (int i = 0; headers[i]; i++) {
+    client_(EthernetClient(255)),
+    arena_(arena_size),
+    keep_alive_timeout_(TWS_KEEP_ALIVE_TIMEOUT),
+    max_keep_alive_requests_(TWS_MAX_KEEP_ALIVE_REQUESTS),
+    cache_max_age_(0),
+    keep_alive_(false),
+    persistent_(false),
+    content_length_sent_(false),
+    http_11_(false),
+    chunked_(false),
+    chunk_sent_(false),
+    headers_only_(false),
+    drop_output_(false),
+    body_remaining_(0),
+    output_len_(0),
+    output_start_(0),
+    route_nodes_(NULL),
+    next_route_(NULL),
+    route_node_count_(0) {
+  route_match_.route = NO_ROUTE;
+  route_match_.params = 0;
+  for (int i = 0; i < TWS_MAX_CONNECTIONS; i++) {
+    connections_[i].state = CONNECTION_FREE;
+    connections_[i].input_pos = connections_[i].input_len = 0;
+  }
+  current_ = &connections_[0];
+  for (int i = 0; i < TWS_MAX_TRANSFERS; i++) {
+    transfers_[i].connection = NULL;
+  }
+  pending_transfer_ = NULL;
+#if TWS_WEBSOCKETS
+  pending_websocket_ = NULL;
+#endif
+#if TWS_FILE_CACHE_SIZE > 0
+  for (int i = 0; i < TWS_FILE_CACHE_SIZE; i++) {
+    file_cache_[i].dir = NULL;
+    file_cache_[i].age = i;
+  }
+#endif
+
+  int size = 0;
+  for (int i = 0; headers && headers[i]; i++) {
+    size++;
+  }
+  for (int i = 0; internal_headers[i]; i++) {
+    if (!contains_header(headers, internal_headers[i])) {
       size++;
     }
-    headers_ = (HeaderValue*)malloc_check(sizeof(HeaderValue) * (size + 1));
-    if (headers_) {
-      for (int i = 0; i < size; i++) {
-        headers_[i].header = headers[i];
-        headers_[i].value = NULL;
+  }
+  headers_ = (HeaderValue*)malloc_check(sizeof(HeaderValue) * (size + 1));
+  if (headers_) {
+    int pos = 0;
+    for (int i = 0; headers && headers[i]; i++) {
+      headers_[pos].header = headers[i];
+      headers_[pos].hash = header_hash(headers[i]);
+      headers_[pos++].offset = 0;
+    }
+    for (int i = 0; internal_headers[i]; i++) {
+      if (!contains_header(headers, internal_headers[i])) {
+        headers_[pos].header = internal_headers[i];
+        headers_[pos].hash = header_hash(internal_headers[i]);
+        headers_[pos++].offset = 0;
       }
-      headers_[size].header = NULL;
     }
+    headers_[size].header = NULL;
   }
 }
 
+TinyWebServer::~TinyWebServer() {
+  free(headers_);
+  free(route_nodes_);
+}
+
 void TinyWebServer::begin() {
+  compile_routes();
   server_.begin();
 }
 
-// Process headers.
+static void send_status_line(Print& out, int code);
+
+// Returns true if the comma separated list of tokens in `value'
+// contains `token', ignoring case.
+static boolean has_token(const char* value, const char* token) {
+  if (!value) {
+    return false;
+  }
+  int len = strlen(token);
+  while (*value) {
+    while (*value == ' ' || *value == ',') {
+      value++;
+    }
+    if (!strncasecmp(value, token, len)
+        && (!value[len] || value[len] == ',' || value[len] == ' ')) {
+      return true;
+    }
+    while (*value && *value != ',') {
+      value++;
+    }
+  }
+  return false;
+}
+
+// Sets `length' to the value of a Content-Length header, 0 if there's
+// none. Returns false if `value' isn't a number that fits in 31 bits,
+// which leaves the body's end unknown.
+static boolean parse_content_length(const char* value, int32_t* length) {
+  *length = 0;
+  if (!value) {
+    return true;
+  }
+  if (!*value) {
+    return false;
+  }
+  for (; *value; value++) {
+    if (!isdigit(*value) || *length > (0x7fffffffL - 9) / 10) {
+      return false;
+    }
+    *length = *length * 10 + *value - '0';
+  }
+  return true;
+}
+
+void TinyWebServer::process() {
+  // Start tracking the connection with pending input, unless we
+  // already do.
+  EthernetClient client = server_.available();
+  if (client) {
+    accept_client(client);
+  }
+
+  // Advance all the open connections.
+  for (int i = 0; i < TWS_MAX_CONNECTIONS; i++) {
+    if (connections_[i].state != CONNECTION_FREE) {
+      advance_connection(connections_[i]);
+    }
+  }
+}
+
+void TinyWebServer::accept_client(EthernetClient& client) {
+  if (has_client(client)) {
+    return;
+  }
+  // Without a free slot the client waits until one is released.
+  for (int i = 0; i < TWS_MAX_CONNECTIONS; i++) {
+    if (connections_[i].state == CONNECTION_FREE) {
+      start_connection(connections_[i], client);
+      return;
+    }
+  }
+}
+
+boolean TinyWebServer::has_client(EthernetClient& client) {
+  for (int i = 0; i < TWS_MAX_CONNECTIONS; i++) {
+    if (connections_[i].state != CONNECTION_FREE
+        && connections_[i].client == client) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TinyWebServer::start_connection(Connection& c, EthernetClient& client) {
+  c.client = client;
+  c.state = REQUEST_LINE;
+  c.pos = 0;
+  c.requests_served = 0;
+  c.input_pos = c.input_len = 0;
+  c.last_activity = millis();
+  COUNT(connections);
+}
+
+void TinyWebServer::close_connection(Connection& c) {
+  if (c.state == CONNECTION_TRANSFER) {
+    // The client went away in the middle of a transfer.
+    for (int i = 0; i < TWS_MAX_TRANSFERS; i++) {
+      if (transfers_[i].connection == &c) {
+        end_transfer(transfers_[i]);
+      }
+    }
+  }
+#if TWS_WEBSOCKETS
+  if (c.state == CONNECTION_WEBSOCKET) {
+    // Let the application forget the WebSocket. It's not one anymore
+    // for broadcast_frame().
+    c.state = CONNECTION_FREE;
+    current_ = &c;
+    client_ = c.client;
+    (*c.websocket_fn)(*this, WS_CLOSE, NULL, 0);
+  }
+#endif
+  c.client.stop();
+  c.state = CONNECTION_FREE;
+}
+
+void TinyWebServer::advance_connection(Connection& c) {
+  if (!is_connected(c.client)) {
+    close_connection(c);
+    return;
+  }
+  if (c.state == CONNECTION_TRANSFER) {
+    advance_transfer(c);
+    return;
+  }
+#if TWS_WEBSOCKETS
+  if (c.state == CONNECTION_WEBSOCKET) {
+    advance_websocket(c);
+    return;
+  }
+#endif
+
+  // Read at most one block of input per call, unless the client
+  // pipelined more requests behind one just handled: those are
+  // handled right away, in order, and their responses sent together.
+  boolean dispatched = false;
+  while (1) {
+    if (c.input_pos == c.input_len) {
+      c.input_pos = 0;
+      c.input_len = read_block(c.client, c.input, sizeof(c.input));
+      if (c.input_len) {
+        c.last_activity = millis();
+      }
+    }
+
+    int status = parse_input(c);
+    if (status == 200) {
+      dispatch(c);
+      dispatched = true;
+      if (c.state == REQUEST_LINE) {
+        continue;
+      }
+      return;
+    } else if (status) {
+#if DEBUG
+      Serial << F("TWS:Bad request\n");
+#endif
+      client_ = c.client;
+      send_error_code(status);
+      flush();
+      close_connection(c);
+      return;
+    }
+    break;
+  }
+  if (dispatched) {
+    // Send the responses held back for the pipelined requests.
+    flush();
+    return;
+  }
+
+  // Drop connections waiting too long for the next request, or too
+  // slow in sending the current one.
+  boolean idle = c.state == REQUEST_LINE && c.pos == 0;
+  if (millis() - c.last_activity
+      > (idle ? keep_alive_timeout_ : REQUEST_TIMEOUT)) {
+#if DEBUG
+    Serial << F("TWS:Closing idle connection\n");
+#endif
+    if (!idle) {
+      COUNT(timeouts);
+    }
+    close_connection(c);
+  }
+}
+
+int TinyWebServer::parse_input(Connection& c) {
+  while (c.input_pos < c.input_len) {
+    if (c.state == HEADER_IGNORE_VALUE) {
+      // Skip to the end of the line in one go.
+      uint8_t* eol = (uint8_t*)memchr(c.input + c.input_pos, '\n',
+                                      c.input_len - c.input_pos);
+      if (!eol) {
+        c.input_pos = c.input_len;
+        break;
+      }
+      c.input_pos = eol - c.input + 1;
+      c.state = HEADER_START;
+      continue;
+    }
+    int status = parse_char(c, c.input[c.input_pos++]);
+    if (status) {
+      return status;
+    }
+  }
+  return 0;
+}
+
+int TinyWebServer::parse_char(Connection& c, char ch) {
+#if DEBUG
+  Serial.print(ch);
+#endif
+  if (!ch) {
+    // The request line and the header values are stored NUL
+    // terminated, a NUL inside them would throw off their parsing.
+    return 400;
+  }
+  switch (c.state) {
+  case REQUEST_LINE:
+    if (!c.pos && (ch == '\r' || ch == '\n')) {
+      // Ignore empty lines before the request line.
+      break;
+    } else if (ch == '\n') {
+      // Drop the trailing '\r'. The header values go in `values'.
+      if (c.pos && c.buffer[c.pos - 1] == '\r') {
+        c.pos--;
+      }
+      c.buffer[c.pos] = 0;
+      c.pos = 0;
+      c.state = HEADER_START;
+#if TWS_STATS
+      c.headers_start = micros();
+      record_time(stats.request_line, c.headers_start - c.request_start);
+#endif
+    } else if (c.pos + 1U >= sizeof(c.buffer)) {
+      // The requested path is too long.
+      return 414;
+    } else {
+#if TWS_STATS
+      if (!c.pos) {
+        c.request_start = micros();
+      }
+#endif
+      c.buffer[c.pos++] = ch;
+    }
+    break;
+
+  case HEADER_START:
+    if (ch == '\r') {
+      break;
+    } else if (ch == '\n') {
+      return 200;
+    } else if (isalnum(ch) || ch == '-') {
+      // The name is stored after the values of the previous
+      // headers. Names that don't fit can't be those of requested
+      // headers.
+      c.mark = c.pos;
+      c.hash = header_hash_char(0, ch);
+      if (c.pos + 1U < sizeof(c.values)) {
+        c.values[c.pos++] = ch;
+        c.state = HEADER_NAME;
+      } else {
+        c.state = HEADER_IGNORE_VALUE;
+      }
+    } else {
+      return 400;
+    }
+    break;
+
+  case HEADER_NAME:
+    if (ch == ':') {
+      c.values[c.pos] = 0;
+      int index = find_header(c.hash, c.values + c.mark);
+      c.pos = c.mark;
+      if (index >= 0) {
+        // Replace the name with the index of the header. Its value
+        // follows.
+        c.values[c.pos++] = index + 1;
+        c.state = HEADER_VALUE_SKIP_INITIAL_SPACES;
+      } else {
+        c.state = HEADER_IGNORE_VALUE;
+      }
+    } else if (isalnum(ch) || ch == '-') {
+      c.hash = header_hash_char(c.hash, ch);
+      if (c.pos + 1U < sizeof(c.values)) {
+        c.values[c.pos++] = ch;
+      } else {
+        c.pos = c.mark;
+        c.state = HEADER_IGNORE_VALUE;
+      }
+    } else {
+      return 400;
+    }
+    break;
+
+  case HEADER_VALUE_SKIP_INITIAL_SPACES:
+    if (ch == ' ') {
+      break;
+    }
+    c.state = HEADER_VALUE;
+    // Fall through.
+
+  case HEADER_VALUE:
+    if (ch == '\n') {
+      c.values[c.pos++] = 0;
+      c.state = HEADER_START;
+    } else if (c.pos + 2U >= sizeof(c.values)) {
+      // The values of the requested headers take more than
+      // TWS_HEADER_BUFFER_SIZE.
+      return 431;
+    } else if (ch != '\r') {
+      c.values[c.pos++] = ch;
+    }
+    break;
+
+  case HEADER_IGNORE_VALUE:
+    if (ch == '\n') {
+      c.state = HEADER_START;
+    }
+    break;
+
+  default:
+    break;
+  }
+  return 0;
+}
+
 boolean TinyWebServer::process_headers() {
-  if (headers_) {
-    // First clear the header values from the previous HTTP request.
-    for (int i = 0; headers_[i].header; i++) {
-      if (headers_[i].value) {
-        free(headers_[i].value);
-        // Ensure the pointer is cleared once the memory is freed.
-        headers_[i].value = NULL;
-      }
-    }
-  }
-
-  enum State {
-    ERROR,
-    START_LINE,
-    HEADER_NAME,
-    HEADER_VALUE,
-    HEADER_VALUE_SKIP_INITIAL_SPACES,
-    HEADER_IGNORE_VALUE,
-    END_HEADERS,
-  };
-  State state = START_LINE;
-
-  char ch;
-  int pos;
-  const char* header;
+  // Read the headers in the current connection's header buffer, in
+  // place of those of the request.
+  Connection& c = *current_;
+  c.state = HEADER_START;
+  c.pos = 0;
+
   uint32_t start_time = millis();
   while (1) {
     if (should_stop_processing()) {
       return false;
     }
     if (millis() - start_time > READ_TIMEOUT) {
+      COUNT(timeouts);
       return false;
     }
-    if (!read_next_char(client_, (uint8_t*)&ch)) {
+    if (c.input_pos == c.input_len) {
+      c.input_pos = 0;
+      c.input_len = read_block(client_, c.input, sizeof(c.input));
+      if (!c.input_len) {
+        continue;
+      }
+      start_time = millis();
+    }
+    int status = parse_input(c);
+    if (status == 200) {
+      break;
+    } else if (status) {
+      return false;
+    }
+  }
+  assign_header_values(c);
+  return parse_content_length(get_header_value("Content-Length"),
+                              &body_remaining_);
+}
+
+void TinyWebServer::dispatch(Connection& c) {
+  current_ = &c;
+  client_ = c.client;
+#if TWS_STATS
+  COUNT(requests);
+  uint32_t start = micros();
+  record_time(stats.headers, start - c.headers_start);
+#endif
+#if DEBUG
+  Serial << F("TWS:New request: ");
+  Serial.println(c.buffer);
+#endif
+
+  char* request_type_str = get_field(c.buffer, 0, &arena_);
+  request_type_ = UNKNOWN_REQUEST;
+  if (request_type_str) {
+    if (!strcmp("GET", request_type_str)) {
+      request_type_ = GET;
+    } else if (!strcmp("HEAD", request_type_str)) {
+      request_type_ = HEAD;
+    } else if (!strcmp("POST", request_type_str)) {
+      request_type_ = POST;
+    } else if (!strcmp("PUT", request_type_str)) {
+      request_type_ = PUT;
+    } else if (!strcmp("DELETE", request_type_str)) {
+      request_type_ = DELETE;
+    }
+  }
+
+  path_ = get_field(c.buffer, 1, &arena_);
+  query_ = NULL;
+  if (path_) {
+    // Routes are matched on the path alone.
+    query_ = strchr(path_, '?');
+    if (query_) {
+      *query_++ = 0;
+    }
+  }
+  char* version = get_field(c.buffer, 2, &arena_);
+  http_11_ = version && !strcmp(version, "HTTP/1.1");
+  assign_header_values(c);
+
+  keep_alive_ = false;
+  persistent_ = false;
+  content_length_sent_ = false;
+  chunked_ = false;
+  headers_only_ = request_type_ == HEAD;
+  drop_output_ = false;
+  boolean framed = parse_content_length(get_header_value("Content-Length"),
+                                        &body_remaining_);
+
+  boolean should_close = true;
+  if (!path_ || !framed) {
+    // Either a malformed request line, no space left in the arena or
+    // a body whose end can't be found.
+    send_error_code(400);
+  } else {
+    // HTTP/1.1 connections are persistent unless the client asks
+    // otherwise, HTTP/1.0 ones only when the client asks for it.
+    const char* connection = get_header_value("Connection");
+    keep_alive_ = c.requests_served + 1 < max_keep_alive_requests_
+      && (http_11_ ? !has_token(connection, "close")
+          : has_token(connection, "keep-alive"));
+
+    // Identify the handler to call.
+    int route = find_handler(path_, request_type_);
+    if (route < 0 && headers_only_) {
+      route = find_handler(path_, GET);
+      request_type_ = HEAD;
+    }
+#if TWS_STATS
+    uint32_t found = micros();
+    record_time(stats.route, found - start);
+#endif
+    if (route >= 0) {
+      should_close = (handlers_[route].handler)(*this);
+#if TWS_STATS
+      record_time(stats.handler, micros() - found);
+#endif
+    } else {
+      // Send an empty body so the connection can be reused.
+      send_status_line(*this, 404);
+      send_content_length(0);
+      end_headers();
+    }
+  }
+
+  if (output_start_) {
+    flush_chunk(true);
+  }
+  chunked_ = false;
+
+  if (pending_transfer_) {
+    // The response goes on over the next calls to process().
+    Transfer& t = *pending_transfer_;
+    pending_transfer_ = NULL;
+    t.connection = &c;
+    t.persistent = persistent_;
+    t.drop_output = drop_output_;
+    t.body_remaining = body_remaining_;
+    flush();
+    c.state = CONNECTION_TRANSFER;
+#if TWS_WEBSOCKETS
+  } else if (pending_websocket_) {
+    // From now on the connection carries frames.
+    c.websocket_fn = pending_websocket_;
+    pending_websocket_ = NULL;
+    c.state = CONNECTION_WEBSOCKET;
+    c.pos = c.mark = 0;
+    c.last_activity = millis();
+    flush();
+#endif
+  } else {
+    finish_request(c, should_close);
+  }
+
+  // Release everything allocated while handling the request.
+  drop_output_ = false;
+  path_ = NULL;
+  query_ = NULL;
+  clear_header_values();
+  arena_.reset();
+}
+
+void TinyWebServer::finish_request(Connection& c, boolean should_close) {
+  // The connection can only be reused once the request's body has
+  // been consumed. Skip over what the handler didn't read, as long as
+  // it's already here.
+  while (body_remaining_ > 0
+         && read((uint8_t*)buffer, sizeof(buffer)) > 0) {
+  }
+
+  // When the next request is already here, its response is sent along
+  // with this one by advance_connection().
+  boolean reuse = should_close && persistent_ && !body_remaining_;
+  if (!reuse || c.input_pos == c.input_len) {
+    flush();
+  }
+
+  if (!should_close) {
+    // The handler took over the connection.
+    c.state = CONNECTION_FREE;
+  } else if (reuse) {
+    // Wait for the next request.
+    c.state = REQUEST_LINE;
+    c.pos = 0;
+    c.requests_served++;
+    c.last_activity = millis();
+  } else {
+    close_connection(c);
+  }
+}
+
+// Routing.
+//
+// The handlers' paths are compiled by begin() into a trie of path
+// segments. Each node matches one segment of the request path: a
+// literal one, a :parameter matching any non-empty segment, or the
+// prefix of the remainder of the path for paths ending with '*'.
+// Nodes keep the list of handlers whose path ends on them, in
+// declaration order.
+
+#define NO_NODE 0xFF
+
+enum RouteSegmentKind {
+  LITERAL_SEGMENT,
+  PARAM_SEGMENT,
+  PREFIX_SEGMENT,
+};
+
+// Returns the length of the path segment starting at `s'.
+static uint8_t segment_length(const char* s) {
+  const char* end = strchr(s, '/');
+  return end ? end - s : strlen(s);
+}
+
+void TinyWebServer::compile_routes() {
+  // Each segment of a path needs at most one node, plus the root.
+  int handler_count = 0;
+  int max_nodes = 1;
+  for (; handlers_ && handlers_[handler_count].path; handler_count++) {
+    for (const char* p = handlers_[handler_count].path; *p; p++) {
+      if (*p == '/') {
+        max_nodes++;
+      }
+    }
+    max_nodes++;
+  }
+  if (handler_count >= NO_ROUTE || max_nodes >= NO_NODE) {
+    return;
+  }
+  route_nodes_ = (RouteNode*)malloc_check(sizeof(RouteNode) * max_nodes
+                                          + handler_count);
+  if (!route_nodes_) {
+    return;
+  }
+  next_route_ = (uint8_t*)(route_nodes_ + max_nodes);
+  route_node_count_ = 1;
+  route_nodes_[0].first_child = NO_NODE;
+
+  for (int i = 0; i < handler_count; i++) {
+    const char* p = handlers_[i].path;
+    if (*p == '/') {
+      p++;
+    }
+    uint8_t node = 0;
+    while (1) {
+      RouteNode n;
+      n.segment = p;
+      n.length = segment_length(p);
+      n.kind = LITERAL_SEGMENT;
+      if (!p[n.length] && n.length && p[n.length - 1] == '*') {
+        n.kind = PREFIX_SEGMENT;
+        n.length--;
+      } else if (*p == ':' && n.length > 1) {
+        n.kind = PARAM_SEGMENT;
+      }
+
+      // Reuse a matching child node, or add a new one.
+      uint8_t child = route_nodes_[node].first_child;
+      uint8_t last = NO_NODE;
+      for (; child != NO_NODE; child = route_nodes_[child].next_sibling) {
+        RouteNode& c = route_nodes_[child];
+        if (c.kind == n.kind
+            && (n.kind == PARAM_SEGMENT
+                || (c.length == n.length
+                    && !strncmp(c.segment, n.segment, n.length)))) {
+          break;
+        }
+        last = child;
+      }
+      if (child == NO_NODE) {
+        child = route_node_count_++;
+        n.first_child = NO_NODE;
+        n.next_sibling = NO_NODE;
+        n.first_route = NO_ROUTE;
+        route_nodes_[child] = n;
+        if (last == NO_NODE) {
+          route_nodes_[node].first_child = child;
+        } else {
+          route_nodes_[last].next_sibling = child;
+        }
+      }
+      node = child;
+
+      p += segment_length(p);
+      if (!*p || n.kind == PREFIX_SEGMENT) {
+        break;
+      }
+      // Skip the '/'.
+      p++;
+    }
+
+    // Append the handler to the node's list.
+    next_route_[i] = NO_ROUTE;
+    uint8_t* route = &route_nodes_[node].first_route;
+    while (*route != NO_ROUTE) {
+      route = &next_route_[*route];
+    }
+    *route = i;
+  }
+}
+
+void TinyWebServer::match_routes(uint8_t node, const char* rest,
+                                 RouteMatch& current, RouteMatch& best) {
+  for (uint8_t child = route_nodes_[node].first_child;
+       child != NO_NODE;
+       child = route_nodes_[child].next_sibling) {
+    RouteNode& n = route_nodes_[child];
+    if (n.kind == PREFIX_SEGMENT) {
+      if (!strncmp(rest, n.segment, n.length)) {
+        match_node_routes(child, current, best);
+      }
+      continue;
+    }
+
+    uint8_t length = segment_length(rest);
+    uint8_t params = current.params;
+    if (n.kind == LITERAL_SEGMENT) {
+      if (length != n.length || strncmp(rest, n.segment, length)) {
+        continue;
+      }
+    } else {
+      if (!length || params == TWS_MAX_PATH_PARAMS) {
+        continue;
+      }
+      current.param_pos[params] = rest - path_;
+      current.param_len[params] = length;
+      current.params++;
+    }
+    if (rest[length] == '/') {
+      match_routes(child, rest + length + 1, current, best);
+    } else {
+      match_node_routes(child, current, best);
+    }
+    current.params = params;
+  }
+}
+
+void TinyWebServer::match_node_routes(uint8_t node, RouteMatch& current,
+                                      RouteMatch& best) {
+  // The list is in declaration order, so the first handler for the
+  // request's method is the one with the highest priority here.
+  for (uint8_t route = route_nodes_[node].first_route;
+       route != NO_ROUTE && route < best.route;
+       route = next_route_[route]) {
+    HttpRequestType type = handlers_[route].type;
+    if (type == ANY || type == request_type_) {
+      best = current;
+      best.route = route;
+      return;
+    }
+  }
+}
+
+int TinyWebServer::find_handler(char* path, HttpRequestType type) {
+  path_ = path;
+  request_type_ = type;
+  RouteMatch current;
+  current.params = 0;
+  route_match_.route = NO_ROUTE;
+  route_match_.params = 0;
+  if (route_nodes_) {
+    match_routes(0, path_[0] == '/' ? path_ + 1 : path_,
+                 current, route_match_);
+  } else {
+    // No memory for the compiled routes, check the handlers one by
+    // one.
+    for (int i = 0; handlers_ && handlers_[i].path; i++) {
+      int len = strlen(handlers_[i].path);
+      boolean exact_match = !strcmp(path_, handlers_[i].path);
+      boolean regex_match = false;
+      if (handlers_[i].path[len - 1] == '*') {
+        regex_match = !strncmp(path_, handlers_[i].path, len - 1);
+      }
+      if ((exact_match || regex_match)
+          && (handlers_[i].type == ANY || handlers_[i].type == type)) {
+        route_match_.route = i;
+        break;
+      }
+    }
+  }
+  return route_match_.route == NO_ROUTE ? -1 : route_match_.route;
+}
+
+const char* TinyWebServer::get_path_param(uint8_t index, uint8_t* length) {
+  if (index >= route_match_.params) {
+    return NULL;
+  }
+  if (length) {
+    *length = route_match_.param_len[index];
+  }
+  return path_ + route_match_.param_pos[index];
+}
+
+const char* TinyWebServer::get_path_param(const char* name, uint8_t* length) {
+  if (route_match_.route == NO_ROUTE) {
+    return NULL;
+  }
+  // Find which parameter of the matched handler's path has this name.
+  int len = strlen(name);
+  uint8_t index = 0;
+  const char* p = handlers_[route_match_.route].path;
+  while ((p = strchr(p, '/'))) {
+    p++;
+    if (*p == ':') {
+      if (segment_length(p + 1) == len && !strncmp(p + 1, name, len)) {
+        return get_path_param(index, length);
+      }
+      index++;
+    }
+  }
+  return NULL;
+}
+
+void TinyWebServer::clear_header_values() {
+  if (!headers_) {
+    return;
+  }
+  // The values live in the connection's buffer, there's nothing to
+  // free.
+  for (int i = 0; headers_[i].header; i++) {
+    headers_[i].offset = 0;
+  }
+}
+
+int TinyWebServer::find_header(uint16_t hash, const char* name) {
+  if (!headers_) {
+    return -1;
+  }
+  for (int i = 0; headers_[i].header; i++) {
+    if (headers_[i].hash == hash && !strcasecmp(name, headers_[i].header)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void TinyWebServer::assign_header_values(Connection& c) {
+  // The header buffer holds the values of the requested headers, each
+  // preceded by the header's index + 1 and NUL terminated.
+  clear_header_values();
+  int pos = 0;
+  while (pos < c.pos) {
+    int index = (uint8_t)c.values[pos++] - 1;
+    int length = strlen(c.values + pos);
+    headers_[index].offset = pos;
+    headers_[index].length = length;
+    pos += length + 1;
+  }
+}
+
+FLASH_STRING(content_type_msg, "Content-Type: ");
+
+// Sends the status line with HTTP status `code'.
+static void send_status_line(Print& out, int code) {
+#if DEBUG
+  Serial << F("TWS:Returning ");
+  Serial.println(code, DEC);
+#endif
+#if TWS_STATS
+  if (code >= 500) {
+    COUNT(status_5xx);
+  } else if (code >= 400) {
+    COUNT(status_4xx);
+  }
+#endif
+  out << F("HTTP/1.1 ");
+  out.print(code, DEC);
+  // The reason phrases of the codes the library and its examples
+  // send. Others get an empty one, which HTTP allows, rather than a
+  // wrong one.
+  switch (code) {
+  case 101:
+    out << F(" Switching Protocols\r\n");
+    break;
+  case 200:
+    out << F(" OK\r\n");
+    break;
+  case 206:
+    out << F(" Partial Content\r\n");
+    break;
+  case 304:
+    out << F(" Not Modified\r\n");
+    break;
+  case 400:
+    out << F(" Bad Request\r\n");
+    break;
+  case 404:
+    out << F(" Not Found\r\n");
+    break;
+  case 406:
+    out << F(" Not Acceptable\r\n");
+    break;
+  case 414:
+    out << F(" URI Too Long\r\n");
+    break;
+  case 416:
+    out << F(" Range Not Satisfiable\r\n");
+    break;
+  case 417:
+    out << F(" Expectation Failed\r\n");
+    break;
+  case 426:
+    out << F(" Upgrade Required\r\n");
+    break;
+  case 431:
+    out << F(" Request Header Fields Too Large\r\n");
+    break;
+  case 500:
+    out << F(" Internal Server Error\r\n");
+    break;
+  case 503:
+    out << F(" Service Unavailable\r\n");
+    break;
+  default:
+    out << F(" \r\n");
+    break;
+  }
+}
+
+void TinyWebServer::send_error_code(int code) {
+  send_status_line(*this, code);
+  if (code != 200) {
+    end_headers();
+  }
+}
+
+void TinyWebServer::send_error_code(Client& client, int code) {
+  send_status_line(client, code);
+  if (code != 200) {
+    end_headers(client);
+  }
+}
+
+void TinyWebServer::send_content_length(uint32_t length) {
+  *this << F("Content-Length: ");
+  println(length, DEC);
+  content_length_sent_ = true;
+}
+
+void TinyWebServer::end_headers() {
+  // Without a Content-Length the end of the response can only be
+  // signaled by closing the connection.
+  persistent_ = keep_alive_ && (content_length_sent_ || chunked_);
+  if (persistent_) {
+    *this << F("Connection: keep-alive\r\n");
+  } else {
+    *this << F("Connection: close\r\n");
+  }
+  println();
+
+  if (headers_only_) {
+    // The headers describe the body the request would have gotten
+    // otherwise, including its framing, but none of it is sent.
+    chunked_ = false;
+    flush();
+    drop_output_ = true;
+    return;
+  }
+  if (chunked_) {
+    // Leave room for the size of the first chunk after the headers.
+    if (output_len_ + (unsigned)CHUNK_HEADER_SIZE >= sizeof(output_)) {
+      flush();
+    }
+    output_start_ = output_len_ + CHUNK_HEADER_SIZE;
+    output_len_ = output_start_;
+    chunk_sent_ = false;
+  }
+}
+
+void TinyWebServer::send_chunked_encoding() {
+  // HTTP/1.0 clients don't know about chunks, for them the end of the
+  // response is signaled by closing the connection.
+  if (http_11_) {
+    *this << F("Transfer-Encoding: chunked\r\n");
+    chunked_ = true;
+  }
+}
+
+void TinyWebServer::send_content_type(MimeType mime_type) {
+  *this << content_type_msg;
+  if (mime_type >= MIME_TYPE_CUSTOM) {
+    println(custom_mime_types[mime_type - MIME_TYPE_CUSTOM].content_type);
+  } else {
+    if (mime_type >= MIME_TYPE_COUNT) {
+      mime_type = MIME_HTM;
+    }
+    println((const __FlashStringHelper*)pgm_read_ptr(&mime_types[mime_type]));
+  }
+}
+
+void TinyWebServer::send_content_type(const char* content_type) {
+  *this << content_type_msg;
+  println(content_type);
+}
+
+const char* TinyWebServer::get_path() { return path_; }
+
+const TinyWebServer::HttpRequestType TinyWebServer::get_type() {
+  return request_type_;
+}
+
+const char* TinyWebServer::get_header_value(const char* name,
+                                            uint16_t* length) {
+  int index = find_header(header_hash(name), name);
+  if (index < 0 || !headers_[index].offset) {
+    return NULL;
+  }
+  if (length) {
+    *length = headers_[index].length;
+  }
+  return current_->values + headers_[index].offset;
+}
+
+int parseHexChar(char ch) {
+  if (isdigit(ch)) {
+    return ch - '0';
+  }
+  ch = tolower(ch);
+  if (ch >= 'a' &&  ch <= 'f') {
+    return ch - 'a' + 10;
+  }
+  return 0;
+}
+
+// Decodes the escape sequences of the `length' characters at `s'
+// into `r', and the '+' characters into spaces if `plus_is_space'. At
+// most `size' - 1 characters are written, followed by a NUL. The
+// result is never longer than `s', so `r' can be `s'.
+static void url_decode(const char* s, int length, char* r, int size,
+                       boolean plus_is_space) {
+  if (size <= 0) {
+    return;
+  }
+  const char* end = s + length;
+  char* r_end = r + size - 1;
+  for (; s < end && r < r_end; s++) {
+    if (*s == '%' && s + 2 < end
+        && isxdigit(*(s + 1)) && isxdigit(*(s + 2))) {
+      *r++ = parseHexChar(*(s + 1)) << 4 | parseHexChar(*(s + 2));
+      s += 2;
+    } else if (*s == '+' && plus_is_space) {
+      *r++ = ' ';
+    } else {
+      // Everything else is kept as is, including a '%' that doesn't
+      // start a valid escape sequence.
+      *r++ = *s;
+    }
+  }
+  *r = 0;
+}
+
+// Decodes `s' in place.
+static void decode_in_place(char* s, boolean plus_is_space) {
+  int len = strlen(s);
+  url_decode(s, len, s, len + 1, plus_is_space);
+}
+
+char* TinyWebServer::decode_url_encoded(const char* s, TinyWebArena* arena) {
+  if (!s) {
+    return NULL;
+  }
+  char* r = (char*)alloc_from(arena, strlen(s) + 1);
+  if (!r){
+    return NULL;
+  }
+  strcpy(r, s);
+  decode_in_place(r, false);
+
+  return r;
+}
+
+const char* TinyWebServer::get_query() { return query_; }
+
+boolean TinyWebServer::get_query_param(const char* name,
+                                       char* buffer, int size) {
+  return find_query_param(query_, name, buffer, size);
+}
+
+boolean TinyWebServer::find_query_param(const char* query, const char* name,
+                                        char* buffer, int size) {
+  if (!query) {
+    return false;
+  }
+  int name_len = strlen(name);
+  const char* p = query;
+  while (*p) {
+    int len = strcspn(p, "&");
+    int key_len = strcspn(p, "=&");
+    if (key_len == name_len && !strncmp(p, name, name_len)) {
+      const char* value = p + key_len;
+      if (*value == '=') {
+        value++;
+      }
+      url_decode(value, len - (value - p), buffer, size, true);
+      return true;
+    }
+    p += len;
+    if (*p) {
+      p++;
+    }
+  }
+  return false;
+}
+
+char* TinyWebServer::get_file_from_path(const char* path,
+                                        TinyWebArena* arena) {
+  // Obtain the last path component.
+  const char* encoded_fname = strrchr(path, '/');
+  if (!encoded_fname) {
+    return NULL;
+  } else {
+    // Skip past the '/'.
+    encoded_fname++;
+  }
+  char* decoded = decode_url_encoded(encoded_fname, arena);
+  if (!decoded) {
+    return NULL;
+  }
+  for (char* p = decoded; *p; p++) {
+    *p = toupper(*p);
+  }
+  return decoded;
+}
+
+void TinyWebServer::set_custom_mime_types(const MimeTypeMapping* types) {
+  custom_mime_types = types;
+}
+
+TinyWebServer::MimeType TinyWebServer::get_mime_type_from_filename(
+    const char* filename) {
+  if (!filename) {
+    return MIME_HTM;
+  }
+
+  const char* ext = strrchr(filename, '.');
+  if (!ext) {
+    return MIME_HTM;
+  }
+  // We found an extension. Skip past the '.'
+  ext++;
+
+  // The application's types come first, so they can override the
+  // default ones.
+  for (int i = 0; custom_mime_types && custom_mime_types[i].extension; i++) {
+    if (!strcasecmp(ext, custom_mime_types[i].extension)) {
+      return MIME_TYPE_CUSTOM + i;
+    }
+  }
+
+  char upper[MAX_EXTENSION_LENGTH + 1];
+  int len = 0;
+  for (; ext[len]; len++) {
+    if (len == MAX_EXTENSION_LENGTH) {
+      return MIME_HTM;
+    }
+    upper[len] = toupper(ext[len]);
+  }
+  upper[len] = 0;
+
+  int low = 0;
+  int high = sizeof(mime_extensions) / sizeof(mime_extensions[0]) - 1;
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    int cmp = strcmp_P(upper, mime_extensions[middle].extension);
+    if (!cmp) {
+      return pgm_read_byte(&mime_extensions[middle].type);
+    } else if (cmp < 0) {
+      high = middle - 1;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return MIME_HTM;
+}
+
+const char* TinyWebServer::get_mime_extension(int index) {
+  const int count = sizeof(mime_extensions) / sizeof(mime_extensions[0]);
+  return index >= 0 && index < count ? mime_extensions[index].extension
+    : NULL;
+}
+
+void TinyWebServer::send_file(SdFile& file, uint32_t length) {
+  if (drop_output_) {
+    return;
+  }
+  // Read the file straight into the output buffer, after the pending
+  // headers, and send it a full buffer at a time.
+  int size;
+  while (length) {
+    uint16_t room = sizeof(output_) - output_len_;
+    if (room > length) {
+      room = length;
+    }
+    size = file.read(output_ + output_len_, room);
+    if (size <= 0 || !is_connected(client_)) {
+      break;
+    }
+    output_len_ += size;
+    length -= size;
+    if (output_len_ == sizeof(output_)) {
+      flush();
+    }
+  }
+  flush();
+}
+
+void TinyWebServer::send_template(SdFile& file,
+                                  const TemplateVariable* variables) {
+  Template t;
+  t.state = TEMPLATE_TEXT;
+  int size;
+  while ((size = file.read(buffer, sizeof(buffer))) > 0
+         && is_connected(client_)) {
+    render_template(t, buffer, size, variables);
+  }
+  end_template(t);
+}
+
+void TinyWebServer::send_template_P(const char* data,
+                                    const TemplateVariable* variables) {
+  Template t;
+  t.state = TEMPLATE_TEXT;
+  int size;
+  do {
+    // Copy the template out of program memory a block at a time, up
+    // to its NUL terminator.
+    for (size = 0; size < (int)sizeof(buffer); size++) {
+      buffer[size] = pgm_read_byte(data + size);
+      if (!buffer[size]) {
+        break;
+      }
+    }
+    render_template(t, buffer, size, variables);
+    data += size;
+  } while (size == sizeof(buffer) && is_connected(client_));
+  end_template(t);
+}
+
+void TinyWebServer::render_template(Template& t, const char* block, int size,
+                                    const TemplateVariable* variables) {
+  // The start of the text that wasn't sent yet.
+  int start = 0;
+  for (int i = 0; i < size; i++) {
+    char ch = block[i];
+    switch (t.state) {
+    case TEMPLATE_TEXT:
+      if (ch == '{') {
+        write((const uint8_t*)block + start, i - start);
+        t.state = TEMPLATE_OPEN;
+      }
+      break;
+
+    case TEMPLATE_OPEN:
+      if (ch == '{') {
+        t.state = TEMPLATE_NAME;
+        t.length = 0;
+      } else {
+        // Just a brace.
+        write('{');
+        t.state = TEMPLATE_TEXT;
+        start = i;
+      }
+      break;
+
+    case TEMPLATE_CLOSE:
+      if (ch == '}') {
+        t.name[t.length] = 0;
+        // Allow spaces around the name.
+        char* name = t.name + strspn(t.name, " ");
+        for (char* p = name + strlen(name); p > name && *(p - 1) == ' ';) {
+          *--p = 0;
+        }
+        const TemplateVariable* v = variables;
+        for (; v && v->name; v++) {
+          if (!strcmp(v->name, name)) {
+            (*v->fn)(*this);
+            break;
+          }
+        }
+#if DEBUG
+        if (!v || !v->name) {
+          Serial << F("TWS:Unknown template variable ") << name << "\n";
+        }
+#endif
+        t.state = TEMPLATE_TEXT;
+        start = i + 1;
+        break;
+      }
+      // The '}' is part of the name.
+      t.state = TEMPLATE_NAME;
+      if (t.length < TWS_TEMPLATE_NAME_SIZE) {
+        t.name[t.length++] = '}';
+      }
+      // Fall through.
+
+    case TEMPLATE_NAME:
+      if (ch == '}') {
+        t.state = TEMPLATE_CLOSE;
+      } else if (t.length < TWS_TEMPLATE_NAME_SIZE && ch != '\n') {
+        t.name[t.length++] = ch;
+      } else {
+        // Not a placeholder after all, send it as text.
+        end_template(t);
+        start = i;
+      }
+      break;
+    }
+  }
+  if (t.state == TEMPLATE_TEXT) {
+    write((const uint8_t*)block + start, size - start);
+  }
+}
+
+void TinyWebServer::end_template(Template& t) {
+  if (t.state != TEMPLATE_TEXT) {
+    write('{');
+  }
+  if (t.state >= TEMPLATE_NAME) {
+    write('{');
+    write((const uint8_t*)t.name, t.length);
+  }
+  if (t.state == TEMPLATE_CLOSE) {
+    write('}');
+  }
+  t.state = TEMPLATE_TEXT;
+}
+
+TinyWebServer::Transfer* TinyWebServer::new_transfer() {
+  if (pending_transfer_) {
+    // One transfer per request.
+    return NULL;
+  }
+  for (int i = 0; i < TWS_MAX_TRANSFERS; i++) {
+    Transfer& t = transfers_[i];
+    if (!t.connection) {
+      t.step = NULL;
+      t.done = NULL;
+      t.remaining = t.transferred = 0;
+      t.complete = false;
+      t.last_activity = millis();
+      return &t;
+    }
+  }
+  return NULL;
+}
+
+boolean TinyWebServer::queue_file(SdFile& file, uint32_t length,
+                                  TransferDoneFn done) {
+  if (drop_output_) {
+    // Nothing to send, the file is done with right away.
+    file.close();
+    if (done) {
+      (*done)(*this, true, 0);
+    }
+    return true;
+  }
+  Transfer* t = new_transfer();
+  if (!t) {
+    return false;
+  }
+  // The transfer outlives the handler, and so does its copy of the
+  // file.
+  t->file = file;
+  t->done = done;
+  t->remaining = length;
+  pending_transfer_ = t;
+  return true;
+}
+
+TinyWebServer::Transfer* TinyWebServer::start_transfer(TransferStepFn step,
+                                                       TransferDoneFn done,
+                                                       uint32_t length) {
+  Transfer* t = new_transfer();
+  if (!t) {
+    return NULL;
+  }
+  t->step = step;
+  t->done = done;
+  t->remaining = length;
+  pending_transfer_ = t;
+  return t;
+}
+
+void TinyWebServer::advance_transfer(Connection& c) {
+  Transfer* t = NULL;
+  for (int i = 0; i < TWS_MAX_TRANSFERS; i++) {
+    if (transfers_[i].connection == &c) {
+      t = &transfers_[i];
+    }
+  }
+  if (!t) {
+    close_connection(c);
+    return;
+  }
+
+  current_ = &c;
+  client_ = c.client;
+  body_remaining_ = t->body_remaining;
+  drop_output_ = t->drop_output;
+  boolean over = false;
+  for (int i = 0; i < TWS_TRANSFER_BLOCKS && !over; i++) {
+    over = t->step ? (*t->step)(*this, *t) : send_file_block(*t);
+  }
+  flush();
+  t->body_remaining = body_remaining_;
+  if (!over) {
+    drop_output_ = false;
+    return;
+  }
+
+  // Carry on with the connection as if the handler had just returned.
+  // A response sent by the done function closes the connection, the
+  // request it answers may not be the last one received.
+  keep_alive_ = false;
+  content_length_sent_ = false;
+  persistent_ = t->persistent;
+  persistent_ = end_transfer(*t) && persistent_;
+  finish_request(c, true);
+  drop_output_ = false;
+}
+
+boolean TinyWebServer::end_transfer(Transfer& t) {
+  Connection& c = *(Connection*)t.connection;
+  current_ = &c;
+  client_ = c.client;
+  if (t.done) {
+    (*t.done)(*this, t.complete, t.transferred);
+  }
+  if (!t.step) {
+    t.file.close();
+  }
+  t.connection = NULL;
+  return t.complete;
+}
+
+boolean TinyWebServer::send_file_block(Transfer& t) {
+  // Read the next block straight into the output buffer, like
+  // send_file().
+  uint16_t room = sizeof(output_) - output_len_;
+  if (room > t.remaining) {
+    room = t.remaining;
+  }
+  int size = room ? t.file.read(output_ + output_len_, room) : 0;
+  if (size <= 0 || !is_connected(client_)) {
+    // Reaching the end of the file completes a transfer whose length
+    // wasn't given.
+    t.complete = !t.remaining
+      || (size == 0 && t.remaining + t.transferred == 0xFFFFFFFF);
+    return true;
+  }
+  output_len_ += size;
+  t.remaining -= size;
+  t.transferred += size;
+  flush();
+  t.complete = !t.remaining;
+  return t.complete;
+}
+
+// Writes `n' in hexadecimal at `p', and returns the end of the
+// written characters.
+static char* format_hex(char* p, uint32_t n) {
+  char digits[8];
+  int len = 0;
+  do {
+    digits[len++] = "0123456789abcdef"[n & 0xF];
+    n >>= 4;
+  } while (n);
+  while (len) {
+    *p++ = digits[--len];
+  }
+  return p;
+}
+
+// Writes `n', between 0 and 99, in decimal on two digits at `p'.
+static char* format_2digits(char* p, uint8_t n) {
+  *p++ = '0' + n / 10;
+  *p++ = '0' + n % 10;
+  return p;
+}
+
+static const char day_names[] PROGMEM = "SunMonTueWedThuFriSat";
+static const char month_names[] PROGMEM =
+  "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+// Formats the FAT `date' and `time' as an HTTP date, e.g. "Sun, 06
+// Nov 1994 08:49:37 GMT", in `buf', which must have room for 30
+// characters. The card doesn't know about time zones, the time is
+// assumed to be GMT.
+static void format_http_date(char* buf, uint16_t date, uint16_t time) {
+  int year = FAT_YEAR(date);
+  uint8_t month = FAT_MONTH(date);
+  uint8_t day = FAT_DAY(date);
+
+  // Sakamoto's method for the day of the week.
+  static const uint8_t month_offsets[] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+  int y = month < 3 ? year - 1 : year;
+  uint8_t weekday = (y + y / 4 - y / 100 + y / 400
+                     + month_offsets[month - 1] + day) % 7;
+
+  char* p = buf;
+  memcpy_P(p, day_names + 3 * weekday, 3);
+  p += 3;
+  *p++ = ',';
+  *p++ = ' ';
+  p = format_2digits(p, day);
+  *p++ = ' ';
+  memcpy_P(p, month_names + 3 * (month - 1), 3);
+  p += 3;
+  *p++ = ' ';
+  p = format_2digits(p, year / 100);
+  p = format_2digits(p, year % 100);
+  *p++ = ' ';
+  p = format_2digits(p, FAT_HOUR(time));
+  *p++ = ':';
+  p = format_2digits(p, FAT_MINUTE(time));
+  *p++ = ':';
+  p = format_2digits(p, FAT_SECOND(time));
+  strcpy_P(p, PSTR(" GMT"));
+}
+
+// Parses the decimal number at `*p' into `n', and advances `*p' past
+// it. Returns false if there's no number, or if it overflows.
+static boolean parse_decimal(const char** p, uint32_t* n) {
+  const char* s = *p;
+  *n = 0;
+  while (isdigit(*s)) {
+    if (*n > (0xFFFFFFFFUL - 9) / 10) {
+      return false;
+    }
+    *n = *n * 10 + (*s++ - '0');
+  }
+  if (s == *p) {
+    return false;
+  }
+  *p = s;
+  return true;
+}
+
+int TinyWebServer::parse_range(const char* value, uint32_t size,
+                               uint32_t* first, uint32_t* last) {
+  // Only single ranges are supported: "bytes=first-last",
+  // "bytes=first-" and "bytes=-suffix_length". Anything else is
+  // ignored and the whole file is sent, as HTTP allows.
+  if (!value || strncasecmp(value, "bytes=", 6)) {
+    return RANGE_NONE;
+  }
+  const char* p = value + 6;
+  uint32_t n;
+  if (*p == '-') {
+    p++;
+    if (!parse_decimal(&p, &n) || *p) {
+      return RANGE_NONE;
+    }
+    if (!n || !size) {
+      return RANGE_UNSATISFIABLE;
+    }
+    *first = n < size ? size - n : 0;
+    *last = size - 1;
+    return RANGE_SATISFIABLE;
+  }
+
+  if (!parse_decimal(&p, first) || *p++ != '-') {
+    return RANGE_NONE;
+  }
+  if (!*p) {
+    *last = size - 1;
+  } else if (!parse_decimal(&p, last) || *p || *last < *first) {
+    return RANGE_NONE;
+  }
+  if (*first >= size) {
+    return RANGE_UNSATISFIABLE;
+  }
+  if (*last >= size) {
+    *last = size - 1;
+  }
+  return RANGE_SATISFIABLE;
+}
+
+// Returns true if the Accept-Encoding header `value' allows gzip
+// encoded responses.
+static boolean accepts_gzip(const char* value) {
+  while (value && (value = strstr(value, "gzip"))) {
+    value += 4;
+    while (*value == ' ') {
+      value++;
+    }
+    if (!*value || *value == ',') {
+      return true;
+    }
+    if (*value == ';') {
+      // Only a quality value of 0 refuses gzip.
+      const char* q = value + 1;
+      while (*q == ' ') {
+        q++;
+      }
+      if (!strncmp(q, "q=0", 3)) {
+        q += 3;
+        if (*q == '.') {
+          q++;
+        }
+        while (*q == '0') {
+          q++;
+        }
+        if (!*q || *q == ',' || *q == ' ') {
+          continue;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+char* TinyWebServer::get_gzip_file_name(const char* filename, char* buf,
+                                        int size) {
+  // The 8.3 file names leave room for 3 characters of extension, so
+  // "JQUERY.JS" becomes "JQUERY.JGZ".
+  const char* ext = strrchr(filename, '.');
+  if (!ext || !ext[1]) {
+    return NULL;
+  }
+  int len = ext - filename + 2;
+  if (len + 3 > size) {
+    return NULL;
+  }
+  memcpy(buf, filename, len);
+  strcpy(buf + len, "GZ");
+  return buf;
+}
+
+// Directory entry indexes of files not looked up yet, and of files
+// that don't exist, TinyWebServer::NO_FILE_INDEX.
+#define UNKNOWN_FILE 0xFFFE
+#define NO_FILE 0xFFFF
+
+// Returns true if the directory entry of `file' is that of the file
+// `name'. The entry holds the name in the 8.3 format, e.g. "JQUERY  JS ".
+static boolean dir_entry_matches(SdFile& file, const char* name) {
+  dir_t entry;
+  if (!file.dirEntry(&entry)) {
+    return false;
+  }
+  uint8_t i = 0;
+  for (; *name && *name != '.'; name++) {
+    if (i == 8 || entry.name[i++] != toupper(*name)) {
+      return false;
+    }
+  }
+  while (i < 8) {
+    if (entry.name[i++] != ' ') {
+      return false;
+    }
+  }
+  if (*name == '.') {
+    name++;
+  }
+  for (; *name; name++) {
+    if (i == 11 || entry.name[i++] != toupper(*name)) {
+      return false;
+    }
+  }
+  while (i < 11) {
+    if (entry.name[i++] != ' ') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Opens the file `name' in `dir', by its directory entry `*index' when
+// it's known, and records its index otherwise.
+static boolean open_file_at(SdFile& file, SdFile& dir, const char* name,
+                            uint16_t* index) {
+  if (*index == NO_FILE) {
+    return false;
+  }
+  if (*index != UNKNOWN_FILE) {
+    if (file.open(&dir, *index, O_READ)) {
+      if (dir_entry_matches(file, name)) {
+        return true;
+      }
+      file.close();
+    }
+  }
+  // Look the name up in the directory, which leaves the directory
+  // positioned right after the file's entry.
+  if (file.open(&dir, name, O_READ)) {
+    *index = dir.curPosition() / 32 - 1;
+    return true;
+  }
+  *index = NO_FILE;
+  return false;
+}
+
+boolean TinyWebServer::open_file(SdFile& dir, const char* filename,
+                                 boolean gzip, SdFile& file,
+                                 boolean* gzipped, boolean* has_gzip) {
+  char gzip_name[13];
+  boolean has_gzip_name =
+    get_gzip_file_name(filename, gzip_name, sizeof(gzip_name));
+
+  // The directory entry indexes of the file and its compressed
+  // version, remembered across requests when there's room in the
+  // cache.
+  uint16_t indexes[2] = { UNKNOWN_FILE, UNKNOWN_FILE };
+  uint16_t* index = indexes;
+#if TWS_FILE_CACHE_SIZE > 0
+  CachedFile* cached = find_cached_file(dir, filename);
+  if (cached) {
+    index = cached->index;
+  }
+#endif
+
+  // Whether there's a compressed version matters even to the clients
+  // that don't get it, the response varies with Accept-Encoding.
+  *gzipped = *has_gzip = false;
+  if (has_gzip_name && index[1] != NO_FILE) {
+    if (gzip) {
+      *gzipped = *has_gzip = open_file_at(file, dir, gzip_name, &index[1]);
+    } else if (index[1] == UNKNOWN_FILE) {
+      *has_gzip = open_file_at(file, dir, gzip_name, &index[1]);
+      file.close();
+    } else {
+      *has_gzip = true;
+    }
+  }
+  return *gzipped || open_file_at(file, dir, filename, &index[0]);
+}
+
+#if TWS_FILE_CACHE_SIZE > 0
+TinyWebServer::CachedFile* TinyWebServer::find_cached_file(
+    SdFile& dir, const char* filename) {
+  if (strlen(filename) >= sizeof(file_cache_[0].name)) {
+    return NULL;
+  }
+  CachedFile* r = NULL;
+  CachedFile* victim = NULL;
+  for (int i = 0; i < TWS_FILE_CACHE_SIZE; i++) {
+    CachedFile& e = file_cache_[i];
+    if (e.dir == &dir && !strcasecmp(e.name, filename)) {
+      r = &e;
+      break;
+    }
+    // Replace a free entry, or the least recently used one.
+    if (!victim || (victim->dir && (!e.dir || e.age > victim->age))) {
+      victim = &e;
+    }
+  }
+  if (!r) {
+    r = victim;
+    r->dir = &dir;
+    strcpy(r->name, filename);
+    r->index[0] = r->index[1] = UNKNOWN_FILE;
+  }
+
+  // The entries more recent than this one get older.
+  for (int i = 0; i < TWS_FILE_CACHE_SIZE; i++) {
+    if (file_cache_[i].age < r->age) {
+      file_cache_[i].age++;
+    }
+  }
+  r->age = 0;
+  return r;
+}
+#endif
+
+void TinyWebServer::invalidate_cached_file(const char* filename) {
+#if TWS_FILE_CACHE_SIZE > 0
+  if (!filename) {
+    return;
+  }
+  char gzip_name[13];
+  for (int i = 0; i < TWS_FILE_CACHE_SIZE; i++) {
+    CachedFile& e = file_cache_[i];
+    if (e.dir
+        && (!strcasecmp(e.name, filename)
+            || (get_gzip_file_name(e.name, gzip_name, sizeof(gzip_name))
+                && !strcasecmp(gzip_name, filename)))) {
+      e.dir = NULL;
+    }
+  }
+#endif
+}
+
+boolean TinyWebServer::get_cached_file_index(SdFile& dir,
+                                            const char* filename,
+                                            uint16_t* index) {
+#if TWS_FILE_CACHE_SIZE > 0
+  for (int i = 0; i < TWS_FILE_CACHE_SIZE; i++) {
+    CachedFile& e = file_cache_[i];
+    if (e.dir == &dir && !strcasecmp(e.name, filename)) {
+      *index = e.index[0];
+      return *index != UNKNOWN_FILE;
+    }
+  }
+#endif
+  return false;
+}
+
+void TinyWebServer::clear_file_cache() {
+#if TWS_FILE_CACHE_SIZE > 0
+  for (int i = 0; i < TWS_FILE_CACHE_SIZE; i++) {
+    file_cache_[i].dir = NULL;
+  }
+#endif
+}
+
+boolean TinyWebServer::serve_file(SdFile& dir, const char* filename) {
+  SdFile file;
+  if (!filename) {
+    return false;
+  }
+
+  // Prefer a precompressed version of the file, if there's one and
+  // the client can handle it.
+  boolean gzipped;
+  boolean has_gzip;
+  if (!open_file(dir, filename,
+                 accepts_gzip(get_header_value("Accept-Encoding")),
+                 file, &gzipped, &has_gzip)) {
+    return false;
+  }
+
+  // The validators: an entity tag made of the file's size and
+  // modification time, and the modification time itself.
+  char etag[24];
+  char last_modified[30];
+  dir_t entry;
+  boolean has_validators = file.dirEntry(&entry)
+    && FAT_MONTH(entry.lastWriteDate) >= 1
+    && FAT_MONTH(entry.lastWriteDate) <= 12
+    && FAT_DAY(entry.lastWriteDate) >= 1;
+  boolean not_modified = false;
+  if (has_validators) {
+    char* p = etag;
+    *p++ = '"';
+    p = format_hex(p, file.fileSize());
+    *p++ = '-';
+    p = format_hex(p, ((uint32_t)entry.lastWriteDate << 16)
+                   | entry.lastWriteTime);
+    *p++ = '"';
+    *p = 0;
+    format_http_date(last_modified, entry.lastWriteDate, entry.lastWriteTime);
+
+    // If-None-Match takes precedence over If-Modified-Since. Clients
+    // send back the Last-Modified value they got, so the dates are
+    // simply compared as strings.
+    const char* if_none_match = get_header_value("If-None-Match");
+    const char* if_modified_since = get_header_value("If-Modified-Since");
+    if (if_none_match) {
+      not_modified = !strcmp(if_none_match, "*")
+        || strstr(if_none_match, etag);
+    } else if (if_modified_since) {
+      not_modified = !strcmp(if_modified_since, last_modified);
+    }
+  }
+
+  // A Range only applies to the version of the file named by
+  // If-Range, if any.
+  uint32_t size = file.fileSize();
+  uint32_t first = 0;
+  uint32_t last = size - 1;
+  int range = RANGE_NONE;
+  if (!not_modified && request_type_ == GET) {
+    const char* if_range = get_header_value("If-Range");
+    if (!if_range
+        || (has_validators
+            && (!strcmp(if_range, etag) || !strcmp(if_range, last_modified)))) {
+      range = parse_range(get_header_value("Range"), size, &first, &last);
+    }
+  }
+
+  int code = 200;
+  if (not_modified) {
+    code = 304;
+  } else if (range == RANGE_UNSATISFIABLE) {
+    code = 416;
+  } else if (range == RANGE_SATISFIABLE) {
+    code = 206;
+  }
+  send_status_line(*this, code);
+  if (has_validators) {
+    *this << F("ETag: ") << etag << F("\r\n");
+    *this << F("Last-Modified: ") << last_modified << F("\r\n");
+    *this << F("Cache-Control: max-age=");
+    println(cache_max_age_, DEC);
+  }
+  if (has_gzip) {
+    *this << F("Vary: Accept-Encoding\r\n");
+  }
+  if (code == 304) {
+    // A 304 response never has a body, the connection can be reused
+    // right away.
+    content_length_sent_ = true;
+    end_headers();
+  } else if (code == 416) {
+    *this << F("Content-Range: bytes */");
+    println(size, DEC);
+    send_content_length(0);
+    end_headers();
+  } else {
+    *this << F("Accept-Ranges: bytes\r\n");
+    send_content_type(get_mime_type_from_filename(filename));
+    if (gzipped) {
+      *this << F("Content-Encoding: gzip\r\n");
+    }
+    if (code == 206) {
+      *this << F("Content-Range: bytes ");
+      print(first, DEC);
+      write('-');
+      print(last, DEC);
+      write('/');
+      println(size, DEC);
+      file.seekSet(first);
+    }
+    send_content_length(last - first + 1);
+    end_headers();
+    // Large files are sent over the next calls to process(), so they
+    // don't hold up everything else.
+    uint32_t length = last - first + 1;
+    if (length > sizeof(output_) - output_len_ && queue_file(file, length)) {
+      return true;
+    }
+    send_file(file, length);
+  }
+  file.close();
+  return true;
+}
+
+boolean TinyWebServer::serve_bundle_file(
+    const TinyWebBundleHandler::File* bundle) {
+  if (!bundle || !path_) {
+    return false;
+  }
+  size_t len = strlen(path_);
+  TinyWebBundleHandler::File file;
+  while (1) {
+    memcpy_P(&file, bundle++, sizeof(file));
+    if (!file.path) {
+      return false;
+    }
+    if (strlen_P(file.path) == len && !strncasecmp_P(path_, file.path, len)) {
+      break;
+    }
+  }
+
+  if (file.gzipped && !accepts_gzip(get_header_value("Accept-Encoding"))) {
+    send_status_line(*this, 406);
+    send_content_length(0);
+    end_headers();
+    return true;
+  }
+
+  char etag[24];
+  strncpy_P(etag, file.etag, sizeof(etag) - 1);
+  etag[sizeof(etag) - 1] = 0;
+  const char* if_none_match = get_header_value("If-None-Match");
+  boolean not_modified = if_none_match
+    && (!strcmp(if_none_match, "*") || strstr(if_none_match, etag));
+
+  send_status_line(*this, not_modified ? 304 : 200);
+  *this << F("ETag: ") << etag << F("\r\n");
+  *this << F("Cache-Control: max-age=");
+  println(cache_max_age_, DEC);
+  if (file.gzipped) {
+    *this << F("Vary: Accept-Encoding\r\n");
+  }
+  if (not_modified) {
+    content_length_sent_ = true;
+    end_headers();
+    return true;
+  }
+  *this << (const __FlashStringHelper*)file.headers;
+  content_length_sent_ = true;
+  end_headers();
+
+  // Copy the data from program memory a full output buffer at a time.
+  const uint8_t* data = file.data;
+  uint32_t size = file.size;
+  while (size && !drop_output_ && is_connected(client_)) {
+    uint16_t n = sizeof(output_) - output_len_;
+    if (n > size) {
+      n = size;
+    }
+    memcpy_P(output_ + output_len_, data, n);
+    output_len_ += n;
+    data += n;
+    size -= n;
+    if (output_len_ == sizeof(output_)) {
+      flush();
+    }
+  }
+  return true;
+}
+
+size_t TinyWebServer::write(uint8_t c) {
+  if (drop_output_) {
+    return 1;
+  }
+  if (output_len_ == sizeof(output_)) {
+    flush();
+  }
+  output_[output_len_++] = c;
+  return 1;
+}
+
+size_t TinyWebServer::write(const char *str) {
+  return write((const uint8_t*)str, strlen(str));
+}
+
+size_t TinyWebServer::write(const uint8_t *buffer, size_t size) {
+  if (drop_output_) {
+    return size;
+  }
+  if (size > sizeof(output_) - output_len_) {
+    flush();
+    if (size >= sizeof(output_) && !output_start_) {
+      // Too big to be worth copying.
+      send(buffer, size);
+      return size;
+    }
+  }
+  // Chunks are framed in the output buffer, so the data has to go
+  // through it.
+  size_t written = size;
+  while (size) {
+    size_t n = sizeof(output_) - output_len_;
+    if (n > size) {
+      n = size;
+    }
+    memcpy(output_ + output_len_, buffer, n);
+    output_len_ += n;
+    buffer += n;
+    size -= n;
+    if (size) {
+      flush();
+    }
+  }
+  return written;
+}
+
+void TinyWebServer::flush() {
+  if (output_start_) {
+    flush_chunk(false);
+  } else if (output_len_) {
+    send(output_, output_len_);
+    output_len_ = 0;
+  }
+}
+
+void TinyWebServer::send(const uint8_t* data, size_t size) {
+  if (drop_output_) {
+    return;
+  }
+  send(client_, data, size);
+}
+
+void TinyWebServer::send(EthernetClient& client, const uint8_t* data,
+                         size_t size) {
+  write_block(client, data, size);
+}
+
+void TinyWebServer::write_block(Client& client, const uint8_t* buffer,
+                                size_t size) {
+#if TWS_STATS
+  stats.bytes_out += size;
+#endif
+  client.write(buffer, size);
+}
+
+void TinyWebServer::flush_chunk(boolean last) {
+  // The buffer holds the response's headers, if they weren't sent
+  // yet, followed by CHUNK_HEADER_SIZE bytes of room for the chunk's
+  // size line, and the chunk's data.
+  uint16_t headers_len = output_start_ - CHUNK_HEADER_SIZE;
+  uint16_t size = output_len_ - output_start_;
+
+  // The size line, right before the data, ends the previous chunk as
+  // well.
+  char line[CHUNK_HEADER_SIZE];
+  uint8_t len = 0;
+  if (size) {
+    if (chunk_sent_) {
+      line[len++] = '\r';
+      line[len++] = '\n';
+    }
+    char digits[4];
+    uint8_t n = 0;
+    uint16_t v = size;
+    do {
+      digits[n++] = "0123456789abcdef"[v & 0xF];
+      v >>= 4;
+    } while (v);
+    while (n) {
+      line[len++] = digits[--n];
+    }
+    line[len++] = '\r';
+    line[len++] = '\n';
+    chunk_sent_ = true;
+  }
+  uint16_t start = output_start_ - len;
+  memcpy(output_ + start, line, len);
+  if (headers_len) {
+    memmove(output_ + start - headers_len, output_, headers_len);
+    start -= headers_len;
+  }
+
+  if (last) {
+    // The last chunk has a size of 0, and is followed by an empty
+    // line.
+    static const char last_chunk[] = "\r\n0\r\n\r\n";
+    const char* p = chunk_sent_ ? last_chunk : last_chunk + 2;
+    uint8_t n = strlen(p);
+    if (n > sizeof(output_) - output_len_) {
+      send(output_ + start, output_len_ - start);
+      start = output_len_ = 0;
+    }
+    memcpy(output_ + output_len_, p, n);
+    output_len_ += n;
+    output_start_ = 0;
+  }
+
+  if (output_len_ > start) {
+    send(output_ + start, output_len_ - start);
+  }
+  if (!last) {
+    output_start_ = CHUNK_HEADER_SIZE;
+  }
+  output_len_ = output_start_;
+}
+
+int TinyWebServer::read_block(Client& client, uint8_t* buffer, int size) {
+  // Non-blocking: the Ethernet library returns -1 when no data is
+  // available yet.
+  int n = client.read(buffer, size);
+  if (n <= 0) {
+    return 0;
+  }
+#if TWS_STATS
+  stats.bytes_in += n;
+#endif
+  return n;
+}
+
+int TinyWebServer::read(uint8_t* buffer, int size) {
+  if (size > body_remaining_) {
+    size = body_remaining_;
+  }
+  if (size <= 0) {
+    return 0;
+  }
+  // First hand out what was read along with the headers.
+  Connection& c = *current_;
+  int n = c.input_len - c.input_pos;
+  if (n > 0) {
+    if (n > size) {
+      n = size;
+    }
+    memcpy(buffer, c.input + c.input_pos, n);
+    c.input_pos += n;
+  } else {
+    n = read_block(client_, buffer, size);
+  }
+  body_remaining_ -= n;
+  return n;
+}
+
+int TinyWebServer::read() {
+  uint8_t ch;
+  return read(&ch, 1) ? ch : -1;
+}
+
+boolean TinyWebServer::read_form(FormFieldFn fn) {
+  return read_form(fn, NULL);
+}
+
+boolean TinyWebServer::read_form(FormField* fields) {
+  for (FormField* f = fields; f->name; f++) {
+    f->found = false;
+    if (f->size) {
+      f->value[0] = 0;
+    }
+  }
+  return read_form(NULL, fields);
+}
+
+boolean TinyWebServer::read_form(FormFieldFn fn, FormField* fields) {
+  // The name and the value of the current field, one after the other
+  // and each NUL terminated. `value' is the offset of the value, or 0
+  // while reading the name.
+  char field[TWS_FORM_FIELD_SIZE];
+  int len = 0;
+  int value = 0;
+
+  uint32_t start_time = millis();
+  while (1) {
+    int ch = read();
+    if (ch == -1) {
+      if (!body_remaining_) {
+        // The end of the body ends the last field.
+        ch = '&';
+      } else if (!is_connected(client_)) {
+        return false;
+      } else if (millis() - start_time > BODY_TIMEOUT) {
+        COUNT(timeouts);
+        return false;
+      } else {
+        continue;
+      }
+    } else {
+      start_time = millis();
+    }
+
+    if (ch == '&') {
+      if (len) {
+        field[len] = 0;
+        if (!value) {
+          // A field without a value.
+          value = len + 1;
+          field[value] = 0;
+        }
+        form_field(fn, fields, field, field + value);
+      }
+      if (!body_remaining_) {
+        return true;
+      }
+      len = value = 0;
+    } else if (ch == '=' && !value) {
+      field[len] = 0;
+      value = ++len;
+    } else if (len < (int)sizeof(field) - 2) {
+      // Leave room for the terminators of the name and of the value,
+      // the characters that don't fit are dropped.
+      field[len++] = ch;
+    }
+  }
+}
+
+void TinyWebServer::form_field(FormFieldFn fn, FormField* fields,
+                               char* name, char* value) {
+  decode_in_place(name, true);
+  decode_in_place(value, true);
+#if DEBUG
+  Serial << F("TWS:Form field ") << name << F("=") << value << "\n";
+#endif
+  if (fn) {
+    (*fn)(*this, name, value);
+    return;
+  }
+  for (FormField* f = fields; f->name; f++) {
+    if (!f->found && !strcmp(f->name, name)) {
+      f->found = true;
+      if (f->size) {
+        strncpy(f->value, value, f->size - 1);
+        f->value[f->size - 1] = 0;
+      }
+      return;
+    }
+  }
+}
+
+// Returns a newly allocated string containing the field number `which`.
+// The first field's index is 0.
+// Unless allocated from `arena', the caller is responsible for freeing
+// the returned value.
+char* TinyWebServer::get_field(const char* buffer, int which,
+                               TinyWebArena* arena) {
+  char* field = NULL;
+  int i = 0;
+  int field_no = 0;
+  int size = strlen(buffer);
+
+  // Locate the field we need. A field is defined as an area of
+  // non-space characters delimited by one or more space characters.
+  for (; field_no < which; field_no++) {
+    // Skip over space characters
+    while (i < size && isspace(buffer[i])) {
+      i++;
+    }
+    // Skip over non-space characters.
+    while (i < size && !isspace(buffer[i])) {
+      i++;
+    }
+  }
+
+  // Now we identify the end of the field that we want.
+  // Skip over space characters.
+  while (i < size && isspace(buffer[i])) {
+    i++;
+  }
+
+  if (field_no == which && i < size) {
+    // Now identify where the field ends.
+    int j = i;
+    while (j < size && !isspace(buffer[j])) {
+      j++;
+    }
+
+    field = (char*) alloc_from(arena, j - i + 1);
+    if (!field) {
+      return NULL;
+    }
+    memcpy(field, buffer + i, j - i);
+    field[j - i] = 0;
+  }
+  return field;
+}
+
+// The PUT handler.
+
+namespace TinyWebPutHandler {
+
+HandlerFn put_handler_fn = NULL;
+ProgressFn put_progress_fn = NULL;
+Stats put_stats;
+
+// The state of the upload in progress. Its block is NULL when there's
+// none.
+static char* block = NULL;
+static int block_size;
+static int fill;
+static uint32_t put_start;
+static char name[13];
+
+// Hands the block over to put_handler_fn.
+static void write_block(TinyWebServer& web_server, uint32_t received) {
+  uint32_t write_start = millis();
+  if (put_handler_fn) {
+    (*put_handler_fn)(web_server, WRITE, block, fill);
+  }
+  put_stats.write_millis += millis() - write_start;
+  put_stats.blocks++;
+  put_stats.received = received;
+  fill = 0;
+}
+
+// Reads what's arrived of the upload, without waiting for more.
+static boolean put_step(TinyWebServer& web_server,
+                        TinyWebServer::Transfer& t) {
+  if (!t.remaining || !web_server.is_connected(web_server.get_client())) {
+    t.complete = !t.remaining;
+    return true;
+  }
+  int16_t size = web_server.read((uint8_t*)block + fill, block_size - fill);
+  if (!size) {
+    if (millis() - t.last_activity > 30000) {
+      // Give up if there has been zero data from the connected
+      // client for more than 30 seconds.
+#if DEBUG
+      Serial << F("TWS:There has been no data for >30 Sec.\n");
+#endif
+      COUNT(timeouts);
+      return true;
+    }
+    return false;
+  }
+  t.last_activity = millis();
+  t.remaining -= size;
+  t.transferred += size;
+  fill += size;
+
+  if (fill == block_size || !t.remaining) {
+    write_block(web_server, t.transferred);
+    if (put_progress_fn) {
+      (*put_progress_fn)(web_server, t.transferred, put_stats.length);
+    }
+  }
+  return false;
+}
+
+static void put_done(TinyWebServer& web_server, boolean complete,
+                     uint32_t received) {
+  if (fill) {
+    // The upload was cut short in the middle of a block.
+    write_block(web_server, received);
+  }
+  if (put_handler_fn) {
+    (*put_handler_fn)(web_server, END, NULL, 0);
+  }
+  block = NULL;
+  put_stats.millis = millis() - put_start;
+#if DEBUG
+  Serial << F("TWS:Received ") << put_stats.received << F(" bytes in ")
+         << put_stats.millis << F(" millis, ") << put_stats.write_millis
+         << F(" spent writing\n");
+#endif
+
+  // The file was most likely stored under the name from the path.
+  web_server.invalidate_cached_file(name);
+}
+
+boolean put_handler(TinyWebServer& web_server) {
+  const char* length_str = web_server.get_header_value("Content-Length");
+  uint32_t length = length_str ? atol(length_str) : 0;
+
+  // The data is received over the next calls to process(), into the
+  // transfer's block. Only one upload at a time.
+  TinyWebServer::Transfer* t = block ? NULL
+    : web_server.start_transfer(&put_step, &put_done, length);
+  if (!t) {
+    send_status_line(web_server, 503);
+    web_server.send_content_length(0);
+    web_server.end_headers();
+    return true;
+  }
+  web_server.send_error_code(200);
+  web_server.end_headers();
+  web_server.flush();
+
+  // Hand the data over in whole SD card sectors, so the file is
+  // written a sector at a time.
+  block = t->block;
+  block_size = sizeof(t->block);
+  fill = 0;
+
+  memset(&put_stats, 0, sizeof(put_stats));
+  put_stats.length = length;
+  put_start = millis();
+  const char* filename =
+    TinyWebServer::get_file_from_path(web_server.get_path(),
+                                      &web_server.get_arena());
+  name[0] = 0;
+  if (filename) {
+    strncpy(name, filename, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+  }
+
+  if (put_handler_fn) {
+    (*put_handler_fn)(web_server, START, NULL, length);
+  }
+  return true;
+}
+
+};
+
+// The multipart/form-data parser.
+
+boolean TinyWebMultipartParser::get_header_param(const char* value,
+                                                 const char* name,
+                                                 char* buffer, int size) {
+  int name_len = strlen(name);
+  // The parameters follow the value itself, each after a ';'.
+  while (value && (value = strchr(value, ';'))) {
+    value++;
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+    if (strncasecmp(value, name, name_len) || value[name_len] != '=') {
+      continue;
+    }
+    value += name_len + 1;
+    char end = ';';
+    if (*value == '"') {
+      end = '"';
+      value++;
+    }
+    int len = 0;
+    while (*value && *value != end && (end == '"' || *value != ' ')) {
+      if (len + 1 < size) {
+        buffer[len++] = *value;
+      }
+      value++;
+    }
+    buffer[len] = 0;
+    return true;
+  }
+  return false;
+}
+
+boolean TinyWebMultipartParser::begin(const char* content_type,
+                                      TinyWebMultipartHandler::HandlerFn fn,
+                                      char* block, int size) {
+  state_ = MULTIPART_PREAMBLE;
+  if (!content_type || strncasecmp(content_type, "multipart/", 10)) {
+    return false;
+  }
+  memcpy(delimiter_, "\r\n--", 4);
+  if (!get_header_param(content_type, "boundary", delimiter_ + 4,
+                        sizeof(delimiter_) - 4)
+      || !delimiter_[4]) {
+    return false;
+  }
+  delimiter_len_ = strlen(delimiter_);
+  // The body starts right with the dashes of the first boundary.
+  match_ = 2;
+  fn_ = fn;
+  block_ = block;
+  block_size_ = size;
+  fill_ = 0;
+  return true;
+}
+
+void TinyWebMultipartParser::parse(TinyWebServer& web_server,
+                                   const uint8_t* data, int size) {
+  const char* p = (const char*)data;
+  const char* end = p + size;
+  while (p < end) {
+    if (state_ == MULTIPART_PREAMBLE || state_ == MULTIPART_DATA) {
+      if (!match_) {
+        // Skip to the next CR in one go, the boundary can't start
+        // before it.
+        const char* cr = (const char*)memchr(p, '\r', end - p);
+        if (!cr) {
+          cr = end;
+        }
+        if (state_ == MULTIPART_DATA) {
+          add_data(web_server, p, cr - p);
+        }
+        p = cr;
+        if (p == end) {
+          break;
+        }
+      }
+      char ch = *p++;
+      if (ch == delimiter_[match_]) {
+        if (++match_ == delimiter_len_) {
+          // The end of the part, if there's one.
+          if (state_ == MULTIPART_DATA) {
+            flush_block(web_server);
+            if (fn_) {
+              (*fn_)(web_server, TinyWebPutHandler::END, part_, NULL, 0);
+            }
+          }
+          match_ = 0;
+          state_ = MULTIPART_BOUNDARY;
+        }
+        continue;
+      }
+      // What was matched turned out to be data. The boundary has no
+      // CR, so it can only start again at `ch'.
+      if (state_ == MULTIPART_DATA) {
+        add_data(web_server, delimiter_, match_);
+      }
+      match_ = ch == delimiter_[0];
+      if (!match_ && state_ == MULTIPART_DATA) {
+        add_data(web_server, &ch, 1);
+      }
       continue;
     }
-    start_time = millis();
-#if DEBUG
-    Serial.print(ch);
-#endif
-    switch (state) {
-    case START_LINE:
-      if (ch == '\r') {
-	break;
+
+    char ch = *p++;
+    switch (state_) {
+    case MULTIPART_BOUNDARY:
+      // The boundary is followed by two dashes if it's the last one,
+      // by the part's headers otherwise.
+      if (ch == '-') {
+        state_ = MULTIPART_BOUNDARY_DASH;
       } else if (ch == '\n') {
-	state = END_HEADERS;
-      } else if (isalnum(ch) || ch == '-') {
-	pos = 0;
-	buffer[pos++] = ch;
-	state = HEADER_NAME;
-      } else {
-	state = ERROR;
+        memset(&part_, 0, sizeof(part_));
+        fill_ = 0;
+        state_ = MULTIPART_HEADERS;
       }
       break;
-
-    case HEADER_NAME:
-      if (pos + 1 >= sizeof(buffer)) {
-	state = ERROR;
-	break;
-      }
-      if (ch == ':') {
-	buffer[pos] = 0;
-	header = buffer;
-	if (is_requested_header(&header)) {
-	  state = HEADER_VALUE_SKIP_INITIAL_SPACES;
-	} else {
-	  state = HEADER_IGNORE_VALUE;
-	}
-	pos = 0;
-      } else if (isalnum(ch) || ch == '-') {
-	buffer[pos++] = ch;
-      } else {
-	state = ERROR;
-	break;
-      }
+    case MULTIPART_BOUNDARY_DASH:
+      state_ = ch == '-' ? MULTIPART_DONE : MULTIPART_BOUNDARY;
       break;
-
-    case HEADER_VALUE_SKIP_INITIAL_SPACES:
-      if (pos + 1 >= sizeof(buffer)) {
-	state = ERROR;
-	break;
+    case MULTIPART_HEADERS:
+      if (ch != '\n') {
+        // Keep the line in the block, which holds no data yet.
+        if (fill_ + 1 < block_size_) {
+          block_[fill_++] = ch;
+        }
+        break;
       }
-      if (ch != ' ') {
-	buffer[pos++] = ch;
-	state = HEADER_VALUE;
+      if (fill_ && block_[fill_ - 1] == '\r') {
+        fill_--;
       }
-      break;
-
-    case HEADER_VALUE:
-      if (pos + 1 >= sizeof(buffer)) {
-	state = ERROR;
-	break;
-      }
-      if (ch == '\n') {
-	buffer[pos] = 0;
-	if (!assign_header_value(header, buffer)) {
-	  state = ERROR;
-	  break;
-	}
-	state = START_LINE;
+      block_[fill_] = 0;
+      if (fill_) {
+        header_line();
       } else {
-	if (ch != '\r') {
-	  buffer[pos++] = ch;
-	}
-      }
-      break;
-
-    case HEADER_IGNORE_VALUE:
-      if (ch == '\n') {
-	state = START_LINE;
+        // An empty line ends the headers.
+        if (fn_) {
+          (*fn_)(web_server, TinyWebPutHandler::START, part_, NULL, 0);
+        }
+        state_ = MULTIPART_DATA;
       }
+      fill_ = 0;
       break;
-
     default:
+      // Ignore what follows the closing boundary.
+      p = end;
       break;
     }
+  }
+}
 
-    if (state == END_HEADERS) {
-      break;
+boolean TinyWebMultipartParser::end(TinyWebServer& web_server) {
+  if (state_ == MULTIPART_DATA) {
+    // The part was cut short, along with the boundary that may have
+    // been matched.
+    flush_block(web_server);
+    if (fn_) {
+      (*fn_)(web_server, TinyWebPutHandler::END, part_, NULL, 0);
     }
-    if (state == ERROR) {
-      return false;
+  }
+  return done();
+}
+
+void TinyWebMultipartParser::add_data(TinyWebServer& web_server,
+                                      const char* data, int size) {
+  while (size > 0) {
+    int n = block_size_ - fill_;
+    if (n > size) {
+      n = size;
+    }
+    memcpy(block_ + fill_, data, n);
+    fill_ += n;
+    data += n;
+    size -= n;
+    if (fill_ == block_size_) {
+      flush_block(web_server);
     }
   }
-  return true;
 }
 
-void TinyWebServer::process() {
-  client_ = server_.available();
-  if (!client_.connected() || !client_.available()) {
-    return;
+void TinyWebMultipartParser::flush_block(TinyWebServer& web_server) {
+  if (fill_ && fn_) {
+    (*fn_)(web_server, TinyWebPutHandler::WRITE, part_, block_, fill_);
   }
+  fill_ = 0;
+}
 
-  boolean is_complete = get_line(buffer, sizeof(buffer));
-  if (!buffer[0]) {
+void TinyWebMultipartParser::header_line() {
+  char* value = strchr(block_, ':');
+  if (!value) {
     return;
   }
-#if DEBUG
-  Serial << F("TWS:New request: ");
-  Serial.println(buffer);
-#endif
-  if (!is_complete) {
-    // The requested path is too long.
-    send_error_code(414);
-    client_.stop();
-    return;
+  *value++ = 0;
+  while (*value == ' ' || *value == '\t') {
+    value++;
+  }
+  if (!strcasecmp(block_, "Content-Disposition")) {
+    get_header_param(value, "name", part_.name, sizeof(part_.name));
+    get_header_param(value, "filename", part_.filename,
+                     sizeof(part_.filename));
+  } else if (!strcasecmp(block_, "Content-Type")) {
+    strncpy(part_.content_type, value, sizeof(part_.content_type) - 1);
   }
+}
 
-  char* request_type_str = get_field(buffer, 0);
-  request_type_ = UNKNOWN_REQUEST;
-  if (!strcmp("GET", request_type_str)) {
-    request_type_ = GET;
-  } else if (!strcmp("POST", request_type_str)) {
-    request_type_ = POST;
-  } else if (!strcmp("PUT", request_type_str)) {
-    request_type_ = PUT;
-  } else if (!strcmp("DELETE", request_type_str)) {
-    request_type_ = DELETE;
-  }
-  
-  path_ = get_field(buffer, 1);
-
-  // Process the headers.
-  if (!process_headers()) {
-    // Malformed header line.
-    send_error_code(417);
-    client_.stop();
-  }
-  // Header processing finished. Identify the handler to call.
+// The multipart/form-data handler.
 
-  boolean should_close = true;
-  boolean found = false;
-  for (int i = 0; handlers_[i].path; i++) {
-    int len = strlen(handlers_[i].path);
-    boolean exact_match = !strcmp(path_, handlers_[i].path);
-    boolean regex_match = false;
-    if (handlers_[i].path[len - 1] == '*') {
-      regex_match = !strncmp(path_, handlers_[i].path, len - 1);
-    }
-    if ((exact_match || regex_match)
-	&& (handlers_[i].type == ANY || handlers_[i].type == request_type_)) {
-      found = true;
-      should_close = (handlers_[i].handler)(*this);
-      break;
-    }
-  }
+namespace TinyWebMultipartHandler {
 
-  if (!found) {
-    send_error_code(404);
-    // (*this) << F("URL not found: ");
-    // client_->print(path_);
-    // client_->println();
-  }
-  if (should_close) {
-    client_.stop();
-  }
+HandlerFn multipart_handler_fn = NULL;
 
-  free(path_);
-  free(request_type_str);
-}
+// The body being received. Its block is NULL when there's none.
+static TinyWebMultipartParser parser;
+static char* block = NULL;
 
-boolean TinyWebServer::is_requested_header(const char** header) {
-  if (!headers_) {
-    return false;
+// Forgets the uploaded files in the file cache, like put_handler().
+static void handle_part(TinyWebServer& web_server,
+                        TinyWebPutHandler::PutAction action,
+                        const Part& part, char* buffer, int size) {
+  if (multipart_handler_fn) {
+    (*multipart_handler_fn)(web_server, action, part, buffer, size);
   }
-  for (int i = 0; headers_[i].header; i++) {
-    if (!strcmp(*header, headers_[i].header)) {
-      *header = headers_[i].header;
-      return true;
-    }
+  if (action == TinyWebPutHandler::END && part.filename[0]) {
+    web_server.invalidate_cached_file(part.filename);
   }
-  return false;
 }
 
-boolean TinyWebServer::assign_header_value(const char* header, char* value) {
-  if (!headers_) {
-    return false;
+// Parses what's arrived of the body, without waiting for more.
+static boolean multipart_step(TinyWebServer& web_server,
+                              TinyWebServer::Transfer& t) {
+  if (!t.remaining || parser.done()
+      || !web_server.is_connected(web_server.get_client())) {
+    t.complete = parser.done();
+    return true;
   }
-  boolean found = false;
-  for (int i = 0; headers_[i].header; i++) {
-    // Use pointer equality, since `header' must be the pointer
-    // inside headers_.
-    if (header == headers_[i].header) {
-      headers_[i].value = (char*)malloc_check(strlen(value) + 1);
-      if (!headers_[i].value) {
-	return false;
-      }
-      strcpy(headers_[i].value, value);
-      found = true;
+  uint8_t data[64];
+  for (int n = 0; n < TWS_PUT_BLOCK_SIZE && t.remaining;) {
+    int16_t size = web_server.read(data, sizeof(data));
+    if (!size) {
       break;
     }
+    parser.parse(web_server, data, size);
+    t.remaining -= size;
+    t.transferred += size;
+    t.last_activity = millis();
+    n += size;
+  }
+  if (millis() - t.last_activity > 30000) {
+    // Give up if there has been zero data from the connected client
+    // for more than 30 seconds.
+    COUNT(timeouts);
+    return true;
   }
-  return found;
+  return false;
 }
 
-FLASH_STRING(content_type_msg, "Content-Type: ");
-
-void TinyWebServer::send_error_code(Client& client, int code) {
+static void multipart_done(TinyWebServer& web_server, boolean complete,
+                           uint32_t received) {
+  complete = parser.end(web_server);
+  block = NULL;
 #if DEBUG
-  Serial << F("TWS:Returning ");
-  Serial.println(code, DEC);
+  Serial << F("TWS:Received ") << received << F(" bytes of form data\n");
 #endif
-  client << F("HTTP/1.1 ");
-  client.print(code, DEC);
-  client << F(" OK\r\n");
-  if (code != 200) {
-    end_headers(client);
+
+  // The response is only sent once the whole body was read, browsers
+  // don't expect it earlier.
+  if (complete) {
+    web_server.send_error_code(200);
+    web_server.send_content_type("text/plain");
+    web_server.send_content_length(3);
+    web_server.end_headers();
+    web_server << F("OK\n");
+  } else {
+    web_server.send_error_code(400);
   }
 }
 
-void TinyWebServer::send_content_type(MimeType mime_type) {
-  client_ << content_type_msg;
+boolean multipart_handler(TinyWebServer& web_server) {
+  const char* length_str = web_server.get_header_value("Content-Length");
+  uint32_t length = length_str ? atol(length_str) : 0;
+
+  // As in put_handler(), the body is received over the next calls to
+  // process(), into the transfer's block. Only one body at a time.
+  TinyWebServer::Transfer* t = block ? NULL
+    : web_server.start_transfer(&multipart_step, &multipart_done, length);
+  if (!t) {
+    send_status_line(web_server, 503);
+    web_server.send_content_length(0);
+    web_server.end_headers();
+    return true;
+  }
+  block = t->block;
+  if (!parser.begin(web_server.get_header_value("Content-Type"),
+                    &handle_part, block, sizeof(t->block))) {
+    // Not a multipart body, the transfer ends right away with a 400.
+    t->remaining = 0;
+  }
+  return true;
+}
+
+};
+
+// The asset bundle handler.
 
-  char ch;
-  int i = mime_type;
-  while ((ch = mime_types[i++]) != '|') {
-    client_.print(ch);
+namespace TinyWebBundleHandler {
+
+const File* bundle = NULL;
+
+boolean bundle_handler(TinyWebServer& web_server) {
+  if (!web_server.serve_bundle_file(bundle)) {
+    web_server.send_error_code(404);
   }
+  return true;
+}
 
-  client_.println();
+};
+
+#if TWS_STATS
+
+const TinyWebStats& TinyWebServer::get_stats() {
+  return stats;
 }
 
-void TinyWebServer::send_content_type(const char* content_type) {
-  client_ << content_type_msg;
-  client_.println(content_type);
+void TinyWebServer::reset_stats() {
+  memset(&stats, 0, sizeof(stats));
 }
 
-const char* TinyWebServer::get_path() { return path_; }
+// The statistics handler.
 
-const TinyWebServer::HttpRequestType TinyWebServer::get_type() {
-  return request_type_;
+namespace TinyWebStatsHandler {
+
+static void send_histogram(TinyWebServer& web_server, const char* name,
+                           const TinyWebHistogram& h) {
+  web_server << F(",\"") << name << F("\":{\"max\":") << h.max
+             << F(",\"buckets\":[");
+  for (uint8_t i = 0; i < TWS_STATS_BUCKETS; i++) {
+    if (i) {
+      web_server.write(',');
+    }
+    web_server << h.buckets[i];
+  }
+  web_server << F("]}");
 }
 
-const char* TinyWebServer::get_header_value(const char* name) {
-  if (!headers_) {
-    return NULL;
+boolean stats_handler(TinyWebServer& web_server) {
+  // Take a copy so the counters of this very request don't change
+  // while they're sent.
+  TinyWebStats s = TinyWebServer::get_stats();
+  web_server.send_error_code(200);
+  web_server.send_content_type("application/json");
+  web_server.send_chunked_encoding();
+  web_server.end_headers();
+  web_server << F("{\"connections\":") << s.connections
+             << F(",\"requests\":") << s.requests
+             << F(",\"bytes_in\":") << s.bytes_in
+             << F(",\"bytes_out\":") << s.bytes_out
+             << F(",\"status_4xx\":") << s.status_4xx
+             << F(",\"status_5xx\":") << s.status_5xx
+             << F(",\"alloc_failures\":") << s.alloc_failures
+             << F(",\"timeouts\":") << s.timeouts;
+  send_histogram(web_server, "request_line", s.request_line);
+  send_histogram(web_server, "headers", s.headers);
+  send_histogram(web_server, "route", s.route);
+  send_histogram(web_server, "handler", s.handler);
+  web_server << F("}\n");
+  return true;
+}
+
+};
+
+#endif
+
+#if TWS_WEBSOCKETS
+
+// WebSockets.
+
+// Just enough of SHA-1 for the handshake. The message schedule is
+// kept as a rolling window of 16 words, to spare the stack.
+typedef struct {
+  uint32_t h[5];
+  uint8_t block[64];
+  uint8_t length;
+  uint32_t total;
+} Sha1;
+
+static inline uint32_t rotate_left(uint32_t x, uint8_t n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_init(Sha1& s) {
+  s.h[0] = 0x67452301;
+  s.h[1] = 0xEFCDAB89;
+  s.h[2] = 0x98BADCFE;
+  s.h[3] = 0x10325476;
+  s.h[4] = 0xC3D2E1F0;
+  s.length = 0;
+  s.total = 0;
+}
+
+static void sha1_block(Sha1& s) {
+  uint32_t w[16];
+  for (uint8_t i = 0; i < 16; i++) {
+    w[i] = (uint32_t)s.block[4 * i] << 24
+      | (uint32_t)s.block[4 * i + 1] << 16
+      | (uint32_t)s.block[4 * i + 2] << 8
+      | s.block[4 * i + 3];
   }
-  for (int i = 0; headers_[i].header; i++) {
-    if (!strcmp(headers_[i].header, name)) {
-      return headers_[i].value;
+  uint32_t a = s.h[0], b = s.h[1], c = s.h[2], d = s.h[3], e = s.h[4];
+  for (uint8_t i = 0; i < 80; i++) {
+    if (i >= 16) {
+      w[i & 15] = rotate_left(w[(i + 13) & 15] ^ w[(i + 8) & 15]
+                              ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+    }
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
     }
+    uint32_t t = rotate_left(a, 5) + f + e + k + w[i & 15];
+    e = d;
+    d = c;
+    c = rotate_left(b, 30);
+    b = a;
+    a = t;
   }
-  return NULL;
+  s.h[0] += a;
+  s.h[1] += b;
+  s.h[2] += c;
+  s.h[3] += d;
+  s.h[4] += e;
 }
 
-int parseHexChar(char ch) {
-  if (isdigit(ch)) {
-    return ch - '0';
-  }
-  ch = tolower(ch);
-  if (ch >= 'a' &&  ch <= 'e') {
-    return ch - 'a' + 10;
+static void sha1_add(Sha1& s, uint8_t byte) {
+  s.total++;
+  s.block[s.length++] = byte;
+  if (s.length == sizeof(s.block)) {
+    sha1_block(s);
+    s.length = 0;
   }
-  return 0;
 }
 
-char* TinyWebServer::decode_url_encoded(const char* s) {
-  if (!s) {
-    return NULL;
+static void sha1_final(Sha1& s, uint8_t* digest) {
+  uint32_t bits = s.total * 8;
+  sha1_add(s, 0x80);
+  while (s.length != 56) {
+    sha1_add(s, 0);
   }
-  char* r = (char*)malloc_check(strlen(s) + 1);
-  if (!r){
-    return NULL;
+  // The messages hashed here are much shorter than 2^32 bits.
+  for (uint8_t i = 0; i < 4; i++) {
+    sha1_add(s, 0);
   }
-  char* r2 = r;
-  const char* p = s;
-  while (*s && (p = strchr(s, '%'))) {
-    if (p - s) {
-      memcpy(r2, s, p - s);
-      r2 += (p - s);
-    }
-    // If the remaining number of characters is less than 3, we cannot
-    // have a complete escape sequence. Break early.
-    if (strlen(p) < 3) {
-      // Move the new beginning to the value of p.
-      s = p;
-      break;
-    }
-    uint8_t r = parseHexChar(*(p + 1)) << 4 | parseHexChar(*(p + 2));
-    *r2++ = r;
-    p += 3;
-
-    // Move the new beginning to the value of p.
-    s = p;
+  for (int8_t i = 24; i >= 0; i -= 8) {
+    sha1_add(s, bits >> i);
   }
-  // Copy whatever is left of the string in the result.
-  int len = strlen(s);
-  if (len > 0) {
-    strncpy(r2, s, len);
+  for (uint8_t i = 0; i < 20; i++) {
+    digest[i] = s.h[i / 4] >> (24 - 8 * (i % 4));
   }
-  // Append the 0 terminator.
-  *(r2 + len) = 0;
-
-  return r;
 }
 
-char* TinyWebServer::get_file_from_path(const char* path) {
-  // Obtain the last path component.
-  const char* encoded_fname = strrchr(path, '/');
-  if (!encoded_fname) {
-    return NULL;
-  } else {
-    // Skip past the '/'.
-    encoded_fname++;
+static const char websocket_guid[] PROGMEM =
+  "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static const char base64_chars[] PROGMEM =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void TinyWebServer::websocket_accept_key(const char* key, char* accept) {
+  // The Base64 encoded SHA-1 of the key followed by the GUID.
+  Sha1 s;
+  sha1_init(s);
+  for (const char* p = key; *p; p++) {
+    sha1_add(s, *p);
   }
-  char* decoded = decode_url_encoded(encoded_fname);
-  if (!decoded) {
-    return NULL;
+  for (uint8_t i = 0; i < sizeof(websocket_guid) - 1; i++) {
+    sha1_add(s, pgm_read_byte(websocket_guid + i));
   }
-  for (char* p = decoded; *p; p++) {
-    *p = toupper(*p);
+  uint8_t digest[20];
+  sha1_final(s, digest);
+
+  for (uint8_t i = 0; i < sizeof(digest); i += 3) {
+    uint32_t n = (uint32_t)digest[i] << 16;
+    if (i + 1U < sizeof(digest)) {
+      n |= (uint32_t)digest[i + 1] << 8;
+    }
+    if (i + 2U < sizeof(digest)) {
+      n |= digest[i + 2];
+    }
+    for (uint8_t j = 0; j < 4; j++) {
+      *accept++ = i + j <= sizeof(digest)
+        ? pgm_read_byte(base64_chars + ((n >> (18 - 6 * j)) & 0x3F)) : '=';
+    }
   }
-  return decoded;
+  *accept = 0;
 }
 
-TinyWebServer::MimeType TinyWebServer::get_mime_type_from_filename(
-    const char* filename) {
-  MimeType r = text_html_content_type;
-  if (!filename) {
-    return r;
-  }
-
-  char* ext = strrchr(filename, '.');
-  if (ext) {
-    // We found an extension. Skip past the '.'
-    ext++;
-
-    char ch;
-    int i = 0;
-    while (i < mime_types.length()) {
-      // Compare the extension.
-      char* p = ext;
-      ch = mime_types[i];
-      while (*p && ch != '*' && toupper(*p) == ch) {
-	p++; i++;
-	ch = mime_types[i];
-      }
-      if (!*p && ch == '*') {
-	// We reached the end of the extension while checking
-	// equality with a MIME type: we have a match. Increment i
-	// to reach past the '*' char, and assign it to `mime_type'.
-	r = ++i;
-	break;
-      } else {
-	// Skip past the the '|' character indicating the end of a
-	// MIME type.
-	while (mime_types[i++] != '|')
-	  ;
-      }
+// Returns true if the current request is for version 13 of the
+// WebSocket protocol, the only one there is besides drafts.
+static boolean is_websocket_version_13(TinyWebServer& web_server) {
+  const char* version = web_server.get_header_value("Sec-WebSocket-Version");
+  return version && !strcmp(version, "13");
+}
+
+boolean TinyWebServer::accept_websocket(WebSocketFn fn) {
+  const char* key = get_header_value("Sec-WebSocket-Key");
+  const char* upgrade = get_header_value("Upgrade");
+  if (!key || !*key || !upgrade || strcasecmp(upgrade, "websocket")) {
+    return false;
+  }
+  if (!is_websocket_version_13(*this)) {
+    send_status_line(*this, 426);
+    *this << F("Sec-WebSocket-Version: 13\r\n");
+    send_content_length(0);
+    end_headers();
+    return false;
+  }
+  uint8_t open = 0;
+  for (int i = 0; i < TWS_MAX_CONNECTIONS; i++) {
+    if (connections_[i].state == CONNECTION_WEBSOCKET) {
+      open++;
     }
   }
-  return r;
+  if (open >= TWS_MAX_WEBSOCKETS) {
+    return false;
+  }
+
+  char accept[29];
+  websocket_accept_key(key, accept);
+  send_status_line(*this, 101);
+  *this << F("Upgrade: websocket\r\n"
+             "Connection: Upgrade\r\n"
+             "Sec-WebSocket-Accept: ") << accept << F("\r\n\r\n");
+  pending_websocket_ = fn;
+  return true;
 }
 
-void TinyWebServer::send_file(SdFile& file) {
-  size_t size;
-  while ((size = file.read(buffer, sizeof(buffer))) > 0) {
-    if (!client_.connected()) {
-      break;
+boolean TinyWebServer::send_frame(uint8_t opcode, const uint8_t* data,
+                                  uint16_t size) {
+  return write_frame(client_, opcode, data, size);
+}
+
+uint8_t TinyWebServer::broadcast_frame(uint8_t opcode, const uint8_t* data,
+                                       uint16_t size) {
+  uint8_t n = 0;
+  for (int i = 0; i < TWS_MAX_CONNECTIONS; i++) {
+    Connection& c = connections_[i];
+    if (c.state == CONNECTION_WEBSOCKET
+        && write_frame(c.client, opcode, data, size)) {
+      n++;
     }
-    write((uint8_t*)buffer, size);
   }
+  return n;
 }
 
-size_t TinyWebServer::write(uint8_t c) {
-  client_.write(c);
+uint8_t TinyWebServer::broadcast_text(const char* text) {
+  return broadcast_frame(WS_TEXT, (const uint8_t*)text, strlen(text));
 }
 
-size_t TinyWebServer::write(const char *str) {
-  client_.write(str);
+void TinyWebServer::close_websocket(uint16_t code) {
+  if (current_->state == CONNECTION_WEBSOCKET) {
+    close_websocket(*current_, code);
+  }
 }
 
-size_t TinyWebServer::write(const uint8_t *buffer, size_t size) {
-  client_.write(buffer, size);
+void TinyWebServer::close_websocket(Connection& c, uint16_t code) {
+  uint8_t status[2] = { (uint8_t)(code >> 8), (uint8_t)code };
+  write_frame(c.client, WS_CLOSE, status, sizeof(status));
+  close_connection(c);
 }
 
-boolean TinyWebServer::read_next_char(Client& client, uint8_t* ch) {
-  if (!client.available()) {
+boolean TinyWebServer::write_frame(EthernetClient& client, uint8_t opcode,
+                                   const uint8_t* data, uint16_t size) {
+  if (!is_connected(client)) {
     return false;
+  }
+  // The server's frames aren't masked. Small frames go out in a
+  // single write, and so in a single packet.
+  uint8_t frame[64];
+  uint8_t header = 2;
+  frame[0] = 0x80 | opcode;
+  if (size < 126) {
+    frame[1] = size;
   } else {
-    *ch = client.read();
-    return true;
+    frame[1] = 126;
+    frame[2] = size >> 8;
+    frame[3] = size;
+    header = 4;
+  }
+  if (header + size <= sizeof(frame)) {
+    if (size) {
+      memcpy(frame + header, data, size);
+    }
+    send(client, frame, header + size);
+  } else {
+    send(client, frame, header);
+    send(client, data, size);
   }
+  return true;
 }
 
-boolean TinyWebServer::get_line(char* buffer, int size) {
-  int i = 0;
-  char ch;
+void TinyWebServer::advance_websocket(Connection& c) {
+  if (c.input_pos == c.input_len) {
+    c.input_pos = 0;
+    c.input_len = read_block(c.client, c.input, sizeof(c.input));
+  }
 
-  buffer[0] = 0;
-  for (; i < size - 1; i++) {
-    if (!read_next_char(client_, (uint8_t*)&ch)) {
-      continue;
+  // Collect each frame in the request buffer: its first two bytes,
+  // then its 16 bits length if it has one, then the mask and the
+  // data.
+  uint8_t* f = (uint8_t*)c.buffer;
+  while (c.input_pos < c.input_len) {
+    uint16_t want = c.mark ? c.mark : (c.pos < 2 ? 2 : 4);
+    uint16_t n = want - c.pos;
+    if (n > c.input_len - c.input_pos) {
+      n = c.input_len - c.input_pos;
     }
-    if (ch == '\n') {
+    memcpy(f + c.pos, c.input + c.input_pos, n);
+    c.pos += n;
+    c.input_pos += n;
+    if (c.pos < want) {
       break;
     }
-    buffer[i] = ch;
-  }
-  buffer[i] = 0;
-  return i < size - 1;
-}
 
-// Returns a newly allocated string containing the field number `which`.
-// The first field's index is 0.
-// The caller is responsible for freeing the returned value.
-char* TinyWebServer::get_field(const char* buffer, int which) {
-  char* field = NULL;
-  boolean prev_is_space = false;
-  int i = 0;
-  int field_no = 0;
-  int size = strlen(buffer);
+    if (c.mark) {
+      handle_frame(c);
+      if (c.state != CONNECTION_WEBSOCKET) {
+        return;
+      }
+      c.pos = c.mark = 0;
+      continue;
+    }
 
-  // Locate the field we need. A field is defined as an area of
-  // non-space characters delimited by one or more space characters.
-  for (; field_no < which; field_no++) {
-    // Skip over space characters
-    while (i < size && isspace(buffer[i])) {
-      i++;
+    // Clients must mask their frames, and can't use extensions that
+    // weren't negotiated.
+    if (!(f[1] & 0x80) || (f[0] & 0x70)) {
+      close_websocket(c, 1002);
+      return;
     }
-    // Skip over non-space characters.
-    while (i < size && !isspace(buffer[i])) {
-      i++;
+    uint16_t size = f[1] & 0x7F;
+    // Control frames can't be fragmented, and carry at most 125
+    // bytes.
+    if ((f[0] & 0x08) && (!(f[0] & 0x80) || size > 125)) {
+      close_websocket(c, 1002);
+      return;
     }
-  }
-
-  // Now we identify the end of the field that we want.
-  // Skip over space characters.
-  while (i < size && isspace(buffer[i])) {
-    i++;
-  }
-
-  if (field_no == which && i < size) {
-    // Now identify where the field ends.
-    int j = i;
-    while (j < size && !isspace(buffer[j])) {
-      j++;
+    uint8_t header = 6;
+    if (size == 126) {
+      if (c.pos < 4) {
+        continue;
+      }
+      size = (uint16_t)f[2] << 8 | f[3];
+      header = 8;
     }
-
-    field = (char*) malloc_check(j - i + 1);
-    if (!field) {
-      return NULL;
+    // Leave room for the NUL after the data.
+    if (size == 127 || size >= sizeof(c.buffer) - header) {
+      close_websocket(c, 1009);
+      return;
     }
-    memcpy(field, buffer + i, j - i);
-    field[j - i] = 0;
+    c.mark = header + size;
   }
-  return field;
 }
 
-// The PUT handler.
-
-namespace TinyWebPutHandler {
-
-HandlerFn put_handler_fn = NULL;
-
-// Fills in `buffer' by reading up to `num_bytes'.
-// Returns the number of characters read.
-int read_chars(TinyWebServer& web_server, Client& client,
-               uint8_t* buffer, int size) {
-  uint8_t ch;
-  int pos;
-  for (pos = 0; pos < size && web_server.read_next_char(client, &ch); pos++) {
-    buffer[pos] = ch;
+void TinyWebServer::handle_frame(Connection& c) {
+  uint8_t* f = (uint8_t*)c.buffer;
+  uint8_t header = (f[1] & 0x7F) == 126 ? 8 : 6;
+  uint8_t* mask = f + header - 4;
+  uint8_t* data = f + header;
+  uint16_t size = c.mark - header;
+  for (uint16_t i = 0; i < size; i++) {
+    data[i] ^= mask[i & 3];
+  }
+  data[size] = 0;
+
+  current_ = &c;
+  client_ = c.client;
+  uint8_t opcode = f[0] & 0x0F;
+  switch (opcode) {
+  case WS_CONTINUATION:
+  case WS_TEXT:
+  case WS_BINARY:
+    (*c.websocket_fn)(*this, opcode, data, size);
+    break;
+  case WS_PING:
+    write_frame(c.client, WS_PONG, data, size);
+    break;
+  case WS_PONG:
+    break;
+  case WS_CLOSE:
+    // Echo the status code, and close.
+    write_frame(c.client, WS_CLOSE, data, size < 2 ? 0 : 2);
+    close_connection(c);
+    break;
+  default:
+    close_websocket(c, 1002);
+    break;
   }
-  return pos;
 }
 
-boolean put_handler(TinyWebServer& web_server) {
-  web_server.send_error_code(200);
-  web_server.end_headers();
-
-  const char* length_str = web_server.get_header_value("Content-Length");
-  long length = atol(length_str);
-  uint32_t start_time = 0;
-  boolean watchdog_start = false;
-
-  EthernetClient client = web_server.get_client();
+// The WebSocket handler.
 
-  if (put_handler_fn) {
-    (*put_handler_fn)(web_server, START, NULL, length);
-  }
+namespace TinyWebSocketHandler {
 
-  uint32_t i;
-  for (i = 0; i < length && client.connected();) {
-    int16_t size = read_chars(web_server, client, (uint8_t*)buffer, 64);
-    if (!size) {
-      if (watchdog_start) {
-        if (millis() - start_time > 30000) {
-          // Exit if there has been zero data from connected client
-          // for more than 30 seconds.
-#if DEBUG
-          Serial << F("TWS:There has been no data for >30 Sec.\n");
-#endif
-          break;
-        }
-      } else {
-        // We have hit an empty buffer, start the watchdog.
-        start_time = millis();
-        watchdog_start = true;
-      }
-      continue;
-    }
-    i += size;
-    // Ensure we re-start the watchdog if we get ANY data input.
-    watchdog_start = false;
+MessageFn message_fn = NULL;
 
-    if (put_handler_fn) {
-      (*put_handler_fn)(web_server, WRITE, buffer, size);
-    }
+boolean websocket_handler(TinyWebServer& web_server) {
+  if (message_fn && web_server.accept_websocket(message_fn)) {
+    return true;
   }
-  if (put_handler_fn) {
-    (*put_handler_fn)(web_server, END, NULL, 0);
+  // Tell a handshake apart from a plain request. accept_websocket()
+  // answered the handshakes for other versions itself.
+  if (!web_server.get_header_value("Sec-WebSocket-Key")) {
+    web_server.send_error_code(400);
+  } else if (!message_fn || is_websocket_version_13(web_server)) {
+    web_server.send_error_code(503);
   }
-
   return true;
 }
 
 };
+
+#endif
@@ -15,6 +15,231 @@
 class SdFile;
 class TinyWebServer;
 
+// How long, in milliseconds, a persistent connection may stay idle
+// before it's closed.
+#ifndef TWS_KEEP_ALIVE_TIMEOUT
+#define TWS_KEEP_ALIVE_TIMEOUT 500
+#endif
+
+// The maximum number of requests served on a persistent connection.
+#ifndef TWS_MAX_KEEP_ALIVE_REQUESTS
+#define TWS_MAX_KEEP_ALIVE_REQUESTS 16
+#endif
+
+// The number of connections served at the same time. The W5100
+// Ethernet chip has 4 sockets; boards with 2KB of RAM can't afford to
+// track all of them.
+#ifndef TWS_MAX_CONNECTIONS
+#if defined(RAMEND) && RAMEND < 0x900
+#define TWS_MAX_CONNECTIONS 2
+#else
+#define TWS_MAX_CONNECTIONS 4
+#endif
+#endif
+
+// What a connection costs, for each of TWS_MAX_CONNECTIONS, is fixed
+// and allocated up front, so the worst case is also the usual one:
+//
+//   TWS_INPUT_BUFFER_SIZE + 2       66
+//   TWS_REQUEST_BUFFER_SIZE        160
+//   TWS_HEADER_BUFFER_SIZE         192  64 on boards with 2KB of RAM
+//   client, state and timestamps   ~20  8 more with TWS_STATS
+//
+// which is about 440 bytes by default, and about 310 on boards with
+// 2KB of RAM, where only 2 connections are tracked. Reading a request
+// allocates nothing else per connection: a header the library starts
+// using has to fit the header buffer's budget below instead of
+// growing it.
+//
+// The size of each connection's request buffer, which holds the NUL
+// terminated request line, so paths and query strings of up to 150
+// characters or so are accepted, longer ones get a 414 response. On
+// a WebSocket it holds the frame being received instead.
+#ifndef TWS_REQUEST_BUFFER_SIZE
+#define TWS_REQUEST_BUFFER_SIZE 160
+#endif
+
+// The size of each connection's header buffer, which holds the values
+// of the requested headers, each taking its length plus 2 bytes, and
+// the name of the header being read. A request whose values don't fit
+// gets a 431 response. The headers used by the library itself take,
+// with the values sent by common browsers:
+//
+//   Connection             12  keep-alive, 21 with Upgrade
+//   Content-Length         12
+//   Content-Type          102  multipart/form-data with a 70 characters
+//                              boundary, the longest RFC 2046 allows
+//   Accept-Encoding        32  gzip, deflate, br, zstd
+//   If-None-Match          24  an entity tag of serve_file()
+//   If-Modified-Since      31  an HTTP date
+//   If-Range               31
+//   Range                  24
+//   Upgrade                11
+//   Sec-WebSocket-Key      26
+//   Sec-WebSocket-Version   4  13
+//
+// The largest combinations are a multipart upload, 158 bytes, and a
+// conditional Range request, 154 bytes, which leaves the sketch's own
+// headers 34 bytes by default. Boards with 2KB of RAM only have room
+// for the basics, which excludes multipart uploads with long
+// boundaries. Any header added to the library must keep within this
+// budget.
+#ifndef TWS_HEADER_BUFFER_SIZE
+#if defined(RAMEND) && RAMEND < 0x900
+#define TWS_HEADER_BUFFER_SIZE 64
+#else
+#define TWS_HEADER_BUFFER_SIZE 192
+#endif
+#endif
+
+// The size of the output buffer. The status line, the headers and the
+// body of a response are accumulated in it and sent to the client a
+// full buffer at a time, which keeps the number of packets low.
+#ifndef TWS_OUTPUT_BUFFER_SIZE
+#if defined(RAMEND) && RAMEND < 0x900
+#define TWS_OUTPUT_BUFFER_SIZE 64
+#else
+#define TWS_OUTPUT_BUFFER_SIZE 512
+#endif
+#endif
+
+// The maximum number of :parameter segments captured from a request
+// path.
+#ifndef TWS_MAX_PATH_PARAMS
+#define TWS_MAX_PATH_PARAMS 4
+#endif
+
+// The size of the blocks in which TinyWebPutHandler::put_handler()
+// hands over the uploaded data. A multiple of the SD card's 512 bytes
+// sectors has the file written one sector at a time. Each transfer,
+// see TWS_MAX_TRANSFERS, has a block of this size, which boards with
+// 2KB of RAM can't afford.
+#ifndef TWS_PUT_BLOCK_SIZE
+#if defined(RAMEND) && RAMEND < 0x900
+#define TWS_PUT_BLOCK_SIZE 128
+#else
+#define TWS_PUT_BLOCK_SIZE 512
+#endif
+#endif
+
+// The size of the name, file name and content type of a
+// multipart/form-data part kept by TinyWebMultipartParser, NUL
+// included. Longer ones are truncated.
+#ifndef TWS_MULTIPART_FIELD_SIZE
+#define TWS_MULTIPART_FIELD_SIZE 32
+#endif
+
+// The size of the buffer, on the stack, in which read_form() decodes
+// a field's name and value.
+#ifndef TWS_FORM_FIELD_SIZE
+#define TWS_FORM_FIELD_SIZE 64
+#endif
+
+// The longest name of a template variable, in {{name}}.
+#ifndef TWS_TEMPLATE_NAME_SIZE
+#define TWS_TEMPLATE_NAME_SIZE 24
+#endif
+
+// Define to 1 to count requests, bytes and errors and time the phases
+// of each request, see TinyWebStats. Everything related is compiled
+// out otherwise.
+#ifndef TWS_STATS
+#define TWS_STATS 0
+#endif
+
+// The number of files whose directory entries serve_file()
+// remembers, so it doesn't have to look them up in the directory on
+// every request. 0 disables the cache.
+#ifndef TWS_FILE_CACHE_SIZE
+#if defined(RAMEND) && RAMEND < 0x900
+#define TWS_FILE_CACHE_SIZE 2
+#else
+#define TWS_FILE_CACHE_SIZE 8
+#endif
+#endif
+
+// The number of large file downloads and uploads that can be in
+// progress at the same time, each advanced a little on every call to
+// process(), and how many blocks each of them moves per call.
+#ifndef TWS_MAX_TRANSFERS
+#if defined(RAMEND) && RAMEND < 0x900
+#define TWS_MAX_TRANSFERS 1
+#else
+#define TWS_MAX_TRANSFERS 2
+#endif
+#endif
+
+#ifndef TWS_TRANSFER_BLOCKS
+#define TWS_TRANSFER_BLOCKS 4
+#endif
+
+// Define to 0 to leave out WebSocket support, see accept_websocket().
+// A WebSocket keeps one of the connections, and its frames are
+// received in the connection's request buffer, so they're limited to
+// TWS_REQUEST_BUFFER_SIZE - 9 bytes.
+#ifndef TWS_WEBSOCKETS
+#if defined(RAMEND) && RAMEND < 0x900
+#define TWS_WEBSOCKETS 0
+#else
+#define TWS_WEBSOCKETS 1
+#endif
+#endif
+
+// The number of connections that can be WebSockets at the same time,
+// keeping the others for HTTP requests.
+#ifndef TWS_MAX_WEBSOCKETS
+#define TWS_MAX_WEBSOCKETS 2
+#endif
+
+// The size of each connection's input buffer. Input is read from the
+// Ethernet chip in blocks of up to this many bytes, one block per
+// connection on each call to process().
+#ifndef TWS_INPUT_BUFFER_SIZE
+#define TWS_INPUT_BUFFER_SIZE 64
+#endif
+
+// The default size, in bytes, of the per-request memory arena. It has
+// to hold the request method, the path, the values of the requested
+// headers and whatever the handlers allocate from it. Use
+// TinyWebArena::high_water_mark() to find the right size for your
+// application.
+#ifndef TWS_DEFAULT_ARENA_SIZE
+#define TWS_DEFAULT_ARENA_SIZE 256
+#endif
+
+// A fixed size, request scoped memory arena. Memory is handed out
+// sequentially from a buffer allocated once, at construction time,
+// and it's all released at once by reset(). TinyWebServer resets its
+// arena at the end of every request, which keeps malloc() and free()
+// out of the request path and the heap from fragmenting.
+class TinyWebArena {
+public:
+  TinyWebArena(size_t size);
+  ~TinyWebArena();
+
+  // Returns `size' bytes of memory, or NULL if the arena is exhausted.
+  void* alloc(size_t size);
+
+  // Returns a NUL terminated copy of the first `len' characters of
+  // `s', or NULL if the arena is exhausted.
+  char* strndup(const char* s, size_t len);
+
+  // Releases all the memory handed out since the last reset.
+  void reset() { used_ = 0; }
+
+  size_t capacity() const { return size_; }
+  size_t used() const { return used_; }
+
+  // The largest number of bytes ever in use at the same time.
+  size_t high_water_mark() const { return high_water_mark_; }
+
+private:
+  char* base_;
+  size_t size_;
+  size_t used_;
+  size_t high_water_mark_;
+};
+
 namespace TinyWebPutHandler {
   enum PutAction {
     START,
@@ -26,13 +251,226 @@ namespace TinyWebPutHandler {
 			    PutAction action,
 			    char* buffer, int size);
 
+  // Called after each block of the upload was handed to the
+  // HandlerFn, with the number of bytes received so far and the
+  // length of the upload.
+  typedef void (*ProgressFn)(TinyWebServer& web_server,
+                             uint32_t received, uint32_t length);
+
+  // Statistics of the last upload.
+  typedef struct {
+    // The length announced by the client, and the bytes received.
+    uint32_t length;
+    uint32_t received;
+    // The number of WRITE calls.
+    uint16_t blocks;
+    // The duration of the upload, and the part of it spent in the
+    // WRITE calls, in milliseconds.
+    uint32_t millis;
+    uint32_t write_millis;
+  } Stats;
+
   // An HTTP handler that knows how to handle file uploads using the
   // PUT method. Set the `put_handler_fn' variable below to your own
   // function to handle the characters of the uploaded function.
+  //
+  // The uploaded data is handed over in blocks of TWS_PUT_BLOCK_SIZE
+  // bytes, except for the last one, which suits the SD card's 512
+  // bytes sectors.
+  //
+  // The data is received over the next calls to process(), one block
+  // at a time, so WRITE and END are called from process() after the
+  // handler returned. Only one upload is received at a time, others,
+  // and uploads arriving while all the transfers are in progress, are
+  // answered with 503 Service Unavailable.
   boolean put_handler(TinyWebServer& web_server);
   extern HandlerFn put_handler_fn;
+  extern ProgressFn put_progress_fn;
+  extern Stats put_stats;
+};
+
+namespace TinyWebMultipartHandler {
+  // A part of a multipart/form-data body, as described by its
+  // headers. The fields are empty when the headers don't have them.
+  typedef struct {
+    // The name of the form field, and for files the name of the file
+    // on the user's computer and its type.
+    char name[TWS_MULTIPART_FIELD_SIZE];
+    char filename[TWS_MULTIPART_FIELD_SIZE];
+    char content_type[TWS_MULTIPART_FIELD_SIZE];
+  } Part;
+
+  // Like TinyWebPutHandler::HandlerFn, called with START, WRITE and
+  // END for each part of the body, in order.
+  typedef void (*HandlerFn)(TinyWebServer& web_server,
+                            TinyWebPutHandler::PutAction action,
+                            const Part& part, char* buffer, int size);
+
+  // An HTTP handler for the POST requests of HTML forms with
+  // enctype="multipart/form-data", typically file uploads from an
+  // <input type="file">. The parts are handed over to the
+  // `multipart_handler_fn' variable below, in blocks of
+  // TWS_PUT_BLOCK_SIZE bytes.
+  //
+  // Like put_handler(), the body is received over the next calls to
+  // process(), so the HandlerFn can't use get_path() or the headers
+  // of the request. Once the whole body was received, the response is
+  // a 200 one, or a 400 one if it was cut short or isn't
+  // multipart/form-data. Only one body is received at a time, others,
+  // and bodies arriving while all the transfers are in progress, are
+  // answered with 503 Service Unavailable.
+  boolean multipart_handler(TinyWebServer& web_server);
+  extern HandlerFn multipart_handler_fn;
+};
+
+// A streaming parser of multipart/form-data bodies. It's fed the body
+// in pieces of any size, and hands the parts over to a HandlerFn
+// without keeping more than the current block: the boundary is
+// looked for across the ends of the pieces by remembering how much of
+// it was matched. It has no constructor, begin() starts it.
+class TinyWebMultipartParser {
+public:
+  // Starts parsing a body whose Content-Type is `content_type',
+  // handing its parts over to `fn' in `block', a buffer of `size'
+  // bytes. The data of a part is handed over in blocks of `size'
+  // bytes, except for its last one. Header lines longer than the
+  // block are truncated. Returns false if `content_type' isn't
+  // multipart with a boundary.
+  boolean begin(const char* content_type,
+                TinyWebMultipartHandler::HandlerFn fn,
+                char* block, int size);
+
+  // Parses the next `size' bytes of the body.
+  void parse(TinyWebServer& web_server, const uint8_t* data, int size);
+
+  // Ends the body, calling END for a part cut short. Returns whether
+  // the body was complete.
+  boolean end(TinyWebServer& web_server);
+
+  // Whether the closing boundary was seen.
+  boolean done() const { return state_ == MULTIPART_DONE; }
+
+  // Finds the parameter `name' of the header value `value', as in
+  // `form-data; name="file"', and copies it to `buffer' of `size'
+  // bytes without its quotes. Returns false if there's none.
+  static boolean get_header_param(const char* value, const char* name,
+                                  char* buffer, int size);
+
+private:
+  enum {
+    // Before the first boundary, and right after one.
+    MULTIPART_PREAMBLE,
+    MULTIPART_BOUNDARY,
+    MULTIPART_BOUNDARY_DASH,
+    MULTIPART_HEADERS,
+    MULTIPART_DATA,
+    // After the closing boundary.
+    MULTIPART_DONE,
+  };
+
+  // Adds `size' bytes to the data of the current part.
+  void add_data(TinyWebServer& web_server, const char* data, int size);
+
+  // Calls `fn_' with what's left in the block.
+  void flush_block(TinyWebServer& web_server);
+
+  // Handles the header line in the block.
+  void header_line();
+
+  // CRLF, two dashes and the boundary, and how much of it was
+  // matched so far.
+  char delimiter_[4 + 70 + 1];
+  uint8_t delimiter_len_;
+  uint8_t match_;
+  uint8_t state_;
+  TinyWebMultipartHandler::HandlerFn fn_;
+  char* block_;
+  int block_size_;
+  int fill_;
+  TinyWebMultipartHandler::Part part_;
 };
 
+namespace TinyWebBundleHandler {
+  // A file of an asset bundle, as generated by extras/make_bundle.py.
+  // The structure and everything it points to live in program memory.
+  typedef struct {
+    // The request path, e.g. "/index.htm".
+    const char* path;
+    // The Content-Type, Content-Length and, for compressed files,
+    // Content-Encoding header lines.
+    const char* headers;
+    // The entity tag, in quotes.
+    const char* etag;
+    const uint8_t* data;
+    uint32_t size;
+    // Whether `data' is gzip compressed.
+    uint8_t gzipped;
+  } File;
+
+  // An HTTP handler that serves the files of `bundle' below, a NULL
+  // path terminated array, straight from program memory.
+  boolean bundle_handler(TinyWebServer& web_server);
+  extern const File* bundle;
+};
+
+#if TWS_WEBSOCKETS
+namespace TinyWebSocketHandler {
+  // Called with each message received on a WebSocket, see
+  // TinyWebServer::WebSocketFn.
+  typedef void (*MessageFn)(TinyWebServer& web_server, uint8_t opcode,
+                            uint8_t* data, uint16_t size);
+
+  // An HTTP handler that turns the request into a WebSocket whose
+  // messages are handed to `message_fn' below. Requests that aren't
+  // WebSocket handshakes get a 400 response, handshakes for another
+  // version than 13 a 426 one, and a 503 one when TWS_MAX_WEBSOCKETS
+  // WebSockets are already open.
+  boolean websocket_handler(TinyWebServer& web_server);
+  extern MessageFn message_fn;
+};
+#endif
+
+#if TWS_STATS
+// The number of buckets of a TinyWebHistogram.
+#define TWS_STATS_BUCKETS 8
+
+// A histogram of durations. The first bucket counts the durations
+// shorter than 16 microseconds, and each of the next ones those 4
+// times as long as the previous one, up to 65 milliseconds; the last
+// bucket counts everything longer. The counts stop at 65535.
+typedef struct {
+  uint16_t buckets[TWS_STATS_BUCKETS];
+  // The longest duration, in microseconds.
+  uint32_t max;
+} TinyWebHistogram;
+
+// What the web server did since it was started, with TWS_STATS set.
+typedef struct {
+  uint32_t connections;
+  uint32_t requests;
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+  uint16_t status_4xx;
+  uint16_t status_5xx;
+  // Failed allocations, from the heap or from a request's arena.
+  uint16_t alloc_failures;
+  // Requests or bodies that were too slow to arrive.
+  uint16_t timeouts;
+  // From the first byte of a request to the end of its request line,
+  // from there to the end of the headers, the time taken to find the
+  // handler, and the time spent in the handler.
+  TinyWebHistogram request_line;
+  TinyWebHistogram headers;
+  TinyWebHistogram route;
+  TinyWebHistogram handler;
+} TinyWebStats;
+
+namespace TinyWebStatsHandler {
+  // An HTTP handler that sends TinyWebServer::get_stats() as JSON.
+  boolean stats_handler(TinyWebServer& web_server);
+};
+#endif
+
 class TinyWebServer : public Print {
 public:
   // An HTTP path handler. The handler function takes the path it
@@ -53,10 +491,27 @@ public:
     ANY,
   };
 
-  // An identifier for a MIME type. The number is opaque to a human,
-  // but it's really an offset in the `mime_types' array.
+  // An identifier for a MIME type, as returned by
+  // get_mime_type_from_filename(). The number is opaque to a human,
+  // but it's really an index in the library's table of MIME types, or
+  // MIME_TYPE_CUSTOM plus an index in the application's table.
   typedef uint16_t MimeType;
 
+  enum { MIME_TYPE_CUSTOM = 0x100 };
+
+  // Maps a file name extension, without the '.', to a content type.
+  typedef struct {
+    const char* extension;
+    const char* content_type;
+  } MimeTypeMapping;
+
+  // A handler for the requests whose path matches `path'. Besides
+  // literal segments, `path' may contain :name segments, which match
+  // any non-empty segment of the request path, see get_path_param(),
+  // and may end with '*', which matches any remainder of the request
+  // path. When several handlers match a request, the first one in the
+  // array is called. HEAD requests without a HEAD handler go to the
+  // GET one, whose response is sent without its body.
   typedef struct {
     const char* path;
     HttpRequestType type;
@@ -67,104 +522,459 @@ public:
   // handlers, and a NULL terminated array of headers the handlers are
   // interested in.
   //
-  // NOTE: Make sure the header names are all lowercase.
+  // `arena_size' is the size of the memory arena that backs all the
+  // allocations made while handling a request.
+  //
+  // Header names are matched ignoring case, as HTTP requires.
   TinyWebServer(PathHandler handlers[], const char** headers,
-                const int port=80);
+                const int port=80,
+                size_t arena_size=TWS_DEFAULT_ARENA_SIZE);
+  virtual ~TinyWebServer();
 
   // Call this method to start the HTTP server
   void begin();
 
-  // Handles a possible HTTP request. It will return immediately if no
-  // client has connected. Otherwise the request is handled
-  // synchronously.
+  // Handles possible HTTP requests. Each call reads a bounded amount
+  // of input from every open connection, up to TWS_MAX_CONNECTIONS of
+  // them, and returns, so a slow client doesn't hold up the others or
+  // the rest of the sketch. Once a request has been completely read,
+  // its handler is called synchronously.
+  //
+  // HTTP/1.1 connections, and HTTP/1.0 ones asking for it, are kept
+  // alive after responses whose length is known, i.e. those sending a
+  // Content-Length header, and the following requests on them are
+  // handled as well.
   //
   // Call this method from the main loop() function to have the Web
   // server handle incoming requests.
   void process();
 
-  // Sends the HTTP status code to the connect HTTP client.
-  void send_error_code(int code) {
-    send_error_code(client_, code);
+  // Configures persistent connections: how long, in milliseconds, a
+  // connection may stay idle waiting for the next request, and how
+  // many requests may be served on it. A `max_requests' of 1
+  // disables persistent connections.
+  void set_keep_alive(uint16_t timeout, uint8_t max_requests) {
+    keep_alive_timeout_ = timeout;
+    max_keep_alive_requests_ = max_requests;
   }
+
+  // Sends the HTTP status code to the connect HTTP client.
+  void send_error_code(int code);
   static void send_error_code(Client& client, int code);
 
   void send_content_type(MimeType mime_type);
   void send_content_type(const char* content_type);
 
+  // Sends the Content-Length header. Responses with a known length
+  // allow the connection to be reused for the next request.
+  void send_content_length(uint32_t length);
+
+  // Sends the response's body in chunks, for responses whose length
+  // isn't known up front. Call it instead of send_content_length(),
+  // before end_headers(). Everything written afterwards is sent as a
+  // chunk every time the output buffer fills up or flush() is called,
+  // and the last chunk is sent once the handler returns, which allows
+  // the connection to be reused. HTTP/1.0 clients get the body as is,
+  // and the connection is closed after it.
+  //
+  // NOTE: Don't write directly to get_client() in this mode.
+  void send_chunked_encoding();
+
   // Call this method to indicate the end of the headers.
-  inline void end_headers() { client_.println(); }
+  void end_headers();
   static inline void end_headers(Client& client) { client.println(); }
 
   // void send_error_code(MimeType mime_type, int code);
   // void send_error_code(const char* content_type, int code);
 
+  // The path of the request, without the query string.
   const char* get_path();
+
+  // The query string of the request, the part of the target after the
+  // '?', or NULL if it didn't have one.
+  const char* get_query();
+
+  // Copies the decoded value of the query parameter `name' into
+  // `buffer', truncated to `size' - 1 characters and NUL
+  // terminated. Returns false if the query string doesn't have the
+  // parameter.
+  boolean get_query_param(const char* name, char* buffer, int size);
   const HttpRequestType get_type();
-  const char* get_header_value(const char* header);
-  EthernetClient& get_client() { return client_; }
 
-  // Processes the HTTP headers and assigns values to the requested
-  // ones in headers_. Returns true when successful, false in case of
-  // errors.
+  // Returns the value of a :parameter segment of the handler's path,
+  // e.g. "12" for the request path "/led/12" handled by "/led/:id",
+  // either by position or by name. The value is not NUL terminated,
+  // its length is stored in `length'. Returns NULL if there's no such
+  // parameter.
+  const char* get_path_param(uint8_t index, uint8_t* length);
+  const char* get_path_param(const char* name, uint8_t* length);
+
+  // Returns the NUL terminated value of `header', one of those given
+  // to the constructor, or NULL if the request didn't have it. The
+  // value's length is stored in `length' when given.
+  const char* get_header_value(const char* header, uint16_t* length=NULL);
+
+  // Returns the client of the current request. Any buffered output is
+  // sent first, so that writing directly to the client preserves the
+  // order of the response.
+  EthernetClient& get_client() { flush(); return client_; }
+
+  // The memory arena of the current request. Everything allocated
+  // from it is released once the request has been handled.
+  TinyWebArena& get_arena() { return arena_; }
+
+  // Reads the HTTP headers synchronously and assigns values to the
+  // requested ones in headers_, then prepares for reading the body.
+  // Returns true when successful, false in case of errors. process()
+  // reads the headers by itself, this is mostly useful for testing.
   boolean process_headers();
 
   // Helper methods
 
+  // The methods below returning strings allocate them from `arena'
+  // when one is given, usually the one returned by get_arena(). Such
+  // strings live until the end of the request and must not be
+  // freed. Without an arena the strings are malloc()ed and must be
+  // free()d by the caller.
+
   // Assumes `s' is an HTTP encoded URL, replaces all the escape
   // characters in it and returns the unencoded version. For example
   // for "/index%2Ehtm", this method returns "index.htm".
-  //
-  // The returned string must be free()d by the caller.
-  static char* decode_url_encoded(const char* s);
+  static char* decode_url_encoded(const char* s, TinyWebArena* arena=NULL);
 
   // Assumes the last component of the URL path is a file
   // name. Returns the file name in upper case, ready to passed to
   // SdFile's open() method.
-  //
-  // In addition to the file name, it sets `mime_type' to an identifier
-  //
-  // The returned string must be free()d by the caller.
-  static char* get_file_from_path(const char* path);
+  static char* get_file_from_path(const char* path,
+                                  TinyWebArena* arena=NULL);
+
+  // Returns in `buf', of `size' bytes, the name of the gzip
+  // compressed version of `filename': its extension is replaced with
+  // the first character of the extension followed by "GZ", as in
+  // JQUERY.JGZ for JQUERY.JS. Returns NULL if `filename' has no
+  // extension or `buf' is too small.
+  static char* get_gzip_file_name(const char* filename, char* buf, int size);
 
   // Guesses a MIME type based on the extension of `filename'. If none
   // could be guessed, the equivalent of text/html is returned.
   static MimeType get_mime_type_from_filename(const char* filename);
 
-  // Sends the contents of `file' to the currently connected
-  // client. The file must be opened in read mode.
+  // Registers the application's MIME types, a NULL terminated array
+  // which must stay around, usually a global. Its extensions are
+  // matched ignoring case and take precedence over the library's.
+  static void set_custom_mime_types(const MimeTypeMapping* types);
+
+  // Sends the contents of `file', from its current position and up
+  // to `length' bytes, to the currently connected client. The file
+  // must be opened in read mode.
+  //
+  // The file is read directly in the output buffer, so small files
+  // usually go out in the same packet as the headers.
+  void send_file(SdFile& file, uint32_t length=0xFFFFFFFF);
+
+  // Writes the value of a template variable to the response.
+  typedef void (*TemplateFn)(TinyWebServer& web_server);
+
+  // A variable of a template, see send_template().
+  typedef struct {
+    const char* name;
+    TemplateFn fn;
+  } TemplateVariable;
+
+  // Sends the template in `file', from its current position, replacing
+  // each {{name}} placeholder with what the function of the variable
+  // `name' in `variables' writes. `variables' is terminated by an
+  // entry with a NULL name. Unknown placeholders are dropped. The
+  // template is read a few bytes at a time, so it can be of any size.
   //
-  // This is mainly an optimization to reuse the internal static
-  // buffer used by this class, which saves us some RAM.
-  void send_file(SdFile& file);
+  // The length of the result isn't known in advance, so the headers
+  // should ask for chunked encoding with send_chunked_encoding().
+  void send_template(SdFile& file, const TemplateVariable* variables);
+
+  // Same as above, for a NUL terminated template in program memory.
+  void send_template_P(const char* data, const TemplateVariable* variables);
+
+#if TWS_STATS
+  // The statistics collected so far, and a way to start over.
+  static const TinyWebStats& get_stats();
+  static void reset_stats();
+#endif
+
+  // Sends a complete response for the file `filename' in the
+  // directory `dir', with an ETag and a Last-Modified header derived
+  // from the file's directory entry. When the client's If-None-Match
+  // or If-Modified-Since header shows it has the current version, a
+  // 304 response is sent without reading the file.
+  //
+  // A single byte range of the file may be requested with a Range
+  // header, and is sent in a 206 response, or a 416 one if it's
+  // beyond the end of the file.
+  //
+  // When the client accepts gzip encoded responses and there's a
+  // precompressed version of the file next to it, named as returned by
+  // get_gzip_file_name(), the compressed file is sent instead. Returns
+  // false, without sending anything, if the file can't be opened.
+  boolean serve_file(SdFile& dir, const char* filename);
+
+  // A response or request body moved over several calls to process(),
+  // after the handler returned, so that a large file doesn't hold up
+  // loop() and the other clients.
+  struct Transfer;
+
+  // Moves the next block of the transfer `t' of the current
+  // connection. Returns true once the transfer is over, after setting
+  // `t.complete' if it went all the way.
+  typedef boolean (*TransferStepFn)(TinyWebServer& web_server, Transfer& t);
+
+  // Called when a transfer is over, with whether it went all the way
+  // and the number of bytes moved.
+  typedef void (*TransferDoneFn)(TinyWebServer& web_server,
+                                 boolean complete, uint32_t bytes);
+
+  struct Transfer {
+    // NULL to send `file'.
+    TransferStepFn step;
+    TransferDoneFn done;
+    SdFile file;
+    // Room for the step function's data, e.g. an upload's block.
+    char block[TWS_PUT_BLOCK_SIZE];
+    // The bytes left to move, and those moved so far.
+    uint32_t remaining;
+    uint32_t transferred;
+    // When the last block was moved, for timeouts.
+    uint32_t last_activity;
+    boolean complete;
+
+    // Kept by the web server.
+    boolean persistent;
+    boolean drop_output;
+    uint32_t body_remaining;
+    void* connection;
+  };
+
+  // Sends `length' bytes of `file', from its current position, over
+  // the next calls to process() once the handler returns, then calls
+  // `done'. The headers must have a Content-Length. The file is closed
+  // once sent, don't close it yourself. Returns false, without sending
+  // anything, if TWS_MAX_TRANSFERS transfers are already in progress;
+  // send_file() is the way to go then. serve_file() uses this for the
+  // files that don't fit in the output buffer.
+  boolean queue_file(SdFile& file, uint32_t length=0xFFFFFFFF,
+                     TransferDoneFn done=NULL);
+
+  // Continues the current request over the next calls to process()
+  // once the handler returns: `step' is called on each of them, up to
+  // TWS_TRANSFER_BLOCKS times, until it returns true, then `done'.
+  // `length' is the initial value of Transfer::remaining. Returns the
+  // transfer, whose block the handler may start filling, or NULL if
+  // TWS_MAX_TRANSFERS transfers are already in progress.
+  Transfer* start_transfer(TransferStepFn step, TransferDoneFn done,
+                           uint32_t length);
+
+#if TWS_WEBSOCKETS
+  // The opcodes of WebSocket frames.
+  enum WebSocketOpcode {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xA,
+  };
+
+  // Called from process() with each data frame received on a
+  // WebSocket: its opcode, which is WS_CONTINUATION for the following
+  // frames of a fragmented message, and its unmasked data, followed
+  // by a NUL so text can be used as a string. send_frame() answers
+  // on the same WebSocket. Called with WS_CLOSE and no data once the
+  // WebSocket is closed, by either side.
+  typedef void (*WebSocketFn)(TinyWebServer& web_server, uint8_t opcode,
+                              uint8_t* data, uint16_t size);
+
+  // Answers a WebSocket handshake, turning the current connection
+  // into a WebSocket once the handler returns. Pings are answered and
+  // close frames are echoed by the web server, data frames are handed
+  // to `fn'. Returns false, without sending anything, if the request
+  // isn't a handshake or if TWS_MAX_WEBSOCKETS WebSockets are already
+  // open. A handshake for another version of the protocol than 13 is
+  // answered with 426 Upgrade Required, telling the version spoken,
+  // and false is returned as well.
+  boolean accept_websocket(WebSocketFn fn);
+
+  // Sends a frame of `size' bytes on the current WebSocket, from its
+  // WebSocketFn. Returns false if it's not connected anymore.
+  boolean send_frame(uint8_t opcode, const uint8_t* data, uint16_t size);
+
+  // Sends a frame of `size' bytes, or the string `text', on all the
+  // open WebSockets, from anywhere in the sketch. Returns the number
+  // of WebSockets it was sent on.
+  uint8_t broadcast_frame(uint8_t opcode, const uint8_t* data,
+                          uint16_t size);
+  uint8_t broadcast_text(const char* text);
+
+  // Closes the current WebSocket with the status `code'.
+  void close_websocket(uint16_t code=1000);
+#endif
+
+  // The results of parse_range().
+  enum { RANGE_NONE, RANGE_SATISFIABLE, RANGE_UNSATISFIABLE };
+
+  // Sends a complete response for the file of `bundle' whose path is
+  // the path of the request, ignoring its query string. Like
+  // serve_file(), it answers conditional requests with 304 responses.
+  // Clients that don't accept gzip get a 406 response for compressed
+  // files. Returns false, without sending anything, if there's no
+  // such file in the bundle.
+  boolean serve_bundle_file(const TinyWebBundleHandler::File* bundle);
+
+  // serve_file() remembers where the files it served are in their
+  // directory, and which files don't exist. Call this method when the
+  // file `filename' is created, replaced or deleted other than by
+  // TinyWebPutHandler::put_handler(), or clear_file_cache() to forget
+  // all the files.
+  void invalidate_cached_file(const char* filename);
+  void clear_file_cache();
+
+  // Sets the max-age, in seconds, of the Cache-Control header sent by
+  // serve_file(). It's 0 by default: clients cache the files, but
+  // check with the server every time they use them.
+  void set_cache_max_age(uint32_t seconds) { cache_max_age_ = seconds; }
 
-  // These methods write directly in the response stream of the
-  // connected client
+  // These methods write in the output buffer, which is sent to the
+  // connected client whenever it fills up, when flush() is called and
+  // after the handler returns.
   virtual size_t write(uint8_t c);
   virtual size_t write(const char *str);
   virtual size_t write(const uint8_t *buffer, size_t size);
 
+  // Sends the buffered output to the client.
+  void flush();
+
+  // Reads up to `size' bytes of the request's body in `buffer',
+  // without waiting for more to arrive. Returns the number of bytes
+  // read, 0 if none is available right now or the whole body, as
+  // given by its Content-Length, has been read.
+  //
+  // Handlers must read the body using these methods rather than
+  // get_client(), since its beginning is usually read together with
+  // the headers.
+  int read(uint8_t* buffer, int size);
+
+  // Returns the next byte of the request's body, or -1 if none is
+  // available.
+  int read();
+
+  // A field of an application/x-www-form-urlencoded body to be filled
+  // in by read_form(). `value' points to a buffer of `size' bytes
+  // that receives the decoded, NUL terminated and possibly truncated
+  // value; `found' tells whether the field was present.
+  typedef struct {
+    const char* name;
+    char* value;
+    uint8_t size;
+    boolean found;
+  } FormField;
+
+  // Called by read_form() with each decoded field of the body.
+  typedef void (*FormFieldFn)(TinyWebServer& web_server,
+                              const char* name, const char* value);
+
+  // Reads the request's body as an application/x-www-form-urlencoded
+  // form, one field at a time, and calls `fn' for each of them, or
+  // fills in the matching entries of `fields', an array terminated by
+  // an entry with a NULL name. Names and values longer than
+  // TWS_FORM_FIELD_SIZE bytes altogether are truncated. Returns false
+  // if the body couldn't be read completely.
+  boolean read_form(FormFieldFn fn);
+  boolean read_form(FormField* fields);
+
   // Some methods used for testing purposes
 
   // Returns true if the HTTP request processing should be stopped.
   virtual boolean should_stop_processing() { return !client_.connected();}
 
-  // Reads a character from the request's input stream. Returns true
-  // if the character could be read, false otherwise.
-  virtual boolean read_next_char(Client& client, uint8_t* ch);
+  // Reads up to `size' bytes of input from `client' in `buffer',
+  // without waiting for them. Returns the number of bytes read. All
+  // the input is read through this method.
+  virtual int read_block(Client& client, uint8_t* buffer, int size);
+
+  // Writes `size' bytes of `buffer' to `client'. All the output is
+  // written through this method.
+  virtual void write_block(Client& client, const uint8_t* buffer,
+                           size_t size);
+
+  // Returns true if `client' is still connected.
+  virtual boolean is_connected(Client& client) { return client.connected(); }
 
  protected:
   // Returns the field number `which' from buffer. Fields are
   // separated by spaces. Should be a private method, but made public
   // so it can be tested.
-  static char* get_field(const char* buffer, int which);
+  static char* get_field(const char* buffer, int which,
+                         TinyWebArena* arena=NULL);
+
+  // Parses the value of a Range header for a file of `size' bytes
+  // into the positions of the `first' and `last' bytes to send.
+  // Returns RANGE_NONE if the whole file should be sent, and
+  // RANGE_UNSATISFIABLE if the range is beyond the end of the file.
+  static int parse_range(const char* value, uint32_t size,
+                         uint32_t* first, uint32_t* last);
+
+  // Finds the parameter `name' in the query string `query' for
+  // get_query_param().
+  static boolean find_query_param(const char* query, const char* name,
+                                  char* buffer, int size);
+
+  // Returns the extension number `index' of the built-in MIME types,
+  // in program memory, or NULL past the last one. Protected so the
+  // order get_mime_type_from_filename() relies on can be tested.
+  static const char* get_mime_extension(int index);
+
+#if TWS_WEBSOCKETS
+  // Computes the Sec-WebSocket-Accept value for the Sec-WebSocket-Key
+  // `key' into `accept', which must have room for 29 characters.
+  static void websocket_accept_key(const char* key, char* accept);
+#endif
+
+  // Builds the routes trie from handlers_, called by begin(). Without
+  // memory for it, the handlers are checked one by one for each
+  // request.
+  void compile_routes();
+
+  // Finds the handler for a `type' request of `path' and records the
+  // path parameters. Returns its index in handlers_, or -1 if there's
+  // none. Protected so it can be tested.
+  int find_handler(char* path, HttpRequestType type);
+
+  // Starts reading the requests of `client', unless it's already
+  // known or all the connections are taken, as process() does for
+  // each client with pending input. Protected so it can be tested.
+  void accept_client(EthernetClient& client);
+
+  // Returns true if one of the connections is open on `client'.
+  // Protected so it can be tested.
+  boolean has_client(EthernetClient& client);
+
+  // Sets `index' to the index of the directory entry that serve_file()
+  // remembers for the file `filename' in `dir', NO_FILE_INDEX if it
+  // remembers there's no such file. Returns false if the file isn't
+  // cached, or wasn't looked up yet. Protected so it can be tested.
+  boolean get_cached_file_index(SdFile& dir, const char* filename,
+                                uint16_t* index);
+  static const uint16_t NO_FILE_INDEX = 0xFFFF;
 
 private:
   // The path handlers
   PathHandler* handlers_;
 
+  // A requested header and the position of its value in the current
+  // connection's buffer. An offset of 0 means the request didn't have
+  // the header.
   typedef struct {
     const char* header;
-    char* value;
+    uint16_t hash;
+    uint16_t offset;
+    uint16_t length;
   } HeaderValue;
 
   // The headers
@@ -174,20 +984,269 @@ private:
   EthernetServer server_;
 
   char* path_;
+  char* query_;
   HttpRequestType request_type_;
   EthernetClient client_;
 
-  // Reads a line from the HTTP request sent by an HTTP client. The
-  // line is put in `buffer' and up to `size' characters are written
-  // in it.
-  boolean get_line(char* buffer, int size);
+  // The states of a connection. A request is read one character at a
+  // time, a few of them on every call to process().
+  enum ConnectionState {
+    CONNECTION_FREE,
+    REQUEST_LINE,
+    HEADER_START,
+    HEADER_NAME,
+    HEADER_VALUE_SKIP_INITIAL_SPACES,
+    HEADER_VALUE,
+    HEADER_IGNORE_VALUE,
+    // A Transfer is in progress.
+    CONNECTION_TRANSFER,
+    // The connection is a WebSocket.
+    CONNECTION_WEBSOCKET,
+  };
+
+  typedef struct {
+    EthernetClient client;
+    uint8_t state;
+    uint8_t requests_served;
+    // Where the next character goes in `buffer', or in `values' once
+    // the request line was read, and where the current header begins.
+    uint16_t pos;
+    uint16_t mark;
+    // The hash of the header name being read.
+    uint16_t hash;
+    uint32_t last_activity;
+#if TWS_STATS
+    // When the current request started, and when its headers did.
+    uint32_t request_start;
+    uint32_t headers_start;
+#endif
+    // Input read from the client, not parsed yet.
+    uint8_t input[TWS_INPUT_BUFFER_SIZE];
+    uint8_t input_pos;
+    uint8_t input_len;
+    // The NUL terminated request line. On a WebSocket, the frame
+    // being received: `pos' bytes of it so far, of `mark' bytes once
+    // its length is known.
+    char buffer[TWS_REQUEST_BUFFER_SIZE];
+    // The NUL terminated values of the requested headers, each
+    // preceded by the header's index + 1.
+    char values[TWS_HEADER_BUFFER_SIZE];
+#if TWS_WEBSOCKETS
+    WebSocketFn websocket_fn;
+#endif
+  } Connection;
+
+  Connection connections_[TWS_MAX_CONNECTIONS];
+
+  // The connection whose request is being handled.
+  Connection* current_;
+
+  Transfer transfers_[TWS_MAX_TRANSFERS];
+
+  // The transfer started by the current handler.
+  Transfer* pending_transfer_;
+
+  // Returns a free transfer, initialized for the current request, or
+  // NULL if there's none.
+  Transfer* new_transfer();
+
+  // Reads what's left of the request's body, if it's already here,
+  // and keeps the connection for the next request or closes it.
+  void finish_request(Connection& c, boolean should_close);
+
+  // Moves a few blocks of the transfer of `c', and finishes the
+  // request once it's over.
+  void advance_transfer(Connection& c);
+
+  // Calls the done function of `t', closes its file and releases it.
+  // Returns whether the transfer was complete.
+  boolean end_transfer(Transfer& t);
+
+  // Sends the next block of the file of `t'.
+  boolean send_file_block(Transfer& t);
+
+#if TWS_WEBSOCKETS
+  // The function of the WebSocket accepted by the current handler.
+  WebSocketFn pending_websocket_;
+
+  // Reads the frames of the WebSocket `c', and hands them over.
+  void advance_websocket(Connection& c);
+
+  // Handles the complete frame in the buffer of `c'.
+  void handle_frame(Connection& c);
+
+  // Sends a frame with `size' bytes of `data' to `client'.
+  boolean write_frame(EthernetClient& client, uint8_t opcode,
+                      const uint8_t* data, uint16_t size);
+
+  // Sends a close frame with the status `code' to `c', and closes it.
+  void close_websocket(Connection& c, uint16_t code);
+#endif
+
+  // Backs the path, the header values and the handlers' allocations.
+  TinyWebArena arena_;
+
+  // Persistent connections configuration, see set_keep_alive().
+  uint16_t keep_alive_timeout_;
+  uint8_t max_keep_alive_requests_;
+
+  // See set_cache_max_age().
+  uint32_t cache_max_age_;
+
+  // Whether the current request allows the connection to be reused,
+  // and whether the response does.
+  boolean keep_alive_;
+  boolean persistent_;
+  boolean content_length_sent_;
+
+  // Whether the request is an HTTP/1.1 one, whether the response is
+  // sent in chunks, and whether a chunk was sent already.
+  boolean http_11_;
+  boolean chunked_;
+  boolean chunk_sent_;
+
+  // Whether the response ends with its headers, as for HEAD requests.
+  // Whatever the handler writes after them is dropped.
+  boolean headers_only_;
+  boolean drop_output_;
+
+  // The number of bytes of the request's body not read yet.
+  int32_t body_remaining_;
+
+  // Response data not sent yet.
+  uint8_t output_[TWS_OUTPUT_BUFFER_SIZE];
+  uint16_t output_len_;
+
+  // Where the data of the current chunk starts in output_, 0 unless
+  // the response is sent in chunks. The chunk's size line goes in the
+  // CHUNK_HEADER_SIZE bytes before it: the end of the previous chunk,
+  // 4 hex digits and CRLF.
+  enum { CHUNK_HEADER_SIZE = 8 };
+  uint16_t output_start_;
+
+  // Sends the current chunk, and the last, empty chunk if `last' is
+  // true.
+  void flush_chunk(boolean last);
+
+  // Sends `size' bytes of the response to the client.
+  void send(const uint8_t* data, size_t size);
+  void send(EthernetClient& client, const uint8_t* data, size_t size);
+
+  // Where send_template() is within a template, between two blocks.
+  enum TemplateState {
+    TEMPLATE_TEXT,
+    TEMPLATE_OPEN,
+    TEMPLATE_NAME,
+    TEMPLATE_CLOSE,
+  };
+
+  typedef struct {
+    TemplateState state;
+    uint8_t length;
+    char name[TWS_TEMPLATE_NAME_SIZE + 1];
+  } Template;
+
+  // Sends the next `size' bytes of a template.
+  void render_template(Template& t, const char* block, int size,
+                       const TemplateVariable* variables);
+
+  // Sends what's left of an unfinished placeholder at the end of a
+  // template.
+  void end_template(Template& t);
+
+  // Reads the body as a form for both read_form() variants.
+  boolean read_form(FormFieldFn fn, FormField* fields);
+
+  // Hands a field read by read_form() over to `fn' or `fields'.
+  void form_field(FormFieldFn fn, FormField* fields,
+                  char* name, char* value);
+
+  // A node of the compiled routes trie, matching one segment of the
+  // request path. Nodes are referred to by their index.
+  typedef struct {
+    const char* segment;
+    uint8_t length;
+    uint8_t kind;
+    uint8_t first_child;
+    uint8_t next_sibling;
+    // The first handler whose path ends here, the others follow in
+    // next_route_.
+    uint8_t first_route;
+  } RouteNode;
+
+  // A handler matching the current request, and the positions of the
+  // path parameters in path_.
+  typedef struct {
+    uint8_t route;
+    uint8_t params;
+    uint8_t param_pos[TWS_MAX_PATH_PARAMS];
+    uint8_t param_len[TWS_MAX_PATH_PARAMS];
+  } RouteMatch;
+
+  enum { NO_ROUTE = 0xFF };
+
+  RouteNode* route_nodes_;
+  uint8_t* next_route_;
+  uint8_t route_node_count_;
+  RouteMatch route_match_;
+
+  void match_routes(uint8_t node, const char* rest,
+                    RouteMatch& current, RouteMatch& best);
+  void match_node_routes(uint8_t node, RouteMatch& current, RouteMatch& best);
+
+  void start_connection(Connection& c, EthernetClient& client);
+  void close_connection(Connection& c);
+
+  // Reads the available input of `c', up to TWS_INPUT_BUFFER_SIZE
+  // characters, and dispatches the request once it's complete.
+  void advance_connection(Connection& c);
+
+  // Feeds the unparsed input of `c' to its parser, until the request
+  // is complete. Returns like parse_char().
+  int parse_input(Connection& c);
+
+  // Feeds `ch' to the request parser of `c'. Returns 0 if more input
+  // is needed, 200 once the request has been read completely, or the
+  // HTTP error code to reply with.
+  int parse_char(Connection& c, char ch);
+
+  // Calls the handler for the request read by `c'.
+  void dispatch(Connection& c);
+
+  // Opens the file `filename' in `dir', or its compressed version if
+  // `gzip' is true and there's one, as told by `gzipped'. `has_gzip'
+  // tells whether there's a compressed version, used or not.
+  boolean open_file(SdFile& dir, const char* filename, boolean gzip,
+                    SdFile& file, boolean* gzipped, boolean* has_gzip);
+
+#if TWS_FILE_CACHE_SIZE > 0
+  // A file served by serve_file(). The indexes of the directory
+  // entries of the file and of its compressed version are
+  // UNKNOWN_FILE until looked up, and NO_FILE if the file
+  // doesn't exist.
+  typedef struct {
+    SdFile* dir;
+    char name[13];
+    uint8_t age;
+    uint16_t index[2];
+  } CachedFile;
+
+  CachedFile file_cache_[TWS_FILE_CACHE_SIZE];
+
+  // Returns the cache entry for `filename', a new one if it wasn't
+  // cached, and marks it as the most recently used.
+  CachedFile* find_cached_file(SdFile& dir, const char* filename);
+#endif
+
+  // Forgets the header values of the previous request.
+  void clear_header_values();
 
-  // Returns true if the header is marked as requested in the headers_
-  // array. As a side effect, the pointer to the actual header is made
-  // to point to the one in the headers_ array.
-  boolean is_requested_header(const char** header);
+  // Returns the index of the header `name', whose hash is `hash', in
+  // headers_, or -1 if it wasn't requested.
+  int find_header(uint16_t hash, const char* name);
 
-  boolean assign_header_value(const char* header, char* value);
+  // Points the header values in headers_ to those read by `c'.
+  void assign_header_values(Connection& c);
 };
 
 #endif /* __WEB_SERVER_H__ */
@@ -16,16 +16,48 @@ extern "C" {
 
 #include <TinyWebServer.h>
 
+// Generated from the static/ directory with:
+//
+//   ../extras/make_bundle.py --gzip --name test_bundle static bundle.h
+#include "bundle.h"
+
 class TinyWebServerTest : public TinyWebServer {
 public:
   TinyWebServerTest(PathHandler handlers[], const char** headers,
 		    const _FLASH_STRING& content)
     : TinyWebServer(handlers, headers),
       content_(content),
-      pos_(0) {}
+      pos_(0) {
+    compile_routes();
+  }
+
+  static char* get_field_public(const char* buffer, int which,
+                                TinyWebArena* arena = NULL) {
+    return get_field(buffer, which, arena);
+  }
+
+  static int parse_range_public(const char* value, uint32_t size,
+                                uint32_t* first, uint32_t* last) {
+    return parse_range(value, size, first, last);
+  }
+
+  static boolean find_query_param_public(const char* query, const char* name,
+                                        char* buffer, int size) {
+    return find_query_param(query, name, buffer, size);
+  }
+
+  static const char* get_mime_extension_public(int index) {
+    return get_mime_extension(index);
+  }
+
+#if TWS_WEBSOCKETS
+  static void websocket_accept_key_public(const char* key, char* accept) {
+    websocket_accept_key(key, accept);
+  }
+#endif
 
-  static char* get_field_public(const char* buffer, int which) {
-    return get_field(buffer, which);
+  int find_handler_public(const char* path, HttpRequestType type) {
+    return find_handler((char*)path, type);
   }
 
 protected:
@@ -35,22 +67,21 @@ protected:
   // Returns true if the HTTP request processing should be stopped.
   virtual boolean should_stop_processing() { return false; }
 
-  // Reads a character from the request's input stream. Returns true
-  // if the character could be read, false otherwise.
-  virtual boolean read_next_char(Client& client, uint8_t* ch) {
-    if (pos_ == content_.length()) {
-      return false;
-    } else {
-      *ch = content_[pos_++];
-      return true;
+  // Reads up to `size' characters from the request's input
+  // stream. Returns the number of characters read.
+  virtual int read_block(Client& client, uint8_t* buffer, int size) {
+    int n = 0;
+    while (n < size && pos_ < content_.length()) {
+      buffer[n++] = content_[pos_++];
     }
+    return n;
   }
 };
 
 int failures = 0;
 
 void expect_str_eq(const char* s1, char* s2, boolean free_s2 = true) {
-  if (strcmp(s1, s2) != 0) {
+  if (s1 != s2 && (!s1 || !s2 || strcmp(s1, s2) != 0)) {
     Serial << F("FAIL: expect ") << s1 << F(", got ") << s2 << "\n";
     failures++;
   }
@@ -94,6 +125,30 @@ void test_get_file_from_path() {
   		TinyWebServer::get_file_from_path("/a/b/index%2Ehtm"));
 }
 
+void test_get_gzip_file_name() {
+  char buf[13];
+  expect_str_eq("JQUERY.JGZ",
+                TinyWebServer::get_gzip_file_name("JQUERY.JS", buf,
+                                                  sizeof(buf)),
+                false /* don't free the second argument */);
+  expect_str_eq("INDEX.HGZ",
+                TinyWebServer::get_gzip_file_name("INDEX.HTM", buf,
+                                                  sizeof(buf)),
+                false /* don't free the second argument */);
+  expect_str_eq("LONGNAME.CGZ",
+                TinyWebServer::get_gzip_file_name("LONGNAME.CSS", buf,
+                                                  sizeof(buf)),
+                false /* don't free the second argument */);
+  expect_str_eq(NULL,
+                TinyWebServer::get_gzip_file_name("README", buf,
+                                                  sizeof(buf)),
+                false /* don't free the second argument */);
+  expect_str_eq(NULL,
+                TinyWebServer::get_gzip_file_name("LONGERNAME.JS", buf,
+                                                  sizeof(buf)),
+                false /* don't free the second argument */);
+}
+
 void test_get_mime_type_from_filename() {
   uint16_t codes[9];
   uint16_t html_code;
@@ -140,6 +195,52 @@ void test_get_mime_type_from_filename() {
       failures++;
     }
   }
+
+  // Every extension in the library's table is found.
+  const char* names[] = {
+    "a.css", "a.gif", "a.html", "a.ico", "a.jpeg", "a.jpg", "a.js",
+    "a.json", "a.mp3", "a.pdf", "a.png", "a.svg", "a.txt", "a.wasm",
+    "a.woff", "a.woff2", "a.xml", NULL
+  };
+  for (int i = 0; names[i]; i++) {
+    expect_true(TinyWebServer::get_mime_type_from_filename(names[i])
+                != codes[0] || !strcmp(names[i], "a.html"));
+  }
+
+  // The binary search needs the table sorted, and finds all of it.
+  char previous[8] = "";
+  char name[10];
+  for (int i = 0; TinyWebServerTest::get_mime_extension_public(i); i++) {
+    const char* extension = TinyWebServerTest::get_mime_extension_public(i);
+    expect_true(strcmp_P(previous, extension) < 0);
+    strcpy_P(previous, extension);
+    sprintf(name, "A.%s", previous);
+    expect_true(TinyWebServer::get_mime_type_from_filename(name) != codes[0]
+                || !strcmp(previous, "HTM") || !strcmp(previous, "HTML"));
+  }
+  expect_true(previous[0] != 0);
+  expect_num_eq(codes[0], TinyWebServer::get_mime_type_from_filename("a.html"));
+  expect_num_eq(codes[0], TinyWebServer::get_mime_type_from_filename("a.zip"));
+  expect_num_eq(codes[0], TinyWebServer::get_mime_type_from_filename("a"));
+  expect_num_eq(codes[0],
+                TinyWebServer::get_mime_type_from_filename("a.toolong"));
+  expect_true(TinyWebServer::get_mime_type_from_filename("a.woff")
+              != TinyWebServer::get_mime_type_from_filename("a.woff2"));
+
+  static const TinyWebServer::MimeTypeMapping custom[] = {
+    {"csv", "text/csv"},
+    {"txt", "text/plain; charset=utf-8"},
+    {NULL},
+  };
+  TinyWebServer::set_custom_mime_types(custom);
+  expect_num_eq(TinyWebServer::MIME_TYPE_CUSTOM,
+                TinyWebServer::get_mime_type_from_filename("DATA.CSV"));
+  expect_num_eq(TinyWebServer::MIME_TYPE_CUSTOM + 1,
+                TinyWebServer::get_mime_type_from_filename("a.txt"));
+  expect_num_eq(codes[2],
+                TinyWebServer::get_mime_type_from_filename("a.css"));
+  TinyWebServer::set_custom_mime_types(NULL);
+  expect_num_eq(codes[1], TinyWebServer::get_mime_type_from_filename("a.txt"));
 }
 
 void test_get_field() {
@@ -164,6 +265,137 @@ void test_get_field() {
   }
 }
 
+void test_arena() {
+  TinyWebArena arena(64);
+  expect_num_eq(64, arena.capacity());
+  expect_num_eq(0, arena.used());
+
+  expect_str_eq("index.htm",
+                TinyWebServer::decode_url_encoded("index%2Ehtm", &arena),
+                false /* owned by the arena */);
+  expect_str_eq("INDEX.HTM",
+                TinyWebServer::get_file_from_path("/a/index%2Ehtm", &arena),
+                false /* owned by the arena */);
+  expect_str_eq("/", TinyWebServerTest::get_field_public("GET / HTTP/1.0", 1,
+                                                         &arena),
+                false /* owned by the arena */);
+  size_t used = arena.used();
+  expect_true(used > 0);
+
+  // Running out of space fails the allocation without side effects.
+  expect_true(arena.alloc(64) == NULL);
+  expect_num_eq(used, arena.used());
+
+  arena.reset();
+  expect_num_eq(0, arena.used());
+  expect_num_eq(used, arena.high_water_mark());
+  expect_true(arena.alloc(64) != NULL);
+  expect_num_eq(64, arena.high_water_mark());
+}
+
+boolean dummy_handler(TinyWebServer& web_server) {
+  return true;
+}
+
+void expect_path_param(TinyWebServer& web, const char* name,
+                       const char* value) {
+  uint8_t length;
+  const char* param = web.get_path_param(name, &length);
+  expect_true(param && length == strlen(value)
+              && !strncmp(param, value, length));
+}
+
+void test_find_handler() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/", TinyWebServer::GET, &dummy_handler},
+    {"/led/:id", TinyWebServer::POST, &dummy_handler},
+    {"/led/:id/:state", TinyWebServer::ANY, &dummy_handler},
+    {"/led/all", TinyWebServer::ANY, &dummy_handler},
+    {"/upload/" "*", TinyWebServer::PUT, &dummy_handler},
+    {"/status*", TinyWebServer::ANY, &dummy_handler},
+    {"/" "*", TinyWebServer::GET, &dummy_handler},
+    {NULL},
+  };
+  FLASH_STRING(content, "");
+  TinyWebServerTest web(handlers, NULL, content);
+
+  expect_num_eq(0, web.find_handler_public("/", TinyWebServer::GET));
+  expect_num_eq(1, web.find_handler_public("/led/12", TinyWebServer::POST));
+  expect_path_param(web, "id", "12");
+  expect_true(!web.get_path_param("state", NULL));
+  expect_num_eq(2, web.find_handler_public("/led/7/on", TinyWebServer::GET));
+  expect_path_param(web, "id", "7");
+  expect_path_param(web, "state", "on");
+  // Declared first, so "/led/:id" wins over "/led/all".
+  expect_num_eq(1, web.find_handler_public("/led/all", TinyWebServer::POST));
+  expect_num_eq(3, web.find_handler_public("/led/all", TinyWebServer::GET));
+  expect_num_eq(4, web.find_handler_public("/upload/A.TXT",
+                                           TinyWebServer::PUT));
+  expect_num_eq(6, web.find_handler_public("/upload/A.TXT",
+                                           TinyWebServer::GET));
+  expect_num_eq(5, web.find_handler_public("/status?x=1",
+                                           TinyWebServer::GET));
+  expect_num_eq(6, web.find_handler_public("/led/", TinyWebServer::GET));
+  expect_num_eq(-1, web.find_handler_public("/led/", TinyWebServer::PUT));
+  expect_num_eq(-1, web.find_handler_public("/index.htm",
+                                            TinyWebServer::POST));
+}
+
+void expect_range(const char* value, uint32_t size, int expected,
+                  uint32_t expected_first = 0, uint32_t expected_last = 0) {
+  uint32_t first, last;
+  int r = TinyWebServerTest::parse_range_public(value, size, &first, &last);
+  expect_num_eq(expected, r);
+  if (r == TinyWebServerTest::RANGE_SATISFIABLE) {
+    expect_num_eq(expected_first, first);
+    expect_num_eq(expected_last, last);
+  }
+}
+
+void test_parse_range() {
+  expect_range(NULL, 1000, TinyWebServerTest::RANGE_NONE);
+  expect_range("bytes=0-499", 1000, TinyWebServerTest::RANGE_SATISFIABLE,
+               0, 499);
+  expect_range("bytes=500-", 1000, TinyWebServerTest::RANGE_SATISFIABLE,
+               500, 999);
+  expect_range("bytes=-100", 1000, TinyWebServerTest::RANGE_SATISFIABLE,
+               900, 999);
+  expect_range("bytes=-2000", 1000, TinyWebServerTest::RANGE_SATISFIABLE,
+               0, 999);
+  expect_range("bytes=900-2000", 1000, TinyWebServerTest::RANGE_SATISFIABLE,
+               900, 999);
+  expect_range("bytes=1000-", 1000, TinyWebServerTest::RANGE_UNSATISFIABLE);
+  expect_range("bytes=-0", 1000, TinyWebServerTest::RANGE_UNSATISFIABLE);
+  expect_range("bytes=5-1", 1000, TinyWebServerTest::RANGE_NONE);
+  expect_range("bytes=0-1,5-6", 1000, TinyWebServerTest::RANGE_NONE);
+  expect_range("items=0-1", 1000, TinyWebServerTest::RANGE_NONE);
+  expect_range("bytes=99999999999-", 1000, TinyWebServerTest::RANGE_NONE);
+}
+
+void test_find_query_param() {
+  const char* query = "a=1&name=Living+room%21&flag&b=%4&led=12345";
+  char buf[8];
+  expect_true(TinyWebServerTest::find_query_param_public(query, "a",
+                                                         buf, sizeof(buf)));
+  expect_str_eq("1", buf, false);
+  expect_true(TinyWebServerTest::find_query_param_public(query, "name",
+                                                         buf, sizeof(buf)));
+  expect_str_eq("Living ", buf, false);
+  expect_true(TinyWebServerTest::find_query_param_public(query, "flag",
+                                                         buf, sizeof(buf)));
+  expect_str_eq("", buf, false);
+  expect_true(TinyWebServerTest::find_query_param_public(query, "b",
+                                                         buf, sizeof(buf)));
+  expect_str_eq("%4", buf, false);
+  expect_true(TinyWebServerTest::find_query_param_public(query, "led",
+                                                         buf, 3));
+  expect_str_eq("12", buf, false);
+  expect_true(!TinyWebServerTest::find_query_param_public(query, "nam",
+                                                          buf, sizeof(buf)));
+  expect_true(!TinyWebServerTest::find_query_param_public(NULL, "a",
+                                                          buf, sizeof(buf)));
+}
+
 void test_process_headers() {
   FLASH_STRING(content,
 	       "User-Agent: curl/7.19.7\r\n"
@@ -187,6 +419,32 @@ void test_process_headers() {
 		false /* don't free the second argument */);
 }
 
+void test_process_headers_ignoring_case() {
+  FLASH_STRING(content,
+	       "host: arduino\r\n"
+	       "content-length: 42\r\n"
+	       "X-CUSTOM-HEADER: a value \r\n"
+	       "\r\n"
+	       );
+  const char* headers[] = {
+    "Host",
+    "X-Custom-Header",
+    NULL
+  };
+
+  TinyWebServerTest web(NULL, headers, content);
+  expect_true(web.process_headers());
+  expect_str_eq("arduino", (char*)web.get_header_value("HOST"),
+		false /* don't free the second argument */);
+  expect_str_eq("42", (char*)web.get_header_value("Content-Length"),
+		false /* don't free the second argument */);
+  uint16_t length;
+  expect_str_eq("a value ",
+                (char*)web.get_header_value("x-custom-header", &length),
+		false /* don't free the second argument */);
+  expect_num_eq(8, length);
+}
+
 void test_process_broken_headers() {
   FLASH_STRING(content,
 	       "User-Agent curl/7.19.7\r\n"
@@ -194,7 +452,1560 @@ void test_process_broken_headers() {
 
   TinyWebServerTest web(NULL, NULL, content);
   expect_true(!web.process_headers());
+
+  // A body whose length can't be known.
+  FLASH_STRING(negative, "Content-Length: -5\r\n\r\n");
+  TinyWebServerTest web2(NULL, NULL, negative);
+  expect_true(!web2.process_headers());
+  FLASH_STRING(overflow, "Content-Length: 4765873541907243859614\r\n\r\n");
+  TinyWebServerTest web3(NULL, NULL, overflow);
+  expect_true(!web3.process_headers());
+}
+
+// Collects the response instead of sending it.
+class TinyWebServerOutputTest : public TinyWebServerTest {
+public:
+  TinyWebServerOutputTest(const _FLASH_STRING& content)
+    : TinyWebServerTest(NULL, NULL, content), length_(0) {
+    output_[0] = 0;
+  }
+
+  using TinyWebServer::write;
+
+  virtual size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
+
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size && length_ + 1 < sizeof(output_); i++) {
+      output_[length_++] = buffer[i];
+    }
+    output_[length_] = 0;
+    return size;
+  }
+
+  char* output() { return output_; }
+
+private:
+  char output_[128];
+  size_t length_;
+};
+
+// Plays a client sending a request, or several, through read_block()
+// and collects the bytes written back to it.
+class TinyWebServerClientTest : public TinyWebServer {
+public:
+  TinyWebServerClientTest(PathHandler handlers[], const char** headers)
+    : TinyWebServer(handlers, headers),
+      client_(0), input_(NULL), length_(0), pos_(0), piece_(0),
+      output_length_(0) {
+    compile_routes();
+  }
+
+  // Has the server read `length' bytes of `input', at most `piece'
+  // bytes per read, over as many calls to process() as it takes, and
+  // until nothing moves anymore or the connection is closed.
+  void run(const char* input, int length, int piece) {
+    input_ = (const uint8_t*)input;
+    length_ = length;
+    pos_ = 0;
+    piece_ = piece;
+    accept_client(client_);
+    for (int idle = 0; idle < 8 && has_client(client_);) {
+      int pos = pos_;
+      size_t output_length = output_length_;
+      process();
+      idle = pos == pos_ && output_length == output_length_ ? idle + 1 : 0;
+    }
+  }
+
+  void run(const char* input) {
+    run(input, strlen(input), TWS_INPUT_BUFFER_SIZE);
+  }
+
+  boolean is_open() { return has_client(client_); }
+
+  using TinyWebServer::get_cached_file_index;
+  using TinyWebServer::NO_FILE_INDEX;
+
+  const char* output() { return output_; }
+  size_t output_length() { return output_length_; }
+  void clear_output() {
+    output_length_ = 0;
+    output_[0] = 0;
+  }
+
+  // Returns true if the output ends with the `size' bytes of
+  // `expected'.
+  boolean output_ends_with(const char* expected, size_t size) {
+    return output_length_ >= size
+      && !memcmp(output_ + output_length_ - size, expected, size);
+  }
+
+protected:
+  virtual boolean should_stop_processing() { return false; }
+
+  virtual int read_block(Client& client, uint8_t* buffer, int size) {
+    int n = length_ - pos_;
+    if (n > size) {
+      n = size;
+    }
+    if (n > piece_) {
+      n = piece_;
+    }
+    memcpy(buffer, input_ + pos_, n);
+    pos_ += n;
+    return n;
+  }
+
+  virtual void write_block(Client& client, const uint8_t* buffer,
+                           size_t size) {
+    for (size_t i = 0; i < size && output_length_ + 1 < sizeof(output_);
+         i++) {
+      output_[output_length_++] = buffer[i];
+    }
+    output_[output_length_] = 0;
+  }
+
+  virtual boolean is_connected(Client& client) { return true; }
+
+private:
+  EthernetClient client_;
+  const uint8_t* input_;
+  int length_;
+  int pos_;
+  int piece_;
+  char output_[1024];
+  size_t output_length_;
+};
+
+// Serves two clients at once, each with its own input and output, one
+// call to process() at a time.
+class TinyWebServerMultiClientTest : public TinyWebServer {
+public:
+  TinyWebServerMultiClientTest(PathHandler handlers[], const char** headers)
+    : TinyWebServer(handlers, headers) {
+    for (int i = 0; i < 2; i++) {
+      peers_[i].client = EthernetClient(i);
+      peers_[i].input = NULL;
+      peers_[i].length = peers_[i].pos = peers_[i].piece = 0;
+      peers_[i].output_length = 0;
+      peers_[i].output[0] = 0;
+    }
+    compile_routes();
+  }
+
+  // Has client `i' connect and send `input', at most `piece' bytes per
+  // read.
+  void connect(int i, const char* input, int length, int piece) {
+    Peer& p = peers_[i];
+    p.input = (const uint8_t*)input;
+    p.length = length;
+    p.pos = 0;
+    p.piece = piece;
+    accept_client(p.client);
+  }
+
+  void connect(int i, const char* input, int piece) {
+    connect(i, input, strlen(input), piece);
+  }
+
+  boolean is_open(int i) { return has_client(peers_[i].client); }
+
+  // Whether client `i' has sent all of its input.
+  boolean is_sent(int i) { return peers_[i].pos == peers_[i].length; }
+
+  const char* output(int i) { return peers_[i].output; }
+  size_t output_length(int i) { return peers_[i].output_length; }
+
+protected:
+  virtual boolean should_stop_processing() { return false; }
+
+  virtual int read_block(Client& client, uint8_t* buffer, int size) {
+    Peer& p = peer(client);
+    int n = p.length - p.pos;
+    if (n > size) {
+      n = size;
+    }
+    if (n > p.piece) {
+      n = p.piece;
+    }
+    memcpy(buffer, p.input + p.pos, n);
+    p.pos += n;
+    return n;
+  }
+
+  virtual void write_block(Client& client, const uint8_t* buffer,
+                           size_t size) {
+    Peer& p = peer(client);
+    for (size_t i = 0; i < size && p.output_length + 1 < sizeof(p.output);
+         i++) {
+      p.output[p.output_length++] = buffer[i];
+    }
+    p.output[p.output_length] = 0;
+  }
+
+  virtual boolean is_connected(Client& client) { return true; }
+
+private:
+  typedef struct {
+    EthernetClient client;
+    const uint8_t* input;
+    int length;
+    int pos;
+    int piece;
+    // Room for a file sent over a few calls to process().
+    char output[TWS_OUTPUT_BUFFER_SIZE * (2 * TWS_TRANSFER_BLOCKS + 4)];
+    size_t output_length;
+  } Peer;
+
+  Peer& peer(Client& client) {
+    return (EthernetClient&)client == peers_[1].client
+      ? peers_[1] : peers_[0];
+  }
+
+  Peer peers_[2];
+};
+
+void write_led_state(TinyWebServer& web_server) {
+  web_server << F("on");
+}
+
+void write_count(TinyWebServer& web_server) {
+  web_server.print(42);
+}
+
+void test_send_template() {
+  FLASH_STRING(content, "");
+  const TinyWebServer::TemplateVariable variables[] = {
+    {"led_state", &write_led_state},
+    {"count", &write_count},
+    {NULL},
+  };
+  static const char tmpl[] PROGMEM =
+    "<a class=\"{{led_state}}\">{{ count }}</a>{{unknown}}"
+    "{x}{{a}b}}{{ open";
+  TinyWebServerOutputTest web(content);
+  web.send_template_P(tmpl, variables);
+  expect_str_eq("<a class=\"on\">42</a>{x}{{ open", web.output(), false);
+}
+
+// Sends a body a bit longer than the output buffer, in chunks when
+// the client allows it.
+const int chunked_body_length = TWS_OUTPUT_BUFFER_SIZE + 50;
+
+boolean chunked_handler(TinyWebServer& web_server) {
+  web_server.send_error_code(200);
+  web_server.send_chunked_encoding();
+  web_server.end_headers();
+  for (int i = 0; i < chunked_body_length; i++) {
+    web_server.write('a' + i % 26);
+  }
+  return true;
+}
+
+boolean empty_chunked_handler(TinyWebServer& web_server) {
+  web_server.send_error_code(200);
+  web_server.send_chunked_encoding();
+  web_server.end_headers();
+  return true;
+}
+
+// Returns true if the headers of the first response in `output' have
+// the line `header'.
+boolean has_header(const char* output, const char* header) {
+  const char* end = strstr(output, "\r\n\r\n");
+  const char* line = strstr(output, header);
+  return end && line && line < end;
+}
+
+// Returns true if `output' starts with the status line `status'.
+boolean has_status_line(const char* output, const char* status) {
+  int n = strlen(status);
+  return !strncmp(output, status, n) && !strncmp(output + n, "\r\n", 2);
+}
+
+// Decodes the chunked `body' into `data'. Returns the number of
+// chunks, not counting the last, empty one, or -1 if the framing is
+// broken or anything follows the last chunk.
+int decode_chunks(const char* body, char* data, int* length) {
+  int chunks = 0;
+  *length = 0;
+  while (1) {
+    char* end;
+    long size = strtol(body, &end, 16);
+    if (end == body || strncmp(end, "\r\n", 2)) {
+      return -1;
+    }
+    body = end + 2;
+    if (!size) {
+      return strcmp(body, "\r\n") ? -1 : chunks;
+    }
+    if ((long)strlen(body) < size + 2 || strncmp(body + size, "\r\n", 2)) {
+      return -1;
+    }
+    memcpy(data + *length, body, size);
+    *length += size;
+    body += size + 2;
+    chunks++;
+  }
+}
+
+void test_chunked_encoding() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/chunked", TinyWebServer::GET, &chunked_handler},
+    {"/empty", TinyWebServer::GET, &empty_chunked_handler},
+    {NULL},
+  };
+  char data[chunked_body_length + 1];
+  int length;
+
+  // The body overflows the output buffer, and is framed across the
+  // chunks sent. The connection is kept alive.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("GET /chunked HTTP/1.1\r\n\r\n");
+    const char* body = strstr(web.output(), "\r\n\r\n");
+    expect_true(body != NULL);
+    expect_true(has_header(web.output(), "Transfer-Encoding: chunked\r\n"));
+    expect_true(has_header(web.output(), "Connection: keep-alive\r\n"));
+    expect_true(decode_chunks(body + 4, data, &length) > 1);
+    expect_num_eq(chunked_body_length, length);
+    for (int i = 0; i < length; i++) {
+      if (data[i] != 'a' + i % 26) {
+        expect_num_eq('a' + i % 26, data[i]);
+        break;
+      }
+    }
+    expect_true(web.output_ends_with("\r\n0\r\n\r\n", 7));
+    expect_true(web.is_open());
+  }
+
+  // Without any data, there's only the last chunk.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("GET /empty HTTP/1.1\r\n\r\n");
+    expect_true(web.output_ends_with("\r\n\r\n0\r\n\r\n", 9));
+    expect_true(web.is_open());
+  }
+
+  // HTTP/1.0 clients get the body as is, ended by closing the
+  // connection.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("GET /chunked HTTP/1.0\r\n"
+            "Connection: keep-alive\r\n"
+            "\r\n");
+    const char* body = strstr(web.output(), "\r\n\r\n");
+    expect_true(body != NULL);
+    expect_true(!strstr(web.output(), "Transfer-Encoding"));
+    expect_true(has_header(web.output(), "Connection: close\r\n"));
+    body += 4;
+    expect_num_eq(chunked_body_length, strlen(body));
+    expect_true(!strncmp(body, "abcdefghijklmnopqrstuvwxyzabcd", 30));
+    expect_true(!web.is_open());
+  }
+}
+
+// The root directory of the card, for serve_file().
+SdFile test_root;
+
+boolean test_file_handler(TinyWebServer& web_server) {
+  const char* filename =
+    TinyWebServer::get_file_from_path(web_server.get_path(),
+                                      &web_server.get_arena());
+  if (!web_server.serve_file(test_root, filename)) {
+    web_server.send_error_code(404);
+  }
+  return true;
+}
+
+// Creates the file `name' on the card, made of `size' letters.
+void create_file(const char* name, int size) {
+  SdFile file;
+  expect_true(file.open(&test_root, name, O_CREAT | O_WRITE | O_TRUNC));
+  for (int i = 0; i < size; i++) {
+    file.write('a' + i % 26);
+  }
+  file.close();
+}
+
+void remove_file(const char* name) {
+  SdFile file;
+  expect_true(file.open(&test_root, name, O_WRITE) && file.remove());
+}
+
+// Copies the value of the response header `name' in `output' into
+// `value'. Returns false if the response doesn't have it.
+boolean get_response_header(const char* output, const char* name,
+                            char* value, int size) {
+  const char* end = strstr(output, "\r\n\r\n");
+  const char* p = strstr(output, name);
+  int length = strlen(name);
+  if (!end || !p || p > end || p[length] != ':') {
+    return false;
+  }
+  p += length + 2;
+  int n = strchr(p, '\r') - p;
+  if (n >= size) {
+    n = size - 1;
+  }
+  memcpy(value, p, n);
+  value[n] = 0;
+  return true;
+}
+
+// Sends `request' on the connection of `web', and returns the status
+// code of the response.
+int get_file(TinyWebServerClientTest& web, const char* request) {
+  web.clear_output();
+  web.run(request);
+  return atoi(web.output() + 9);
+}
+
+// Returns the body of the response in the output of `web'.
+const char* response_body(TinyWebServerClientTest& web) {
+  const char* end = strstr(web.output(), "\r\n\r\n");
+  return end ? end + 4 : "";
+}
+
+void test_serve_file() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/" "*", TinyWebServer::GET, &test_file_handler},
+    {NULL},
+  };
+  Sd2Card card;
+  SdVolume volume;
+  expect_true(card.init(SPI_FULL_SPEED, 4) && volume.init(&card)
+              && test_root.openRoot(&volume));
+  create_file("RANGE.TXT", 100);
+
+  // All the requests go on the same kept alive connection.
+  TinyWebServerClientTest web(handlers, NULL);
+  char request[160];
+  char etag[24];
+  char last_modified[30];
+  char value[32];
+  expect_num_eq(200, get_file(web, "GET /RANGE.TXT HTTP/1.1\r\n\r\n"));
+  expect_true(get_response_header(web.output(), "ETag", etag, sizeof(etag)));
+  expect_true(get_response_header(web.output(), "Last-Modified",
+                                  last_modified, sizeof(last_modified)));
+  expect_true(has_header(web.output(), "Accept-Ranges: bytes\r\n"));
+  expect_true(has_header(web.output(), "Content-Length: 100\r\n"));
+  expect_num_eq(100, strlen(response_body(web)));
+
+  // Conditional requests for the same version of the file get a 304
+  // response, without a body, and the connection stays open. The
+  // entity tag wins over the date.
+  sprintf(request, "GET /RANGE.TXT HTTP/1.1\r\nIf-None-Match: %s\r\n\r\n",
+          etag);
+  expect_num_eq(304, get_file(web, request));
+  expect_true(get_response_header(web.output(), "ETag", value, sizeof(value)));
+  expect_str_eq(etag, value, false);
+  expect_true(has_header(web.output(), "Connection: keep-alive\r\n"));
+  expect_str_eq("", (char*)response_body(web), false);
+  expect_true(web.is_open());
+  expect_num_eq(304, get_file(web, "GET /RANGE.TXT HTTP/1.1\r\n"
+                              "If-None-Match: *\r\n\r\n"));
+  sprintf(request,
+          "GET /RANGE.TXT HTTP/1.1\r\nIf-Modified-Since: %s\r\n\r\n",
+          last_modified);
+  expect_num_eq(304, get_file(web, request));
+  sprintf(request, "GET /RANGE.TXT HTTP/1.1\r\nIf-None-Match: \"0-0\"\r\n"
+          "If-Modified-Since: %s\r\n\r\n", last_modified);
+  expect_num_eq(200, get_file(web, request));
+
+  // A range of the file, also when If-Range names this version of it.
+  expect_num_eq(206, get_file(web, "GET /RANGE.TXT HTTP/1.1\r\n"
+                              "Range: bytes=10-19\r\n\r\n"));
+  expect_true(has_header(web.output(), "Content-Range: bytes 10-19/100\r\n"));
+  expect_true(has_header(web.output(), "Content-Length: 10\r\n"));
+  expect_str_eq("klmnopqrst", (char*)response_body(web), false);
+  sprintf(request, "GET /RANGE.TXT HTTP/1.1\r\nRange: bytes=10-19\r\n"
+          "If-Range: %s\r\n\r\n", etag);
+  expect_num_eq(206, get_file(web, request));
+
+  // The whole file when If-Range names another version.
+  expect_num_eq(200, get_file(web, "GET /RANGE.TXT HTTP/1.1\r\n"
+                              "Range: bytes=10-19\r\n"
+                              "If-Range: \"0-0\"\r\n\r\n"));
+  expect_true(has_header(web.output(), "Content-Length: 100\r\n"));
+  expect_true(!has_header(web.output(), "Content-Range"));
+
+  // A range past the end of the file.
+  expect_num_eq(416, get_file(web, "GET /RANGE.TXT HTTP/1.1\r\n"
+                              "Range: bytes=200-\r\n\r\n"));
+  expect_true(has_header(web.output(), "Content-Range: bytes */100\r\n"));
+  expect_true(has_header(web.output(), "Content-Length: 0\r\n"));
+  expect_true(web.is_open());
+
+  remove_file("RANGE.TXT");
+  test_root.close();
+}
+
+#if TWS_FILE_CACHE_SIZE > 0
+void test_file_cache() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/" "*", TinyWebServer::GET, &test_file_handler},
+    {NULL},
+  };
+  Sd2Card card;
+  SdVolume volume;
+  expect_true(card.init(SPI_FULL_SPEED, 4) && volume.init(&card)
+              && test_root.openRoot(&volume));
+  TinyWebServerClientTest web(handlers, NULL);
+  uint16_t index;
+  uint16_t hit_index;
+
+  // The first request looks the file up and remembers its directory
+  // entry, the next ones open it by that index.
+  create_file("HIT.TXT", 10);
+  expect_true(!web.get_cached_file_index(test_root, "HIT.TXT", &index));
+  expect_num_eq(200, get_file(web, "GET /HIT.TXT HTTP/1.1\r\n\r\n"));
+  expect_true(web.get_cached_file_index(test_root, "HIT.TXT", &hit_index));
+  expect_true(hit_index != TinyWebServerClientTest::NO_FILE_INDEX);
+  expect_num_eq(200, get_file(web, "GET /HIT.TXT HTTP/1.1\r\n\r\n"));
+  expect_str_eq("abcdefghij", (char*)response_body(web), false);
+  expect_true(web.get_cached_file_index(test_root, "HIT.TXT", &index));
+  expect_num_eq(hit_index, index);
+
+  // An index that points to another file's entry by now is looked up
+  // again.
+  create_file("AAA.TXT", 3);
+  expect_num_eq(200, get_file(web, "GET /HIT.TXT HTTP/1.1\r\n\r\n"));
+  expect_str_eq("abcdefghij", (char*)response_body(web), false);
+  remove_file("AAA.TXT");
+
+  // A missing file is remembered as such, and served once created and
+  // invalidated.
+  expect_num_eq(404, get_file(web, "GET /LATE.TXT HTTP/1.1\r\n\r\n"));
+  expect_true(web.get_cached_file_index(test_root, "LATE.TXT", &index));
+  expect_num_eq(TinyWebServerClientTest::NO_FILE_INDEX, index);
+  create_file("LATE.TXT", 4);
+  expect_num_eq(404, get_file(web, "GET /LATE.TXT HTTP/1.1\r\n\r\n"));
+  web.invalidate_cached_file("LATE.TXT");
+  expect_num_eq(200, get_file(web, "GET /LATE.TXT HTTP/1.1\r\n\r\n"));
+  expect_str_eq("abcd", (char*)response_body(web), false);
+  remove_file("LATE.TXT");
+
+  // Once the cache is full, a new file replaces the least recently
+  // used one: F1.TXT once F0.TXT was requested again.
+  web.clear_file_cache();
+  char request[48];
+  char name[13];
+  for (int i = 0; i <= TWS_FILE_CACHE_SIZE; i++) {
+    sprintf(name, "F%d.TXT", i);
+    create_file(name, 1);
+  }
+  for (int i = 0; i < TWS_FILE_CACHE_SIZE; i++) {
+    sprintf(request, "GET /F%d.TXT HTTP/1.1\r\n\r\n", i);
+    expect_num_eq(200, get_file(web, request));
+  }
+  expect_num_eq(200, get_file(web, "GET /F0.TXT HTTP/1.1\r\n\r\n"));
+  sprintf(request, "GET /F%d.TXT HTTP/1.1\r\n\r\n", TWS_FILE_CACHE_SIZE);
+  expect_num_eq(200, get_file(web, request));
+  for (int i = 0; i <= TWS_FILE_CACHE_SIZE; i++) {
+    sprintf(name, "F%d.TXT", i);
+    expect_true(web.get_cached_file_index(test_root, name, &index)
+                == (i != 1));
+  }
+  for (int i = 0; i <= TWS_FILE_CACHE_SIZE; i++) {
+    sprintf(name, "F%d.TXT", i);
+    remove_file(name);
+  }
+  remove_file("HIT.TXT");
+  test_root.close();
+}
+#endif
+
+void test_serve_gzip_file() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/" "*", TinyWebServer::GET, &test_file_handler},
+    {NULL},
+  };
+  Sd2Card card;
+  SdVolume volume;
+  expect_true(card.init(SPI_FULL_SPEED, 4) && volume.init(&card)
+              && test_root.openRoot(&volume));
+  create_file("PAGE.HTM", 100);
+  create_file("PAGE.HGZ", 40);
+  create_file("LONE.HTM", 100);
+
+  // Every response for a file with a compressed version varies with
+  // Accept-Encoding, whichever version is sent, both before and after
+  // the file is in the cache.
+  TinyWebServerClientTest web(handlers, NULL);
+  char request[160];
+  char etag[24];
+  for (int i = 0; i < 2; i++) {
+    expect_num_eq(200, get_file(web, "GET /PAGE.HTM HTTP/1.1\r\n\r\n"));
+    expect_true(has_header(web.output(), "Vary: Accept-Encoding\r\n"));
+    expect_true(has_header(web.output(), "Content-Length: 100\r\n"));
+    expect_true(!has_header(web.output(), "Content-Encoding"));
+  }
+  expect_true(get_response_header(web.output(), "ETag", etag, sizeof(etag)));
+  expect_num_eq(200, get_file(web, "GET /PAGE.HTM HTTP/1.1\r\n"
+                              "Accept-Encoding: gzip, deflate\r\n\r\n"));
+  expect_true(has_header(web.output(), "Vary: Accept-Encoding\r\n"));
+  expect_true(has_header(web.output(), "Content-Encoding: gzip\r\n"));
+  expect_true(has_header(web.output(), "Content-Length: 40\r\n"));
+
+  // Including the 304 and 416 responses.
+  sprintf(request, "GET /PAGE.HTM HTTP/1.1\r\nIf-None-Match: %s\r\n\r\n",
+          etag);
+  expect_num_eq(304, get_file(web, request));
+  expect_true(has_header(web.output(), "Vary: Accept-Encoding\r\n"));
+  expect_num_eq(416, get_file(web, "GET /PAGE.HTM HTTP/1.1\r\n"
+                              "Range: bytes=500-\r\n\r\n"));
+  expect_true(has_header(web.output(), "Vary: Accept-Encoding\r\n"));
+
+  // A file without a compressed version doesn't vary.
+  expect_num_eq(200, get_file(web, "GET /LONE.HTM HTTP/1.1\r\n"
+                              "Accept-Encoding: gzip\r\n\r\n"));
+  expect_true(!has_header(web.output(), "Vary"));
+  expect_num_eq(200, get_file(web, "GET /LONE.HTM HTTP/1.1\r\n\r\n"));
+  expect_true(!has_header(web.output(), "Vary"));
+
+  remove_file("PAGE.HTM");
+  remove_file("PAGE.HGZ");
+  remove_file("LONE.HTM");
+  test_root.close();
+}
+
+// Returns whether the body of the response in the output of `web' is
+// the `size' bytes of program memory at `data'.
+boolean has_bundle_data(TinyWebServerClientTest& web, const uint8_t* data,
+                        uint32_t size) {
+  const char* body = response_body(web);
+  if (web.output() + web.output_length() - body != (long)size) {
+    return false;
+  }
+  for (uint32_t i = 0; i < size; i++) {
+    if ((uint8_t)body[i] != pgm_read_byte(data + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void test_serve_bundle() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/" "*", TinyWebServer::GET, &TinyWebBundleHandler::bundle_handler},
+    {NULL},
+  };
+  TinyWebBundleHandler::bundle = test_bundle;
+  TinyWebServerClientTest web(handlers, NULL);
+
+  // hello.txt doesn't shrink when compressed, and is stored as is.
+  expect_num_eq(200, get_file(web, "GET /hello.txt HTTP/1.1\r\n\r\n"));
+  expect_true(has_header(web.output(), "Content-Type: text/plain\r\n"));
+  expect_true(has_header(web.output(), "Content-Length: 15\r\n"));
+  expect_true(has_header(web.output(), "ETag: \"56064e16\"\r\n"));
+  expect_true(!has_header(web.output(), "Content-Encoding"));
+  expect_true(!has_header(web.output(), "Vary"));
+  expect_str_eq("Hello, bundle!\n", (char*)response_body(web), false);
+
+  // index.htm is stored compressed, and served as such, also for "/",
+  // across several output buffers.
+  static const char* const index_requests[] = {
+    "GET /index.htm HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n",
+    "GET / HTTP/1.1\r\nAccept-Encoding: deflate, gzip\r\n\r\n",
+  };
+  for (int i = 0; i < 2; i++) {
+    expect_num_eq(200, get_file(web, index_requests[i]));
+    expect_true(has_header(web.output(), "Content-Type: text/html\r\n"));
+    expect_true(has_header(web.output(), "Content-Length: 184\r\n"));
+    expect_true(has_header(web.output(), "Content-Encoding: gzip\r\n"));
+    expect_true(has_header(web.output(), "Vary: Accept-Encoding\r\n"));
+    expect_true(has_header(web.output(), "ETag: \"e708b47d\"\r\n"));
+    expect_true(has_bundle_data(web, test_bundle_1_index_htm_data, 184));
+  }
+
+  // Clients that can't decompress it get a 406.
+  expect_num_eq(406, get_file(web, "GET /index.htm HTTP/1.1\r\n\r\n"));
+  expect_true(has_header(web.output(), "Content-Length: 0\r\n"));
+
+  // A matching If-None-Match gets a 304 without a body, and a HEAD
+  // request the headers alone.
+  expect_num_eq(304, get_file(web, "GET /hello.txt HTTP/1.1\r\n"
+                              "If-None-Match: \"56064e16\"\r\n\r\n"));
+  expect_true(!has_header(web.output(), "Content-Length"));
+  expect_str_eq("", (char*)response_body(web), false);
+  expect_num_eq(200, get_file(web, "HEAD /hello.txt HTTP/1.1\r\n\r\n"));
+  expect_true(has_header(web.output(), "Content-Length: 15\r\n"));
+  expect_str_eq("", (char*)response_body(web), false);
+
+  expect_num_eq(404, get_file(web, "GET /missing.txt HTTP/1.1\r\n\r\n"));
+  TinyWebBundleHandler::bundle = NULL;
+}
+
+// Answers with the requested path, with a Content-Length.
+boolean echo_path_handler(TinyWebServer& web_server) {
+  const char* path = web_server.get_path();
+  web_server.send_error_code(200);
+  web_server.send_content_length(strlen(path));
+  web_server.end_headers();
+  web_server << path;
+  return true;
+}
+
+// Answers without a Content-Length, so the response can only end
+// with the connection.
+boolean unframed_handler(TinyWebServer& web_server) {
+  web_server.send_error_code(200);
+  web_server.end_headers();
+  web_server << F("unframed");
+  return true;
+}
+
+// Returns the bodies of the responses in `output', in order, each
+// followed by a space.
+void response_bodies(const char* output, char* bodies) {
+  *bodies = 0;
+  const char* p = output;
+  while ((p = strstr(p, "\r\n\r\n"))) {
+    p += 4;
+    const char* end = strstr(p, "HTTP/1.1 ");
+    int n = end ? end - p : strlen(p);
+    strncat(bodies, p, n);
+    strcat(bodies, " ");
+  }
+}
+
+void test_pipelined_requests() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/unframed", TinyWebServer::GET, &unframed_handler},
+    {"/" "*", TinyWebServer::ANY, &echo_path_handler},
+    {NULL},
+  };
+  static const char three[] =
+    "GET /a HTTP/1.1\r\n\r\n"
+    "POST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nxyz"
+    "GET /c HTTP/1.1\r\n\r\n";
+  char bodies[64];
+
+  // Three requests sent at once, or in small pieces, are answered in
+  // order, the body of the second one skipped, and the connection
+  // stays open.
+  for (int piece = 3; piece <= TWS_INPUT_BUFFER_SIZE; piece *= 4) {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run(three, strlen(three), piece);
+    response_bodies(web.output(), bodies);
+    expect_str_eq("/a /b /c ", bodies, false);
+    expect_true(has_header(web.output(), "Connection: keep-alive\r\n"));
+    expect_true(web.is_open());
+  }
+
+  // The connection is closed after the response to a request asking
+  // for it, and the requests following it are ignored.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("GET /a HTTP/1.1\r\n\r\n"
+            "GET /b HTTP/1.1\r\nConnection: close\r\n\r\n"
+            "GET /c HTTP/1.1\r\n\r\n");
+    response_bodies(web.output(), bodies);
+    expect_str_eq("/a /b ", bodies, false);
+    expect_true(web.output_ends_with("Connection: close\r\n\r\n/b", 23));
+    expect_true(!web.is_open());
+  }
+
+  // HTTP/1.0 connections are only kept alive on request.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("GET /a HTTP/1.0\r\n\r\nGET /b HTTP/1.0\r\n\r\n");
+    expect_true(has_header(web.output(), "Connection: close\r\n"));
+    expect_true(web.output_ends_with("\r\n\r\n/a", 6));
+    expect_true(!web.is_open());
+  }
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("GET /a HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"
+            "GET /b HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n");
+    expect_true(strstr(web.output(), "\r\n\r\n/aHTTP/1.1 200 ") != NULL);
+    expect_true(web.output_ends_with("\r\n\r\n/b", 6));
+    expect_true(web.is_open());
+  }
+
+  // A response without a Content-Length closes the connection.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("GET /unframed HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n");
+    expect_true(has_header(web.output(), "Connection: close\r\n"));
+    expect_true(web.output_ends_with("\r\n\r\nunframed", 12));
+    expect_true(!web.is_open());
+  }
+
+  // So does the last request allowed on a connection.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.set_keep_alive(500, 2);
+    web.run(three);
+    response_bodies(web.output(), bodies);
+    expect_str_eq("/a /b ", bodies, false);
+    expect_true(web.output_ends_with("Connection: close\r\n\r\n/b", 23));
+    expect_true(!web.is_open());
+  }
+}
+
+void test_head_requests() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/chunked", TinyWebServer::GET, &chunked_handler},
+    {"/any", TinyWebServer::ANY, &echo_path_handler},
+    {"/echo", TinyWebServer::GET, &echo_path_handler},
+    {"/" "*", TinyWebServer::GET, &test_file_handler},
+    {NULL},
+  };
+  char bodies[64];
+
+  // A HEAD request gets the GET handler's headers, without the body,
+  // so the response to the next request on the connection is read
+  // right.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("HEAD /echo HTTP/1.1\r\n\r\n"
+            "HEAD /any HTTP/1.1\r\n\r\n"
+            "GET /echo HTTP/1.1\r\n\r\n");
+    response_bodies(web.output(), bodies);
+    expect_str_eq("  /echo ", bodies, false);
+    expect_true(has_header(web.output(), "Content-Length: 5\r\n"));
+    expect_true(strstr(web.output(), "Content-Length: 4\r\n") != NULL);
+    expect_true(web.is_open());
+  }
+
+  // Nor chunks, not even the last one.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("HEAD /chunked HTTP/1.1\r\n\r\n");
+    expect_true(has_header(web.output(), "Transfer-Encoding: chunked\r\n"));
+    expect_true(web.output_ends_with("\r\n\r\n", 4));
+    expect_true(web.is_open());
+  }
+
+  // Nor files, those sent from the output buffer or queued.
+  Sd2Card card;
+  SdVolume volume;
+  expect_true(card.init(SPI_FULL_SPEED, 4) && volume.init(&card)
+              && test_root.openRoot(&volume));
+  create_file("SMALL.TXT", 10);
+  create_file("LARGE.TXT", 2 * TWS_OUTPUT_BUFFER_SIZE);
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run("HEAD /SMALL.TXT HTTP/1.1\r\n\r\n"
+            "HEAD /LARGE.TXT HTTP/1.1\r\n\r\n"
+            "GET /echo HTTP/1.1\r\n\r\n");
+    response_bodies(web.output(), bodies);
+    expect_str_eq("  /echo ", bodies, false);
+    expect_true(has_header(web.output(), "Content-Length: 10\r\n"));
+    char expected[32];
+    sprintf(expected, "Content-Length: %d\r\n", 2 * TWS_OUTPUT_BUFFER_SIZE);
+    expect_true(strstr(web.output(), expected) != NULL);
+    expect_true(web.is_open());
+  }
+  remove_file("SMALL.TXT");
+  remove_file("LARGE.TXT");
+  test_root.close();
+}
+
+// Answers with the folder query parameter and the values of the
+// Content-Type and Accept-Encoding headers, separated by spaces.
+boolean echo_headers_handler(TinyWebServer& web_server) {
+  char folder[16];
+  if (!web_server.get_query_param("folder", folder, sizeof(folder))) {
+    folder[0] = 0;
+  }
+  const char* type = web_server.get_header_value("Content-Type");
+  const char* encoding = web_server.get_header_value("Accept-Encoding");
+  web_server.send_error_code(200);
+  web_server.end_headers();
+  web_server << folder << ' ' << (type ? type : "")
+             << ' ' << (encoding ? encoding : "");
+  return true;
+}
+
+void test_long_request_headers() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/" "*", TinyWebServer::ANY, &echo_headers_handler},
+    {NULL},
+  };
+  const char* headers[] = {
+    "Host",
+    NULL
+  };
+#if TWS_HEADER_BUFFER_SIZE >= 192
+  // A multipart upload from Firefox, with its 68 characters boundary
+  // and its long headers, all of them requested ones except those
+  // ignored.
+  {
+    static const char request[] =
+      "POST /upload?folder=photos HTTP/1.1\r\n"
+      "Host: 192.168.1.177\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) "
+      "Gecko/20100101 Firefox/128.0\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+      "*/" "*;q=0.8\r\n"
+      "Accept-Language: en-US,en;q=0.5\r\n"
+      "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+      "Content-Type: multipart/form-data; boundary="
+      "---------------------------28118623833924377124765873541907243859614"
+      "\r\n"
+      "Content-Length: 0\r\n"
+      "Origin: http://192.168.1.177\r\n"
+      "Connection: keep-alive\r\n"
+      "Referer: http://192.168.1.177/upload.htm\r\n"
+      "Cookie: session=0123456789abcdef0123456789abcdef\r\n"
+      "Upgrade-Insecure-Requests: 1\r\n"
+      "Priority: u=0, i\r\n"
+      "\r\n";
+    static const char boundary[] =
+      "---------------------------28118623833924377124765873541907243859614";
+    char expected[200];
+    sprintf(expected,
+            "photos multipart/form-data; boundary=%s gzip, deflate, br, zstd",
+            boundary);
+    TinyWebServerClientTest web(handlers, headers);
+    web.run(request);
+    expect_num_eq(200, atoi(web.output() + 9));
+    expect_str_eq(expected, (char*)response_body(web), false);
+  }
+
+  // A conditional Range request as long as the header buffer allows.
+  {
+    static const char request[] =
+      "GET /folder/with/a/rather/long/path/to/a/file.htm HTTP/1.1\r\n"
+      "Host: 192.168.1.177\r\n"
+      "Connection: keep-alive\r\n"
+      "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+      "If-None-Match: \"1f4a2-5a3c2e10\"\r\n"
+      "If-Modified-Since: Tue, 03 Jan 2023 10:20:30 GMT\r\n"
+      "If-Range: Tue, 03 Jan 2023 10:20:30 GMT\r\n"
+      "Range: bytes=1024-2047\r\n"
+      "\r\n";
+    TinyWebServerClientTest web(handlers, headers);
+    web.run(request);
+    expect_num_eq(200, atoi(web.output() + 9));
+    expect_str_eq("  gzip, deflate, br, zstd", (char*)response_body(web),
+                  false);
+  }
+#endif
+
+  // Values that don't fit get a 431 response, and the connection is
+  // closed.
+  {
+    char request[TWS_HEADER_BUFFER_SIZE + 64];
+    strcpy(request, "GET / HTTP/1.1\r\nHost: ");
+    int n = strlen(request);
+    memset(request + n, 'a', TWS_HEADER_BUFFER_SIZE);
+    strcpy(request + n + TWS_HEADER_BUFFER_SIZE, "\r\n\r\n");
+    TinyWebServerClientTest web(handlers, headers);
+    web.run(request);
+    expect_true(has_status_line(
+        web.output(), "HTTP/1.1 431 Request Header Fields Too Large"));
+    expect_true(!web.is_open());
+  }
+}
+
+boolean failing_handler(TinyWebServer& web_server) {
+  web_server.send_error_code(500);
+  return true;
+}
+
+void test_status_lines() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/fail", TinyWebServer::GET, &failing_handler},
+    {"/echo", TinyWebServer::GET, &echo_path_handler},
+    {NULL},
+  };
+  TinyWebServerClientTest web(handlers, NULL);
+  web.run("GET /echo HTTP/1.1\r\n\r\n");
+  expect_true(has_status_line(web.output(), "HTTP/1.1 200 OK"));
+
+  web.clear_output();
+  web.run("GET /missing HTTP/1.1\r\n\r\n");
+  expect_true(has_status_line(web.output(), "HTTP/1.1 404 Not Found"));
+
+  web.clear_output();
+  web.run("GET /fail HTTP/1.1\r\n\r\n");
+  expect_true(has_status_line(web.output(),
+                              "HTTP/1.1 500 Internal Server Error"));
+
+  // Malformed requests are answered before the connection is closed.
+  web.clear_output();
+  web.run("GET /echo HTTP/1.1\r\nBad header\r\n\r\n");
+  expect_true(has_status_line(web.output(), "HTTP/1.1 400 Bad Request"));
+
+  char request[TWS_REQUEST_BUFFER_SIZE + 32];
+  strcpy(request, "GET /");
+  memset(request + 5, 'a', TWS_REQUEST_BUFFER_SIZE);
+  strcpy(request + 5 + TWS_REQUEST_BUFFER_SIZE, " HTTP/1.1\r\n\r\n");
+  web.clear_output();
+  web.run(request);
+  expect_true(has_status_line(web.output(), "HTTP/1.1 414 URI Too Long"));
+}
+
+#if TWS_STATS
+// Returns the number of durations recorded in `h', and checks that
+// the last bucket used is the one `h.max' falls in.
+int histogram_count(const TinyWebHistogram& h) {
+  int count = 0;
+  int last = -1;
+  for (int i = 0; i < TWS_STATS_BUCKETS; i++) {
+    count += h.buckets[i];
+    if (h.buckets[i]) {
+      last = i;
+    }
+  }
+  if (last > 0) {
+    expect_true(h.max >= (16UL << (2 * (last - 1))));
+  }
+  if (last >= 0 && last < TWS_STATS_BUCKETS - 1) {
+    expect_true(h.max < (16UL << (2 * last)));
+  }
+  return count;
+}
+
+void test_stats() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/fail", TinyWebServer::GET, &failing_handler},
+    {"/echo", TinyWebServer::GET, &echo_path_handler},
+    {"/stats", TinyWebServer::GET, &TinyWebStatsHandler::stats_handler},
+    {NULL},
+  };
+  TinyWebServer::reset_stats();
+  TinyWebServerClientTest web(handlers, NULL);
+  web.run("GET /echo HTTP/1.1\r\n\r\n"
+          "GET /missing HTTP/1.1\r\n\r\n"
+          "GET /fail HTTP/1.1\r\n\r\n");
+  web.clear_output();
+  web.run("GET /echo HTTP/1.1\r\nBad header\r\n\r\n");
+
+  // The test client bypasses read_block() and write_block(), so the
+  // byte counts aren't checked here.
+  const TinyWebStats& stats = TinyWebServer::get_stats();
+  expect_num_eq(2, stats.connections);
+  expect_num_eq(3, stats.requests);
+  expect_num_eq(2, stats.status_4xx);
+  expect_num_eq(1, stats.status_5xx);
+  expect_num_eq(0, stats.alloc_failures);
+  expect_num_eq(0, stats.timeouts);
+
+  // The malformed request is rejected before it's routed, and the
+  // missing path has no handler to time.
+  expect_num_eq(4, histogram_count(stats.request_line));
+  expect_num_eq(3, histogram_count(stats.headers));
+  expect_num_eq(3, histogram_count(stats.route));
+  expect_num_eq(2, histogram_count(stats.handler));
+
+  web.clear_output();
+  web.run("GET /stats HTTP/1.1\r\n\r\n");
+  const char* headers_end = strstr(web.output(), "\r\n\r\n");
+  expect_true(headers_end != NULL);
+  expect_true(has_header(web.output(),
+                         "Content-Type: application/json\r\n"));
+  char body[512];
+  int length;
+  expect_true(decode_chunks(headers_end + 4, body, &length) > 0);
+  body[length] = 0;
+  expect_true(!strncmp(body, "{\"connections\":3,\"requests\":4,", 30));
+  expect_true(strstr(body, ",\"status_4xx\":2,\"status_5xx\":1,") != NULL);
+  expect_true(strstr(body, ",\"handler\":{\"max\":") != NULL);
+  expect_true(!strcmp(body + length - 3, "}}\n"));
+}
+#endif
+
+void test_interleaved_connections() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/" "*", TinyWebServer::ANY, &echo_path_handler},
+    {NULL},
+  };
+  TinyWebServerMultiClientTest web(handlers, NULL);
+
+  // The first client sends its request line a few bytes at a time,
+  // the second one all at once. The second one is answered first,
+  // while the first one's request is still being read.
+  web.connect(0, "GET /first HTTP/1.1\r\n\r\n", 4);
+  web.connect(1, "GET /second HTTP/1.1\r\n\r\n", TWS_INPUT_BUFFER_SIZE);
+  web.process();
+  expect_true(web.is_sent(1));
+  expect_true(!strncmp(web.output(1), "HTTP/1.1 200 OK\r\n", 17));
+  expect_str_eq("/second", (char*)strstr(web.output(1), "\r\n\r\n") + 4,
+                false);
+  expect_true(!web.is_sent(0));
+  expect_num_eq(0, web.output_length(0));
+
+  for (int i = 0; i < 8 && !web.output_length(0); i++) {
+    web.process();
+  }
+  expect_true(web.is_sent(0));
+  expect_true(!strncmp(web.output(0), "HTTP/1.1 200 OK\r\n", 17));
+  expect_str_eq("/first", (char*)strstr(web.output(0), "\r\n\r\n") + 4,
+                false);
+
+  // Both connections stay open for their next requests.
+  expect_true(web.is_open(0));
+  expect_true(web.is_open(1));
+}
+
+// The calls to put_handler_fn, as S<length>, W<size> and E, and the
+// data written.
+char put_events[128];
+char put_data[TWS_PUT_BLOCK_SIZE * 4];
+int put_data_length;
+
+void record_put(TinyWebServer& web_server,
+                TinyWebPutHandler::PutAction action,
+                char* buffer, int size) {
+  char* end = put_events + strlen(put_events);
+  switch (action) {
+  case TinyWebPutHandler::START:
+    sprintf(end, "S%d ", size);
+    put_data_length = 0;
+    break;
+  case TinyWebPutHandler::WRITE:
+    sprintf(end, "W%d ", size);
+    if (put_data_length + size <= (int)sizeof(put_data)) {
+      memcpy(put_data + put_data_length, buffer, size);
+    }
+    put_data_length += size;
+    break;
+  case TinyWebPutHandler::END:
+    strcpy(end, "E ");
+    break;
+  }
+}
+
+// Returns true if the `size' bytes at `data' are those written by
+// create_file().
+boolean has_file_data(const char* data, int size) {
+  for (int i = 0; i < size; i++) {
+    if (data[i] != 'a' + i % 26) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The calls to put_progress_fn, as received/length.
+char put_progress[128];
+
+void record_put_progress(TinyWebServer& web_server,
+                         uint32_t received, uint32_t length) {
+  sprintf(put_progress + strlen(put_progress), "%lu/%lu ",
+          (unsigned long)received, (unsigned long)length);
+}
+
+void test_put_blocks() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/upload/" "*", TinyWebServer::PUT, &TinyWebPutHandler::put_handler},
+    {NULL},
+  };
+  // A body of a few blocks and a bit, read 100 bytes at a time, is
+  // handed over in whole blocks, the remainder last, with the progress
+  // reported after each of them.
+  const int size = 3 * TWS_PUT_BLOCK_SIZE + 100;
+  static char request[3 * TWS_PUT_BLOCK_SIZE + 200];
+  sprintf(request, "PUT /upload/BLOCKS.TXT HTTP/1.1\r\n"
+          "Content-Length: %d\r\n\r\n", size);
+  int n = strlen(request);
+  for (int i = 0; i < size; i++) {
+    request[n + i] = 'a' + i % 26;
+  }
+  TinyWebPutHandler::put_handler_fn = &record_put;
+  TinyWebPutHandler::put_progress_fn = &record_put_progress;
+  put_events[0] = 0;
+  put_progress[0] = 0;
+  TinyWebServerClientTest web(handlers, NULL);
+  web.run(request, n + size, 100);
+
+  char expected[128];
+  sprintf(expected, "S%d W%d W%d W%d W100 E ", size, TWS_PUT_BLOCK_SIZE,
+          TWS_PUT_BLOCK_SIZE, TWS_PUT_BLOCK_SIZE);
+  expect_str_eq(expected, put_events, false);
+  expect_num_eq(size, put_data_length);
+  expect_true(has_file_data(put_data, size));
+  sprintf(expected, "%d/%d %d/%d %d/%d %d/%d ",
+          TWS_PUT_BLOCK_SIZE, size, 2 * TWS_PUT_BLOCK_SIZE, size,
+          3 * TWS_PUT_BLOCK_SIZE, size, size, size);
+  expect_str_eq(expected, put_progress, false);
+  expect_num_eq(4, TinyWebPutHandler::put_stats.blocks);
+  expect_num_eq(size, TinyWebPutHandler::put_stats.received);
+  TinyWebPutHandler::put_handler_fn = NULL;
+  TinyWebPutHandler::put_progress_fn = NULL;
+}
+
+void test_transfers() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/echo", TinyWebServer::GET, &echo_path_handler},
+    {"/upload/" "*", TinyWebServer::PUT, &TinyWebPutHandler::put_handler},
+    {"/" "*", TinyWebServer::GET, &test_file_handler},
+    {NULL},
+  };
+  Sd2Card card;
+  SdVolume volume;
+  expect_true(card.init(SPI_FULL_SPEED, 4) && volume.init(&card)
+              && test_root.openRoot(&volume));
+
+  // A file too large for the output buffer, and for the blocks sent
+  // on a single call to process(), is queued. It's sent over the next
+  // calls, while another client is served.
+  {
+    const int size = TWS_OUTPUT_BUFFER_SIZE * (2 * TWS_TRANSFER_BLOCKS + 1);
+    create_file("LARGE.TXT", size);
+    TinyWebServerMultiClientTest web(handlers, NULL);
+    web.connect(0, "GET /LARGE.TXT HTTP/1.1\r\n\r\n", TWS_INPUT_BUFFER_SIZE);
+    web.process();
+    expect_true(web.output_length(0) > 0);
+    expect_true(web.output_length(0) < (size_t)size);
+
+    web.connect(1, "GET /echo HTTP/1.1\r\n\r\n", TWS_INPUT_BUFFER_SIZE);
+    web.process();
+    expect_str_eq("/echo", (char*)strstr(web.output(1), "\r\n\r\n") + 4,
+                  false);
+    expect_true(web.output_length(0) < (size_t)size);
+
+    for (int i = 0; i < 8; i++) {
+      web.process();
+    }
+    char expected[32];
+    sprintf(expected, "Content-Length: %d\r\n", size);
+    expect_true(has_header(web.output(0), expected));
+    const char* body = strstr(web.output(0), "\r\n\r\n") + 4;
+    expect_num_eq(size, web.output(0) + web.output_length(0) - body);
+    expect_true(has_file_data(body, size));
+    expect_true(web.is_open(0));
+    remove_file("LARGE.TXT");
+  }
+
+  // A PUT body arriving a few bytes at a time is handed over from the
+  // calls to process() that read it, after the handler returned.
+  {
+    static const char request[] =
+      "PUT /upload/PUT.TXT HTTP/1.1\r\n"
+      "Content-Length: 40\r\n"
+      "\r\n"
+      "abcdefghijklmnopqrstuvwxyzabcdefghijklmn";
+    TinyWebPutHandler::put_handler_fn = &record_put;
+    put_events[0] = 0;
+    TinyWebServerMultiClientTest web(handlers, NULL);
+    web.connect(0, request, 16);
+    int calls = 0;
+    for (; calls < 16 && !strchr(put_events, 'S'); calls++) {
+      web.process();
+    }
+    expect_str_eq("S40 ", put_events, false);
+    expect_true(!web.is_sent(0));
+    for (; calls < 32 && !strchr(put_events, 'E'); calls++) {
+      web.process();
+    }
+    expect_str_eq("S40 W40 E ", put_events, false);
+    expect_num_eq(40, put_data_length);
+    expect_true(has_file_data(put_data, 40));
+    expect_true(!strncmp(web.output(0), "HTTP/1.1 200 OK\r\n", 17));
+    TinyWebPutHandler::put_handler_fn = NULL;
+  }
+
+  test_root.close();
+}
+
+int form_field_count = 0;
+
+void count_form_field(TinyWebServer& web_server,
+                      const char* name, const char* value) {
+  form_field_count++;
+}
+
+void test_read_form() {
+  FLASH_STRING(content,
+	       "Content-Length: 42\r\n"
+	       "\r\n"
+	       "led=1&name=Living+room%21&flag&led=0&x=%zz"
+	       );
+  char led[2];
+  char name[8];
+  char x[4];
+  TinyWebServer::FormField fields[] = {
+    {"led", led, sizeof(led)},
+    {"name", name, sizeof(name)},
+    {"flag", NULL, 0},
+    {"x", x, sizeof(x)},
+    {"missing", NULL, 0},
+    {NULL},
+  };
+
+  TinyWebServerTest web(NULL, NULL, content);
+  expect_true(web.process_headers());
+  expect_true(web.read_form(fields));
+  // The first occurrence wins, and values are truncated to fit.
+  expect_str_eq("1", led, false);
+  expect_str_eq("Living ", name, false);
+  expect_true(fields[2].found);
+  expect_str_eq("%zz", x, false);
+  expect_true(!fields[4].found);
+  expect_num_eq(0, web.read((uint8_t*)x, sizeof(x)));
+
+  FLASH_STRING(content2,
+	       "Content-Length: 11\r\n"
+	       "\r\n"
+	       "a=1&&b=2&c="
+	       );
+  TinyWebServerTest web2(NULL, NULL, content2);
+  expect_true(web2.process_headers());
+  expect_true(web2.read_form(count_form_field));
+  expect_num_eq(3, form_field_count);
+}
+
+// What the multipart parser handed over, as "[name,filename,type]"
+// for START, the data for WRITE, and "|" for END.
+char multipart_events[256];
+
+void record_part(TinyWebServer& web_server,
+                 TinyWebPutHandler::PutAction action,
+                 const TinyWebMultipartHandler::Part& part,
+                 char* buffer, int size) {
+  char* p = multipart_events + strlen(multipart_events);
+  switch (action) {
+  case TinyWebPutHandler::START:
+    sprintf(p, "[%s,%s,%s]", part.name, part.filename, part.content_type);
+    break;
+  case TinyWebPutHandler::WRITE:
+    memcpy(p, buffer, size);
+    p[size] = 0;
+    break;
+  case TinyWebPutHandler::END:
+    strcpy(p, "|");
+    break;
+  }
+}
+
+void test_multipart_parser() {
+  FLASH_STRING(content, "");
+  TinyWebServerTest web(NULL, NULL, content);
+  static const char body[] PROGMEM =
+    "preamble\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"led\"\r\n"
+    "\r\n"
+    "1\r\n"
+    "--XyZ\r\n"
+    "content-disposition: form-data; name=\"f\"; filename=\"A.TXT\"\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n"
+    "a\r\n--XyY\r\r\n--X\r\n\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"x\"\r\n"
+    "\r\n"
+    "0123456789012345678901234567890123456789012345678901234567890123456789"
+    "\r\n"
+    "--XyZ--\r\n"
+    "epilogue";
+  const char* expected =
+    "[led,,]1|[f,A.TXT,text/plain]a\r\n--XyY\r\r\n--X\r\n|[x,,]"
+    "0123456789012345678901234567890123456789012345678901234567890123456789"
+    "|";
+  char data[sizeof(body)];
+  memcpy_P(data, body, sizeof(body));
+  int length = strlen(data);
+
+  // Cut the body in pieces of many sizes, so the boundary is split
+  // everywhere, and have the last part take more than a block.
+  for (int piece = 1; piece <= length; piece += 7) {
+    char block[64];
+    TinyWebMultipartParser parser;
+    expect_true(parser.begin("multipart/form-data; boundary=XyZ",
+                             &record_part, block, sizeof(block)));
+    multipart_events[0] = 0;
+    for (int i = 0; i < length; i += piece) {
+      parser.parse(web, (const uint8_t*)data + i,
+                   i + piece < length ? piece : length - i);
+    }
+    expect_true(parser.end(web));
+    expect_str_eq(expected, multipart_events, false);
+  }
+
+  char boundary[8];
+  expect_true(TinyWebMultipartParser::get_header_param(
+      "multipart/form-data; charset=utf-8;boundary=\"a b\"",
+      "boundary", boundary, sizeof(boundary)));
+  expect_str_eq("a b", boundary, false);
+  TinyWebMultipartParser parser;
+  expect_true(!parser.begin("application/x-www-form-urlencoded",
+                            &record_part, boundary, sizeof(boundary)));
+}
+
+#if TWS_WEBSOCKETS
+// The messages received, as "[opcode:data]", and "|" once closed.
+char websocket_events[256];
+
+void record_message(TinyWebServer& web_server, uint8_t opcode,
+                    uint8_t* data, uint16_t size) {
+  char* p = websocket_events + strlen(websocket_events);
+  if (opcode == TinyWebServer::WS_CLOSE) {
+    strcpy(p, "|");
+  } else {
+    sprintf(p, "[%d:%s]", opcode, (char*)data);
+  }
+}
+
+// Appends a client frame with `size' bytes of `data' to `buffer',
+// masked unless `masked' is false. Returns the frame's length.
+int client_frame(char* buffer, uint8_t first, const char* data,
+                 uint16_t size, boolean masked = true) {
+  static const uint8_t mask[] = { 0x37, 0xFA, 0x21, 0x3D };
+  uint8_t* f = (uint8_t*)buffer;
+  int n = 0;
+  f[n++] = first;
+  if (size < 126) {
+    f[n++] = (masked ? 0x80 : 0) | size;
+  } else {
+    f[n++] = (masked ? 0x80 : 0) | 126;
+    f[n++] = size >> 8;
+    f[n++] = size;
+  }
+  if (masked) {
+    memcpy(f + n, mask, sizeof(mask));
+    n += sizeof(mask);
+  }
+  for (uint16_t i = 0; i < size; i++) {
+    f[n++] = masked ? data[i] ^ mask[i & 3] : data[i];
+  }
+  return n;
+}
+
+// Opens a WebSocket, sends it `frames' `piece' bytes at a time, and
+// checks that the server answered the handshake.
+void run_websocket(TinyWebServerClientTest& web, const char* frames,
+                   int length, int piece) {
+  static const char handshake[] =
+    "GET /ws HTTP/1.1\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+  char input[400];
+  int n = strlen(handshake);
+  memcpy(input, handshake, n);
+  memcpy(input + n, frames, length);
+  websocket_events[0] = 0;
+  web.run(input, n + length, piece);
+  expect_true(!strncmp(web.output(), "HTTP/1.1 101 ", 13));
+  expect_true(strstr(web.output(),
+                     "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+                     "\r\n\r\n") != NULL);
+}
+
+void test_websocket_frames() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/ws", TinyWebServer::GET, &TinyWebSocketHandler::websocket_handler},
+    {NULL},
+  };
+  TinyWebSocketHandler::message_fn = &record_message;
+  char frames[300];
+  char data[140];
+  int n;
+
+  // A masked text frame, a ping and a close frame, which are echoed.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    n = client_frame(frames, 0x81, "Hello", 5);
+    n += client_frame(frames + n, 0x89, "hi", 2);
+    n += client_frame(frames + n, 0x88, "\x03\xE8", 2);
+    run_websocket(web, frames, n, TWS_INPUT_BUFFER_SIZE);
+    expect_str_eq("[1:Hello]|", websocket_events, false);
+    expect_true(web.output_ends_with("\x8A\x02hi\x88\x02\x03\xE8", 8));
+    expect_true(!web.is_open());
+  }
+
+  // A frame with a 16 bits length, split across many reads.
+  {
+    TinyWebServerClientTest web(handlers, NULL);
+    for (int i = 0; i < 130; i++) {
+      data[i] = 'a' + i % 26;
+    }
+    data[130] = 0;
+    n = client_frame(frames, 0x82, data, 130);
+    run_websocket(web, frames, n, 3);
+    char expected[150];
+    sprintf(expected, "[2:%s]", data);
+    expect_str_eq(expected, websocket_events, false);
+    expect_true(web.is_open());
+  }
+
+  // Errors close the WebSocket with a status code: 1002 for a frame
+  // that isn't masked, a fragmented control frame or one with more
+  // than 125 bytes, and 1009 for a frame that doesn't fit in the
+  // buffer.
+  static const struct {
+    uint8_t first;
+    uint16_t size;
+    boolean masked;
+    const char* close;
+  } errors[] = {
+    { 0x81, 5, false, "\x88\x02\x03\xEA" },
+    { 0x09, 2, true, "\x88\x02\x03\xEA" },
+    { 0x89, 126, true, "\x88\x02\x03\xEA" },
+    { 0x81, 200, true, "\x88\x02\x03\xF1" },
+  };
+  for (uint8_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+    TinyWebServerClientTest web(handlers, NULL);
+    char big[210];
+    memset(big, 'x', sizeof(big));
+    n = client_frame(frames, errors[i].first, big, errors[i].size,
+                     errors[i].masked);
+    run_websocket(web, frames, n, TWS_INPUT_BUFFER_SIZE);
+    expect_true(web.output_ends_with(errors[i].close, 4));
+    expect_str_eq("|", websocket_events, false);
+    expect_true(!web.is_open());
+  }
+}
+
+void test_websocket_version() {
+  TinyWebServer::PathHandler handlers[] = {
+    {"/ws", TinyWebServer::GET, &TinyWebSocketHandler::websocket_handler},
+    {NULL},
+  };
+  TinyWebSocketHandler::message_fn = &record_message;
+
+  // Handshakes for other versions than 13, or without one, are
+  // answered with the version the server speaks, and the connection
+  // carries on with plain HTTP.
+  const char* versions[] = {
+    "Sec-WebSocket-Version: 8\r\n",
+    "",
+  };
+  for (int i = 0; i < 2; i++) {
+    char request[200];
+    sprintf(request,
+            "GET /ws HTTP/1.1\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "%s"
+            "\r\n", versions[i]);
+    TinyWebServerClientTest web(handlers, NULL);
+    web.run(request);
+    expect_true(has_status_line(web.output(),
+                                "HTTP/1.1 426 Upgrade Required"));
+    expect_true(has_header(web.output(), "Sec-WebSocket-Version: 13\r\n"));
+    expect_true(has_header(web.output(), "Content-Length: 0\r\n"));
+    expect_true(!strstr(web.output(), "Sec-WebSocket-Accept"));
+    expect_true(web.output_ends_with("\r\n\r\n", 4));
+    expect_true(strstr(web.output(), "HTTP/1.1 ") == web.output()
+                && !strstr(web.output() + 1, "HTTP/1.1 "));
+    expect_true(web.is_open());
+  }
+}
+
+void test_websocket_accept_key() {
+  char accept[29];
+  // The example of RFC 6455.
+  TinyWebServerTest::websocket_accept_key_public("dGhlIHNhbXBsZSBub25jZQ==",
+                                                 accept);
+  expect_str_eq("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", accept, false);
+  TinyWebServerTest::websocket_accept_key_public("x3JJHMbDL1EzLkh9GBhXDw==",
+                                                 accept);
+  expect_str_eq("HSmrc0sMlYUkAGmm5OPpG2HaGWk=", accept, false);
 }
+#endif
 
 void setup() {
   Serial.begin(115200);
@@ -202,10 +2013,41 @@ void setup() {
 
   test_decode_url_encoded();
   test_get_file_from_path();
+  test_get_gzip_file_name();
   test_get_mime_type_from_filename();
   test_get_field();
+  test_arena();
+  test_find_handler();
+  test_parse_range();
+  test_find_query_param();
   test_process_headers();
+  test_process_headers_ignoring_case();
   test_process_broken_headers();
+  test_read_form();
+  test_send_template();
+  test_chunked_encoding();
+  test_serve_file();
+  test_serve_gzip_file();
+  test_serve_bundle();
+#if TWS_FILE_CACHE_SIZE > 0
+  test_file_cache();
+#endif
+  test_pipelined_requests();
+  test_head_requests();
+  test_long_request_headers();
+  test_status_lines();
+  test_interleaved_connections();
+  test_transfers();
+  test_put_blocks();
+#if TWS_STATS
+  test_stats();
+#endif
+  test_multipart_parser();
+#if TWS_WEBSOCKETS
+  test_websocket_accept_key();
+  test_websocket_version();
+  test_websocket_frames();
+#endif
 
   if (!failures) {
     Serial << F("\nSUCCESS\n");
@@ -0,0 +1,42 @@
+// -*- c++ -*-
+//
+// Generated by make_bundle.py from static, do not edit.
+
+#include <avr/pgmspace.h>
+#include <TinyWebServer.h>
+
+static const char test_bundle_0_hello_txt_path[] PROGMEM = "/hello.txt";
+static const char test_bundle_0_hello_txt_headers[] PROGMEM =
+  "Content-Type: text/plain\r\nContent-Length: 15\r\n";
+static const char test_bundle_0_hello_txt_etag[] PROGMEM = "\"56064e16\"";
+static const uint8_t test_bundle_0_hello_txt_data[] PROGMEM = {
+  0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x2c, 0x20, 0x62, 0x75, 0x6e, 0x64, 0x6c, 0x65, 0x21, 0x0a,
+};
+
+static const char test_bundle_1_index_htm_path[] PROGMEM = "/index.htm";
+static const char test_bundle_1_index_htm_headers[] PROGMEM =
+  "Content-Type: text/html\r\nContent-Length: 184\r\nContent-Encoding: gzip\r\n";
+static const char test_bundle_1_index_htm_etag[] PROGMEM = "\"e708b47d\"";
+static const uint8_t test_bundle_1_index_htm_data[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x8d, 0xd4, 0x3b, 0x0e, 0xc2, 0x30,
+  0x10, 0x45, 0xd1, 0x3e, 0xab, 0xf0, 0x0a, 0x30, 0x33, 0xc3, 0x57, 0xb2, 0xbc, 0x02, 0x36, 0x41,
+  0x64, 0x43, 0x90, 0x42, 0xe2, 0x22, 0x29, 0xd8, 0x3d, 0x52, 0x1a, 0x3a, 0xe6, 0xf6, 0xb7, 0x3a,
+  0x7a, 0x7a, 0x69, 0x58, 0xde, 0x63, 0x4e, 0xfd, 0x5c, 0x3e, 0xb9, 0x4b, 0x2d, 0xdf, 0x5e, 0x53,
+  0x0d, 0xfb, 0x30, 0x3f, 0xc2, 0x32, 0xd4, 0xd0, 0xaf, 0x53, 0x19, 0x6b, 0x09, 0xed, 0xfe, 0xac,
+  0xbb, 0x14, 0xdb, 0x2f, 0x11, 0x3f, 0x51, 0x3f, 0x31, 0x3f, 0x39, 0xf8, 0xc9, 0xd1, 0x4f, 0x4e,
+  0x7e, 0x72, 0xf6, 0x93, 0x8b, 0x9f, 0x5c, 0x01, 0x1d, 0xe1, 0x05, 0xbe, 0x02, 0x80, 0x05, 0x08,
+  0x0b, 0x20, 0x16, 0x60, 0x2c, 0x00, 0x59, 0x80, 0xb2, 0x00, 0x66, 0x01, 0xce, 0x0a, 0x9c, 0x95,
+  0xec, 0x18, 0x38, 0x2b, 0x70, 0x56, 0xe0, 0xac, 0xc0, 0x59, 0x81, 0xb3, 0x02, 0x67, 0x05, 0xce,
+  0x0a, 0x9c, 0x0d, 0x38, 0x1b, 0x70, 0x36, 0x72, 0x18, 0xc0, 0xd9, 0x80, 0xb3, 0x01, 0x67, 0x03,
+  0xce, 0x06, 0x9c, 0x0d, 0x38, 0xdb, 0x3f, 0xe7, 0xb8, 0xbd, 0x73, 0x8a, 0xdb, 0x55, 0x77, 0x5f,
+  0x7d, 0xb4, 0x08, 0xe7, 0xb2, 0x05, 0x00, 0x00,
+};
+
+static const char test_bundle_1_index_htm_index_path[] PROGMEM = "/";
+
+const TinyWebBundleHandler::File test_bundle[] PROGMEM = {
+  {test_bundle_0_hello_txt_path, test_bundle_0_hello_txt_headers, test_bundle_0_hello_txt_etag, test_bundle_0_hello_txt_data, 15, 0},
+  {test_bundle_1_index_htm_path, test_bundle_1_index_htm_headers, test_bundle_1_index_htm_etag, test_bundle_1_index_htm_data, 184, 1},
+  {test_bundle_1_index_htm_index_path, test_bundle_1_index_htm_headers, test_bundle_1_index_htm_etag, test_bundle_1_index_htm_data, 184, 1},
+  {NULL},
+};
@@ -31,13 +31,10 @@ static uint8_t mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
 // The initial state of the LED
 int ledState = LOW;
 
-void setLedEnabled(boolean state) {
-  ledState = state;
-  digitalWrite(LEDPIN, ledState);
-}
-
 inline boolean getLedState() { return ledState; }
 
+void setLedEnabled(boolean state);
+
 boolean file_handler(TinyWebServer& web_server);
 boolean blink_led_handler(TinyWebServer& web_server);
 boolean led_status_handler(TinyWebServer& web_server);
@@ -49,9 +46,18 @@ TinyWebServer::PathHandler handlers[] = {
   //
   // `put_handler' is defined in TinyWebServer
   {"/", TinyWebServer::GET, &index_handler },
+  {"/index.htm", TinyWebServer::GET, &index_handler },
   {"/upload/" "*", TinyWebServer::PUT, &TinyWebPutHandler::put_handler },
   {"/blinkled", TinyWebServer::POST, &blink_led_handler },
-  {"/ledstatus" "*", TinyWebServer::GET, &led_status_handler },
+  {"/ledstatus", TinyWebServer::GET, &led_status_handler },
+#if TWS_WEBSOCKETS
+  // The page gets the state of the LED pushed over a WebSocket, and
+  // polls /ledstatus without one.
+  {"/ws", TinyWebServer::GET, &TinyWebSocketHandler::websocket_handler },
+#endif
+#if TWS_STATS
+  {"/stats", TinyWebServer::GET, &TinyWebStatsHandler::stats_handler },
+#endif
   {"/" "*", TinyWebServer::GET, &file_handler },
   {NULL},
 };
@@ -63,6 +69,25 @@ const char* headers[] = {
 
 TinyWebServer web = TinyWebServer(handlers, headers);
 
+void setLedEnabled(boolean state) {
+  ledState = state;
+  digitalWrite(LEDPIN, ledState);
+#if TWS_WEBSOCKETS
+  // Tell all the open pages.
+  web.broadcast_text(ledState ? "1" : "0");
+#endif
+}
+
+#if TWS_WEBSOCKETS
+// Pages may also switch the LED with a "0" or "1" message.
+void led_message_handler(TinyWebServer& web_server, uint8_t opcode,
+                         uint8_t* data, uint16_t size) {
+  if (opcode == TinyWebServer::WS_TEXT && size == 1) {
+    setLedEnabled(data[0] == '1');
+  }
+}
+#endif
+
 boolean has_filesystem = true;
 Sd2Card card;
 SdVolume volume;
@@ -73,43 +98,37 @@ void send_file_name(TinyWebServer& web_server, const char* filename) {
   if (!filename) {
     web_server.send_error_code(404);
     web_server << F("Could not parse URL");
+  } else if (web_server.serve_file(root, filename)) {
+    Serial << F("Read file "); Serial.println(filename);
   } else {
-    TinyWebServer::MimeType mime_type
-      = TinyWebServer::get_mime_type_from_filename(filename);
-    web_server.send_error_code(200);
-    web_server.send_content_type(mime_type);
-    web_server.end_headers();
-    if (file.open(&root, filename, O_READ)) {
-      Serial << F("Read file "); Serial.println(filename);
-      web_server.send_file(file);
-      file.close();
-    } else {
-      web_server << F("Could not find file: ") << filename << "\n";
-    }
+    web_server.send_error_code(404);
+    web_server << F("Could not find file: ") << filename << "\n";
   }
 }
 
 boolean file_handler(TinyWebServer& web_server) {
-  char* filename = TinyWebServer::get_file_from_path(web_server.get_path());
+  char* filename = TinyWebServer::get_file_from_path(web_server.get_path(),
+                                                     &web_server.get_arena());
   send_file_name(web_server, filename);
-  free(filename);
   return true;
 }
 
 boolean blink_led_handler(TinyWebServer& web_server) {
   web_server.send_error_code(200);
   web_server.send_content_type("text/plain");
+  web_server.send_chunked_encoding();
   web_server.end_headers();
-  // Reverse the state of the LED.
-  setLedEnabled(!getLedState());
-  Client& client = web_server.get_client();
-  if (client.available()) {
-    char ch = (char)client.read();
-    if (ch == '0') {
-      setLedEnabled(false);
-    } else if (ch == '1') {
-      setLedEnabled(true);
-    }
+  // The form posted by main.js has the new state of the LED in
+  // `led'. Without it, reverse the state of the LED.
+  char led[2];
+  TinyWebServer::FormField fields[] = {
+    {"led", led, sizeof(led)},
+    {NULL},
+  };
+  if (web_server.read_form(fields) && fields[0].found) {
+    setLedEnabled(led[0] == '1');
+  } else {
+    setLedEnabled(!getLedState());
   }
   return true;
 }
@@ -117,14 +136,35 @@ boolean blink_led_handler(TinyWebServer& web_server) {
 boolean led_status_handler(TinyWebServer& web_server) {
   web_server.send_error_code(200);
   web_server.send_content_type("text/plain");
+  web_server.send_chunked_encoding();
   web_server.end_headers();
-  Client& client = web_server.get_client();
-  client.println(getLedState(), DEC);
+  web_server.println(getLedState(), DEC);
   return true;
 }
 
+void write_led_state(TinyWebServer& web_server) {
+  web_server << (getLedState() ? F("on") : F("off"));
+}
+
+const TinyWebServer::TemplateVariable index_variables[] = {
+  {"led_state", &write_led_state},
+  {NULL},
+};
+
 boolean index_handler(TinyWebServer& web_server) {
-  send_file_name(web_server, "INDEX.HTM");
+  // The page is a template with the current state of the LED, so the
+  // browser doesn't have to ask for it.
+  SdFile index;
+  if (!index.open(&root, "INDEX.HTM", O_READ)) {
+    send_file_name(web_server, "INDEX.HTM");
+    return true;
+  }
+  web_server.send_error_code(200);
+  web_server.send_content_type("text/html");
+  web_server.send_chunked_encoding();
+  web_server.end_headers();
+  web_server.send_template(index, index_variables);
+  index.close();
   return true;
 }
 
@@ -141,11 +181,11 @@ void file_uploader_handler(TinyWebServer& web_server,
     if (!file.isOpen()) {
       // File is not opened, create it. First obtain the desired name
       // from the request path.
-      char* fname = web_server.get_file_from_path(web_server.get_path());
+      char* fname = web_server.get_file_from_path(web_server.get_path(),
+                                                  &web_server.get_arena());
       if (fname) {
 	Serial << F("Creating ") << fname << "\n";
 	file.open(&root, fname, O_CREAT | O_WRITE | O_TRUNC);
-	free(fname);
       }
     }
     break;
@@ -214,6 +254,10 @@ void setup() {
   Serial << F("Setting up the Ethernet card...\n");
   Ethernet.begin(mac, ip);
 
+#if TWS_WEBSOCKETS
+  TinyWebSocketHandler::message_fn = led_message_handler;
+#endif
+
   // Start the web server.
   Serial << F("Web server starting...\n");
   web.begin();
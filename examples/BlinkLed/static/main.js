@@ -9,7 +9,8 @@ String.prototype.trim = function () {
 function Button(elem) {
     var btn = this;
     this.elem = elem;
-    this.setEnabled(false);
+    // The page comes with the current state of the LED.
+    this.setEnabled(elem.attr('class') == "on");
     this.elem.click(function(e) {
 	e.preventDefault();
 	btn.clickHandler(btn, e);
@@ -29,7 +30,7 @@ Button.prototype.isEnabled = function() { return this.enabled; };
 Button.prototype.clickHandler = function(btn, e) {
     var url = btn.elem.attr('href');
     $.ajax({type: "POST",
-	    data: (!btn.isEnabled() + 0).toString(10),
+	    data: {led: (!btn.isEnabled() + 0).toString(10)},
 	    dataType: "text",
 	    cache: false,
 	    url: url,
@@ -57,8 +58,29 @@ function ledStatus(btn, url) {
 	   });
 };
 
+// Gets the state of the LED pushed by the server as soon as it
+// changes, and falls back to polling when there's no WebSocket.
+function ledEvents(btn) {
+    var polling = false;
+    var poll = function() {
+	if (!polling) {
+	    polling = true;
+	    window.setTimeout(function() {ledStatus(btn, "/ledstatus");}, 400);
+	}
+    };
+    if (!window.WebSocket) {
+	poll();
+	return;
+    }
+    var ws = new WebSocket("ws://" + window.location.host + "/ws");
+    ws.onmessage = function(e) {
+	btn.setEnabled(parseInt(e.data));
+    };
+    ws.onclose = poll;
+};
+
 $(document).ready(
     function() {
 	var lightBulb = new Button($("#lightbulb"));
-	ledStatus(lightBulb, "/ledstatus");
+	ledEvents(lightBulb);
     });
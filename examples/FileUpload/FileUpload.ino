@@ -35,6 +35,9 @@ TinyWebServer::PathHandler handlers[] = {
   // `put_handler' is defined in TinyWebServer
   {"/", TinyWebServer::GET, &index_handler },
   {"/upload/" "*", TinyWebServer::PUT, &TinyWebPutHandler::put_handler },
+  // The form of index.htm posts files to /upload.
+  {"/upload", TinyWebServer::POST,
+   &TinyWebMultipartHandler::multipart_handler },
   {"/" "*", TinyWebServer::GET, &file_handler },
   {NULL},
 };
@@ -56,26 +59,18 @@ void send_file_name(TinyWebServer& web_server, const char* filename) {
   if (!filename) {
     web_server.send_error_code(404);
     web_server << F("Could not parse URL");
+  } else if (web_server.serve_file(root, filename)) {
+    Serial << F("Read file "); Serial.println(filename);
   } else {
-    TinyWebServer::MimeType mime_type
-      = TinyWebServer::get_mime_type_from_filename(filename);
-    web_server.send_error_code(200);
-    web_server.send_content_type(mime_type);
-    web_server.end_headers();
-    if (file.open(&root, filename, O_READ)) {
-      Serial << F("Read file "); Serial.println(filename);
-      web_server.send_file(file);
-      file.close();
-    } else {
-      web_server << F("Could not find file: ") << filename << "\n";
-    }
+    web_server.send_error_code(404);
+    web_server << F("Could not find file: ") << filename << "\n";
   }
 }
 
 boolean file_handler(TinyWebServer& web_server) {
-  char* filename = TinyWebServer::get_file_from_path(web_server.get_path());
+  char* filename = TinyWebServer::get_file_from_path(web_server.get_path(),
+                                                     &web_server.get_arena());
   send_file_name(web_server, filename);
-  free(filename);
   return true;
 }
 
@@ -97,11 +92,11 @@ void file_uploader_handler(TinyWebServer& web_server,
     if (!file.isOpen()) {
       // File is not opened, create it. First obtain the desired name
       // from the request path.
-      char* fname = web_server.get_file_from_path(web_server.get_path());
+      char* fname = web_server.get_file_from_path(web_server.get_path(),
+                                                  &web_server.get_arena());
       if (fname) {
 	Serial << F("Creating ") << fname << "\n";
 	file.open(&root, fname, O_CREAT | O_WRITE | O_TRUNC);
-	free(fname);
       }
     }
     break;
@@ -117,11 +112,54 @@ void file_uploader_handler(TinyWebServer& web_server,
     file.sync();
     Serial << F("Wrote ") << file.fileSize() << F(" bytes in ")
 	   << millis() - start_time << F(" millis (received ")
-           << total_size << F(" bytes)\n");
+           << total_size << F(" bytes, ")
+           << TinyWebPutHandler::put_stats.write_millis
+           << F(" millis spent writing)\n");
     file.close();
   }
 }
 
+void form_uploader_handler(TinyWebServer& web_server,
+                           TinyWebPutHandler::PutAction action,
+                           const TinyWebMultipartHandler::Part& part,
+                           char* buffer, int size) {
+  // Only the parts holding files are stored, under their own name.
+  if (!part.filename[0]) {
+    return;
+  }
+  switch (action) {
+  case TinyWebPutHandler::START:
+    if (!file.isOpen()) {
+      Serial << F("Creating ") << part.filename << "\n";
+      file.open(&root, part.filename, O_CREAT | O_WRITE | O_TRUNC);
+    }
+    break;
+
+  case TinyWebPutHandler::WRITE:
+    if (file.isOpen()) {
+      file.write(buffer, size);
+    }
+    break;
+
+  case TinyWebPutHandler::END:
+    if (file.isOpen()) {
+      file.sync();
+      Serial << F("Wrote ") << file.fileSize() << F(" bytes to ")
+             << part.filename << "\n";
+      file.close();
+    }
+  }
+}
+
+void file_uploader_progress(TinyWebServer& web_server,
+                            uint32_t received, uint32_t length) {
+  // Report every 16kb.
+  if (!(received & 0x3FFF) || received == length) {
+    Serial << F("Received ") << received << F(" of ") << length
+           << F(" bytes\n");
+  }
+}
+
 void setup() {
   Serial.begin(115200);
   Serial << F("Free RAM: ") << FreeRam() << "\n";
@@ -161,6 +199,8 @@ void setup() {
   if (has_filesystem) {
     // Assign our function to `upload_handler_fn'.
     TinyWebPutHandler::put_handler_fn = file_uploader_handler;
+    TinyWebPutHandler::put_progress_fn = file_uploader_progress;
+    TinyWebMultipartHandler::multipart_handler_fn = form_uploader_handler;
   }
 
   // Initialize the Ethernet.
@@ -0,0 +1,72 @@
+// -*- c++ -*-
+//
+// Copyright 2010 Ovidiu Predescu <ovidiu@gmail.com>
+//
+// Serves the files in the static/ directory from program memory, no
+// SD card needed. bundle.h is generated from them with:
+//
+//   ../../extras/make_bundle.py --gzip static bundle.h
+
+#include <pins_arduino.h>
+#include <SPI.h>
+#include <Ethernet.h>
+#include <Flash.h>
+#include <SD.h>
+#include <TinyWebServer.h>
+
+#include "bundle.h"
+
+/****************VALUES YOU CHANGE*************/
+// pin 10 is the SPI select pin for the Ethernet
+const int ETHER_CS = 10;
+
+// Don't forget to modify the IP to an available one on your home network
+byte ip[] = { 192, 168, 5, 177 };
+/*********************************************/
+
+static uint8_t mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
+
+boolean uptime_handler(TinyWebServer& web_server);
+
+TinyWebServer::PathHandler handlers[] = {
+  {"/uptime", TinyWebServer::GET, &uptime_handler },
+  // Work around Arduino's IDE preprocessor bug in handling /* inside
+  // strings.
+  {"/" "*", TinyWebServer::GET, &TinyWebBundleHandler::bundle_handler },
+  {NULL},
+};
+
+TinyWebServer web = TinyWebServer(handlers, NULL);
+
+boolean uptime_handler(TinyWebServer& web_server) {
+  web_server.send_error_code(200);
+  web_server.send_content_type("text/plain");
+  web_server.send_chunked_encoding();
+  web_server.end_headers();
+  web_server.print(millis() / 1000, DEC);
+  return true;
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial << F("Free RAM: ") << FreeRam() << "\n";
+
+  pinMode(ETHER_CS, OUTPUT);
+  digitalWrite(ETHER_CS, HIGH);
+
+  TinyWebBundleHandler::bundle = bundle;
+
+  // Initialize the Ethernet.
+  Serial << F("Setting up the Ethernet card...\n");
+  Ethernet.begin(mac, ip);
+
+  // Start the web server.
+  Serial << F("Web server starting...\n");
+  web.begin();
+
+  Serial << F("Ready to accept HTTP requests.\n\n");
+}
+
+void loop() {
+  web.process();
+}
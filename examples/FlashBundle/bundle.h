@@ -0,0 +1,71 @@
+// -*- c++ -*-
+//
+// Generated by make_bundle.py from static, do not edit.
+
+#include <avr/pgmspace.h>
+#include <TinyWebServer.h>
+
+static const char bundle_0_index_htm_path[] PROGMEM = "/index.htm";
+static const char bundle_0_index_htm_headers[] PROGMEM =
+  "Content-Type: text/html\r\nContent-Length: 249\r\nContent-Encoding: gzip\r\n";
+static const char bundle_0_index_htm_etag[] PROGMEM = "\"e4f3241c\"";
+static const uint8_t bundle_0_index_htm_data[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x4d, 0x51, 0x4b, 0x6e, 0xc3, 0x20,
+  0x10, 0xdd, 0xf7, 0x14, 0x4f, 0xac, 0xab, 0x58, 0xd9, 0x56, 0x98, 0x55, 0x6f, 0x90, 0x54, 0x59,
+  0x13, 0x18, 0x17, 0x12, 0x8c, 0x11, 0x33, 0x8d, 0xea, 0xdb, 0xd7, 0xc6, 0x4e, 0x95, 0xdd, 0xe8,
+  0x7d, 0x99, 0x41, 0x07, 0x19, 0x93, 0x79, 0x03, 0x74, 0x20, 0xeb, 0xd7, 0x61, 0x19, 0x53, 0xcc,
+  0x77, 0x54, 0x4a, 0xbd, 0x62, 0x99, 0x13, 0x71, 0x20, 0x12, 0x05, 0x99, 0x0b, 0xf5, 0x4a, 0xe8,
+  0x57, 0x3a, 0xc7, 0xac, 0x10, 0x2a, 0x0d, 0xbb, 0xe2, 0xb0, 0x02, 0xdd, 0xee, 0x96, 0x28, 0x89,
+  0xcc, 0x39, 0xe6, 0xf9, 0x42, 0xd7, 0x13, 0xd5, 0x07, 0x55, 0xdd, 0x6d, 0xe0, 0xda, 0xd3, 0x3d,
+  0x8b, 0xf4, 0x75, 0xf2, 0xf3, 0xee, 0x09, 0x47, 0xd3, 0x94, 0x1e, 0x43, 0x9d, 0x46, 0x0c, 0xc9,
+  0x72, 0x58, 0x94, 0xc7, 0x9d, 0x2e, 0xe6, 0x1c, 0x22, 0xa3, 0xd8, 0x6f, 0x82, 0xcd, 0x1e, 0x51,
+  0x18, 0xad, 0x18, 0xed, 0x6d, 0xb0, 0x95, 0xe0, 0xa6, 0xb1, 0xc4, 0xb4, 0x24, 0xc4, 0x2c, 0x13,
+  0x24, 0x2c, 0xdc, 0x9d, 0xc4, 0x85, 0xf7, 0x16, 0x01, 0xe4, 0x09, 0xa7, 0x4f, 0x38, 0x5b, 0x17,
+  0x05, 0x23, 0x13, 0x79, 0xf2, 0x07, 0xdd, 0x95, 0xff, 0x8a, 0xaf, 0x22, 0x71, 0xa4, 0x0f, 0x68,
+  0x2e, 0x36, 0x23, 0xfa, 0x5e, 0xfd, 0x34, 0x44, 0x19, 0xdd, 0xad, 0x90, 0x01, 0x93, 0x9b, 0xb2,
+  0xe7, 0x17, 0x17, 0xbb, 0x1a, 0x8b, 0xbc, 0x9e, 0xe6, 0x66, 0x1f, 0x76, 0x43, 0x15, 0xb8, 0xba,
+  0x67, 0xc8, 0xe1, 0xc6, 0x2d, 0xa7, 0x31, 0xdb, 0x1d, 0xb6, 0xf5, 0x97, 0x2d, 0xdb, 0x0f, 0xfc,
+  0x01, 0x1c, 0x24, 0xf3, 0xe4, 0x89, 0x01, 0x00, 0x00,
+};
+
+static const char bundle_0_index_htm_index_path[] PROGMEM = "/";
+
+static const char bundle_1_style_css_path[] PROGMEM = "/style.css";
+static const char bundle_1_style_css_headers[] PROGMEM =
+  "Content-Type: text/css\r\nContent-Length: 80\r\n";
+static const char bundle_1_style_css_etag[] PROGMEM = "\"4d3e9bf3\"";
+static const uint8_t bundle_1_style_css_data[] PROGMEM = {
+  0x62, 0x6f, 0x64, 0x79, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6f, 0x6e, 0x74, 0x2d,
+  0x66, 0x61, 0x6d, 0x69, 0x6c, 0x79, 0x3a, 0x20, 0x73, 0x61, 0x6e, 0x73, 0x2d, 0x73, 0x65, 0x72,
+  0x69, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x6d, 0x61, 0x72, 0x67, 0x69, 0x6e, 0x3a, 0x20,
+  0x32, 0x65, 0x6d, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a, 0x68, 0x31, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3a, 0x20, 0x23, 0x33, 0x33, 0x36, 0x3b, 0x0a, 0x7d, 0x0a,
+};
+
+static const char bundle_2_uptime_js_path[] PROGMEM = "/uptime.js";
+static const char bundle_2_uptime_js_headers[] PROGMEM =
+  "Content-Type: text/javascript\r\nContent-Length: 193\r\nContent-Encoding: gzip\r\n";
+static const char bundle_2_uptime_js_etag[] PROGMEM = "\"a68d112a\"";
+static const uint8_t bundle_2_uptime_js_data[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x55, 0x8f, 0xc1, 0x0a, 0x82, 0x40,
+  0x10, 0x86, 0xef, 0x3e, 0xc5, 0xb0, 0xa7, 0x15, 0xc4, 0xec, 0x2c, 0x5d, 0x8a, 0x28, 0xa1, 0x2e,
+  0xe1, 0xa1, 0xab, 0xb8, 0x63, 0x09, 0x3a, 0xbb, 0xb9, 0xb3, 0x56, 0x84, 0xef, 0xde, 0x8a, 0x0a,
+  0x75, 0x1b, 0xe6, 0xff, 0xf8, 0xfe, 0x99, 0xca, 0x51, 0xc9, 0xb5, 0x26, 0x70, 0x46, 0x15, 0x8c,
+  0x32, 0x84, 0x4f, 0x00, 0xd0, 0x17, 0x1d, 0x74, 0xf8, 0x70, 0x68, 0x19, 0x36, 0x40, 0xf8, 0x84,
+  0xeb, 0xf9, 0x74, 0x64, 0x36, 0x97, 0x69, 0x29, 0xc3, 0xd4, 0x53, 0x33, 0x11, 0x6b, 0x6a, 0x74,
+  0xa1, 0x3c, 0x58, 0xcd, 0xb2, 0xd9, 0x02, 0xa0, 0x74, 0xe9, 0x5a, 0x24, 0x8e, 0x6f, 0xc8, 0xfb,
+  0x06, 0xc7, 0x71, 0xfb, 0xce, 0x94, 0x14, 0xce, 0x70, 0xdd, 0xa2, 0x08, 0x63, 0xc6, 0x17, 0xef,
+  0x34, 0xb1, 0x4f, 0xbc, 0x80, 0xef, 0xb5, 0x8d, 0x3b, 0xb4, 0x46, 0x93, 0xc5, 0xdc, 0x47, 0x63,
+  0xcd, 0xf0, 0xd7, 0x65, 0x90, 0xa4, 0x38, 0xec, 0x73, 0x11, 0x81, 0x58, 0x2d, 0x9a, 0x5f, 0xc2,
+  0x22, 0xa9, 0xf1, 0xbe, 0x21, 0x58, 0x5e, 0x4a, 0x03, 0x8b, 0x9c, 0xf9, 0x8e, 0xae, 0x2f, 0x1a,
+  0x39, 0x6d, 0x23, 0x58, 0x27, 0x49, 0xe2, 0xa3, 0x2f, 0x2a, 0x11, 0x8d, 0xa6, 0x01, 0x01, 0x00,
+  0x00,
+};
+
+const TinyWebBundleHandler::File bundle[] PROGMEM = {
+  {bundle_0_index_htm_path, bundle_0_index_htm_headers, bundle_0_index_htm_etag, bundle_0_index_htm_data, 249, 1},
+  {bundle_0_index_htm_index_path, bundle_0_index_htm_headers, bundle_0_index_htm_etag, bundle_0_index_htm_data, 249, 1},
+  {bundle_1_style_css_path, bundle_1_style_css_headers, bundle_1_style_css_etag, bundle_1_style_css_data, 80, 0},
+  {bundle_2_uptime_js_path, bundle_2_uptime_js_headers, bundle_2_uptime_js_etag, bundle_2_uptime_js_data, 193, 1},
+  {NULL},
+};
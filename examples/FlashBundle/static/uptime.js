@@ -0,0 +1,10 @@
+function update() {
+  var request = new XMLHttpRequest();
+  request.onload = function() {
+    document.getElementById("uptime").textContent = this.responseText;
+  };
+  request.open("GET", "/uptime");
+  request.send();
+}
+update();
+setInterval(update, 1000);
@@ -45,7 +45,7 @@ TinyWebServer web = TinyWebServer(handlers, NULL);
 const char* ip_to_str(const uint8_t* ipAddr)
 {
   static char buf[16];
-  sprintf(buf, "%d.%d.%d.%d\0", ipAddr[0], ipAddr[1], ipAddr[2], ipAddr[3]);
+  sprintf(buf, "%d.%d.%d.%d", ipAddr[0], ipAddr[1], ipAddr[2], ipAddr[3]);
   return buf;
 }
 
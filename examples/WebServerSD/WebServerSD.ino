@@ -13,12 +13,12 @@
 
 boolean file_handler(TinyWebServer& web_server);
 boolean index_handler(TinyWebServer& web_server);
+void send_file_name(TinyWebServer& web_server, const char* filename);
 
 boolean has_filesystem = true;
 Sd2Card card;
 SdVolume volume;
 SdFile root;
-SdFile file;
 
 static uint8_t mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
 
@@ -41,7 +41,8 @@ boolean file_handler(TinyWebServer& web_server) {
     return true;
   }
 
-  char* filename = TinyWebServer::get_file_from_path(web_server.get_path());
+  char* filename = TinyWebServer::get_file_from_path(web_server.get_path(),
+                                                     &web_server.get_arena());
 
   if(!filename) {
   	web_server.send_error_code(400);
@@ -50,22 +51,13 @@ boolean file_handler(TinyWebServer& web_server) {
   }
 
   send_file_name(web_server, filename);
-  free(filename);
   return true;
 }
 
 void send_file_name(TinyWebServer& web_server, const char* filename) {
 
-  TinyWebServer::MimeType mime_type
-    = TinyWebServer::get_mime_type_from_filename(filename);
-  if (file.open(&root, filename, O_READ)) {
-    web_server.send_error_code(200);
-    web_server.send_content_type(mime_type);
-    web_server.end_headers();
-
+  if (web_server.serve_file(root, filename)) {
     Serial << F("Read file "); Serial.println(filename);
-    web_server.send_file(file);
-    file.close();
   } else {
     web_server.send_error_code(404);
     web_server.send_content_type("text/plain");
@@ -89,7 +81,7 @@ TinyWebServer web = TinyWebServer(handlers, NULL);
 const char* ip_to_str(const uint8_t* ipAddr)
 {
   static char buf[16];
-  sprintf(buf, "%d.%d.%d.%d\0", ipAddr[0], ipAddr[1], ipAddr[2], ipAddr[3]);
+  sprintf(buf, "%d.%d.%d.%d", ipAddr[0], ipAddr[1], ipAddr[2], ipAddr[3]);
   return buf;
 }
 
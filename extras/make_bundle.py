@@ -0,0 +1,144 @@
+#! /usr/bin/env python3
+#
+# Copyright 2010 Ovidiu Predescu <ovidiu@gmail.com>
+#
+# Turns a directory of static files into a C++ header holding them in
+# program memory, for TinyWebBundleHandler::bundle_handler() to serve
+# without an SD card.
+#
+# Usage: make_bundle.py [--gzip] [--name NAME] DIRECTORY OUTPUT.h
+#
+# With --gzip, files that shrink when compressed are stored gzip
+# compressed. The header defines NAME, `bundle' by default, as the
+# NULL terminated array of TinyWebBundleHandler::File to assign to
+# TinyWebBundleHandler::bundle.
+
+import argparse
+import gzip
+import os
+import re
+import sys
+import zlib
+
+# Keep in sync with the MIME types in TinyWebServer.cpp.
+MIME_TYPES = {
+    "css": "text/css",
+    "gif": "image/gif",
+    "htm": "text/html",
+    "html": "text/html",
+    "ico": "image/vnd.microsoft.icon",
+    "jpeg": "image/jpeg",
+    "jpg": "image/jpeg",
+    "js": "text/javascript",
+    "json": "application/json",
+    "mp3": "audio/mpeg",
+    "pdf": "application/pdf",
+    "png": "image/png",
+    "svg": "image/svg+xml",
+    "txt": "text/plain",
+    "wasm": "application/wasm",
+    "woff": "font/woff",
+    "woff2": "font/woff2",
+    "xml": "text/xml",
+}
+
+INDEX_FILES = ("index.htm", "index.html")
+
+
+def c_string(s):
+    return '"' + s.replace("\\", "\\\\").replace('"', '\\"') \
+        .replace("\r", "\\r").replace("\n", "\\n") + '"'
+
+
+def c_bytes(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("  " + ", ".join("0x%02x" % b for b in data[i:i + 16])
+                     + ",")
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Generates a TinyWebServer asset bundle.")
+    parser.add_argument("--gzip", action="store_true",
+                        help="store the files gzip compressed when smaller")
+    parser.add_argument("--name", default="bundle",
+                        help="the name of the generated array")
+    parser.add_argument("directory")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    names = sorted(n for n in os.listdir(args.directory)
+                   if not n.startswith(".") and not n.endswith("~")
+                   and os.path.isfile(os.path.join(args.directory, n)))
+    if not names:
+        sys.exit("No files in " + args.directory)
+
+    out = []
+    out.append("// -*- c++ -*-")
+    out.append("//")
+    out.append("// Generated by make_bundle.py from %s, do not edit."
+               % os.path.basename(os.path.normpath(args.directory)))
+    out.append("")
+    out.append("#include <avr/pgmspace.h>")
+    out.append("#include <TinyWebServer.h>")
+    out.append("")
+
+    entries = []
+    total = 0
+    for i, name in enumerate(names):
+        with open(os.path.join(args.directory, name), "rb") as f:
+            data = f.read()
+        ext = name.rsplit(".", 1)[-1].lower() if "." in name else ""
+        mime = MIME_TYPES.get(ext, "text/html")
+        etag = '"%08x"' % (zlib.crc32(data) & 0xffffffff)
+
+        gzipped = False
+        if args.gzip:
+            # No timestamp, so the output doesn't change between runs.
+            compressed = gzip.compress(data, 9, mtime=0)
+            if len(compressed) < len(data):
+                data = compressed
+                gzipped = True
+
+        headers = "Content-Type: %s\r\nContent-Length: %d\r\n" % (
+            mime, len(data))
+        if gzipped:
+            headers += "Content-Encoding: gzip\r\n"
+
+        ident = "%s_%d_%s" % (args.name, i, re.sub(r"\W", "_", name))
+        out.append("static const char %s_path[] PROGMEM = %s;"
+                   % (ident, c_string("/" + name)))
+        out.append("static const char %s_headers[] PROGMEM =\n  %s;"
+                   % (ident, c_string(headers)))
+        out.append("static const char %s_etag[] PROGMEM = %s;"
+                   % (ident, c_string(etag)))
+        out.append("static const uint8_t %s_data[] PROGMEM = {" % ident)
+        out.append(c_bytes(data))
+        out.append("};")
+        out.append("")
+        entries.append((ident, "%s_path" % ident, len(data), gzipped))
+        if name.lower() in INDEX_FILES:
+            out.append("static const char %s_index_path[] PROGMEM = \"/\";"
+                       % ident)
+            out.append("")
+            entries.append((ident, "%s_index_path" % ident, len(data),
+                            gzipped))
+        total += len(data)
+
+    out.append("const TinyWebBundleHandler::File %s[] PROGMEM = {" % args.name)
+    for ident, path, size, gzipped in entries:
+        out.append("  {%s, %s_headers, %s_etag, %s_data, %d, %d},"
+                   % (path, ident, ident, ident, size, int(gzipped)))
+    out.append("  {NULL},")
+    out.append("};")
+    out.append("")
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(out))
+    print("%s: %d files, %d bytes" % (args.output, len(names), total))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,43 @@
+// -*- c++ -*-
+//
+// Host implementation of the Arduino core stand-in, plus a main()
+// that drives a sketch's setup() and loop() functions.
+
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+
+HardwareSerial Serial;
+
+static uint64_t now_micros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint64_t start_micros = now_micros();
+
+uint32_t millis() { return (now_micros() - start_micros) / 1000; }
+uint32_t micros() { return now_micros() - start_micros; }
+void delay(uint32_t ms) { usleep(ms * 1000); }
+
+static uint8_t pin_state[64];
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {
+  pin_state[pin & 63] = value;
+}
+int digitalRead(uint8_t pin) { return pin_state[pin & 63]; }
+
+size_t HardwareSerial::write(uint8_t c) {
+  return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush() {
+  fflush(stdout);
+}
@@ -0,0 +1,58 @@
+// -*- c++ -*-
+//
+// Host (POSIX) stand-in for the Arduino core, used to build
+// TinyWebServer and its examples on a development machine. Only the
+// subset of the API used by the library and its sketches is provided.
+
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <avr/pgmspace.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define ARDUINO 100
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+#include "Print.h"
+#include "Stream.h"
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual void flush();
+};
+
+extern HardwareSerial Serial;
+
+#endif /* __HOST_ARDUINO_H__ */
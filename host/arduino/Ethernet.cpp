@@ -0,0 +1,177 @@
+// -*- c++ -*-
+//
+// POSIX implementation of the host Ethernet stand-in.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "Ethernet.h"
+
+EthernetClass Ethernet;
+
+namespace {
+
+int listen_fd = -1;
+int sock_fd[MAX_SOCK_NUM] = { -1, -1, -1, -1 };
+
+int fd_for(uint8_t sock) {
+  return sock < MAX_SOCK_NUM ? sock_fd[sock] : -1;
+}
+
+int bytes_available(int fd) {
+  int n = 0;
+  if (fd < 0 || ioctl(fd, FIONREAD, &n) < 0) {
+    return 0;
+  }
+  return n;
+}
+
+bool peer_closed(int fd) {
+  char ch;
+  ssize_t r = recv(fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (r == 0) {
+    return true;
+  }
+  return r < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+}
+
+void accept_pending() {
+  if (listen_fd < 0) {
+    return;
+  }
+  for (int i = 0; i < MAX_SOCK_NUM; i++) {
+    if (sock_fd[i] >= 0) {
+      continue;
+    }
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sock_fd[i] = fd;
+  }
+}
+
+}  // namespace
+
+EthernetClient::EthernetClient() : _sock(MAX_SOCK_NUM) {}
+
+EthernetClient::EthernetClient(uint8_t sock) : _sock(sock) {}
+
+size_t EthernetClient::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t EthernetClient::write(const uint8_t* buf, size_t size) {
+  int fd = fd_for(_sock);
+  size_t written = 0;
+  while (fd >= 0 && written < size) {
+    ssize_t r = send(fd, buf + written, size - written, MSG_NOSIGNAL);
+    if (r > 0) {
+      written += r;
+    } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd p = { fd, POLLOUT, 0 };
+      poll(&p, 1, 1000);
+    } else {
+      break;
+    }
+  }
+  return written;
+}
+
+int EthernetClient::available() {
+  return bytes_available(fd_for(_sock));
+}
+
+int EthernetClient::read() {
+  uint8_t ch;
+  return read(&ch, 1) == 1 ? ch : -1;
+}
+
+int EthernetClient::read(uint8_t* buf, size_t size) {
+  int fd = fd_for(_sock);
+  if (fd < 0) {
+    return -1;
+  }
+  ssize_t r = recv(fd, buf, size, MSG_DONTWAIT);
+  if (r < 0) {
+    return -1;
+  }
+  return r;
+}
+
+int EthernetClient::peek() {
+  int fd = fd_for(_sock);
+  uint8_t ch;
+  if (fd < 0 || recv(fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT) != 1) {
+    return -1;
+  }
+  return ch;
+}
+
+void EthernetClient::stop() {
+  int fd = fd_for(_sock);
+  if (fd >= 0) {
+    close(fd);
+    sock_fd[_sock] = -1;
+  }
+}
+
+uint8_t EthernetClient::connected() {
+  int fd = fd_for(_sock);
+  if (fd < 0) {
+    return 0;
+  }
+  return bytes_available(fd) > 0 || !peer_closed(fd);
+}
+
+EthernetServer::EthernetServer(uint16_t port) : _port(port) {
+  const char* env = getenv("TWS_PORT");
+  if (env) {
+    _port = atoi(env);
+  }
+}
+
+void EthernetServer::begin() {
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(_port);
+  if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+      || listen(listen_fd, 64) < 0) {
+    perror("EthernetServer::begin");
+    exit(1);
+  }
+  fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+}
+
+EthernetClient EthernetServer::available() {
+  accept_pending();
+  for (int i = 0; i < MAX_SOCK_NUM; i++) {
+    if (sock_fd[i] < 0) {
+      continue;
+    }
+    if (bytes_available(sock_fd[i]) > 0) {
+      return EthernetClient(i);
+    }
+    if (peer_closed(sock_fd[i])) {
+      // Like the W5100 library, reclaim sockets the peer has closed.
+      close(sock_fd[i]);
+      sock_fd[i] = -1;
+    }
+  }
+  return EthernetClient(MAX_SOCK_NUM);
+}
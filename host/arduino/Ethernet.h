@@ -0,0 +1,66 @@
+// -*- c++ -*-
+//
+// Host stand-in for the Arduino Ethernet library. Sockets are backed
+// by POSIX TCP sockets, and at most MAX_SOCK_NUM of them are open at
+// any time, just like on the W5100 chip.
+//
+// The listening port can be overridden at run time with the TWS_PORT
+// environment variable, so the examples (which listen on port 80) can
+// run without root privileges.
+
+#ifndef __HOST_ETHERNET_H__
+#define __HOST_ETHERNET_H__
+
+#include <Arduino.h>
+#include <Client.h>
+
+#define MAX_SOCK_NUM 4
+
+class EthernetClient : public Client {
+public:
+  EthernetClient();
+  EthernetClient(uint8_t sock);
+
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t* buf, size_t size);
+  using Print::write;
+  virtual int available();
+  virtual int read();
+  virtual int read(uint8_t* buf, size_t size);
+  virtual int peek();
+  virtual void flush() {}
+  virtual void stop();
+  virtual uint8_t connected();
+  virtual operator bool() { return _sock < MAX_SOCK_NUM; }
+
+  bool operator==(const EthernetClient& other) const {
+    return _sock == other._sock;
+  }
+  bool operator!=(const EthernetClient& other) const {
+    return _sock != other._sock;
+  }
+  uint8_t getSocketNumber() const { return _sock; }
+
+private:
+  uint8_t _sock;
+};
+
+class EthernetServer {
+public:
+  EthernetServer(uint16_t port);
+  void begin();
+  EthernetClient available();
+
+private:
+  uint16_t _port;
+};
+
+class EthernetClass {
+public:
+  void begin(uint8_t* mac, uint8_t* ip) {}
+  void begin(uint8_t* mac) {}
+};
+
+extern EthernetClass Ethernet;
+
+#endif /* __HOST_ETHERNET_H__ */
@@ -0,0 +1,41 @@
+// -*- c++ -*-
+//
+// Host stand-in for Mikal Hart's Flash library (version 5.0), limited
+// to the FLASH_STRING and streaming operators used by TinyWebServer.
+
+#ifndef __HOST_FLASH_H__
+#define __HOST_FLASH_H__
+
+#include <Arduino.h>
+
+#define FLASH_STRING(name, value) \
+  static const char name##_flash[] PROGMEM = value; \
+  _FLASH_STRING name(name##_flash);
+
+class _FLASH_STRING {
+public:
+  _FLASH_STRING(const prog_char* arr) : _arr(arr) {}
+
+  size_t length() const { return strlen_P(_arr); }
+  const prog_char* access() const { return _arr; }
+  const char operator[](int index) const {
+    return static_cast<char>(pgm_read_byte(_arr + index));
+  }
+  void print(Print& stream) const { stream.print(_arr); }
+
+private:
+  const prog_char* _arr;
+};
+
+template<class T>
+inline Print& operator<<(Print& stream, T arg) {
+  stream.print(arg);
+  return stream;
+}
+
+inline Print& operator<<(Print& stream, const _FLASH_STRING& printable) {
+  printable.print(stream);
+  return stream;
+}
+
+#endif /* __HOST_FLASH_H__ */
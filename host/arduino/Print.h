@@ -0,0 +1,47 @@
+// -*- c++ -*-
+//
+// Host stand-in for the Arduino Print class.
+
+#ifndef __HOST_PRINT_H__
+#define __HOST_PRINT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+class __FlashStringHelper;
+#define F(string_literal) \
+  (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str);
+
+  size_t print(const __FlashStringHelper* s);
+  size_t print(const char* s);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = 10);
+  size_t print(int n, int base = 10);
+  size_t print(unsigned int n, int base = 10);
+  size_t print(long n, int base = 10);
+  size_t print(unsigned long n, int base = 10);
+  size_t print(double n, int digits = 2);
+
+  size_t println(const __FlashStringHelper* s);
+  size_t println(const char* s);
+  size_t println(char c);
+  size_t println(unsigned char n, int base = 10);
+  size_t println(int n, int base = 10);
+  size_t println(unsigned int n, int base = 10);
+  size_t println(long n, int base = 10);
+  size_t println(unsigned long n, int base = 10);
+  size_t println(double n, int digits = 2);
+  size_t println();
+
+private:
+  size_t print_number(unsigned long n, uint8_t base);
+};
+
+#endif /* __HOST_PRINT_H__ */
@@ -0,0 +1,241 @@
+// -*- c++ -*-
+//
+// POSIX implementation of the host SD stand-in.
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "SD.h"
+
+// <fcntl.h> cannot be included here: its O_* flags clash with the
+// SdFat ones, so declare the few bits of it we need.
+extern "C" int open(const char* path, int flags, ...);
+static const int kPosixRead = 00;
+static const int kPosixWrite = 01;
+static const int kPosixReadWrite = 02;
+static const int kPosixCreate = 0100;
+static const int kPosixTruncate = 01000;
+
+namespace {
+
+// Directory entries sorted by name, which gives files a stable index
+// the way a FAT directory does.
+std::vector<std::string> list_dir(const char* path) {
+  std::vector<std::string> names;
+  DIR* d = opendir(path);
+  if (!d) {
+    return names;
+  }
+  struct dirent* e;
+  while ((e = readdir(d))) {
+    if (e->d_name[0] != '.') {
+      names.push_back(e->d_name);
+    }
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+}  // namespace
+
+int FreeRam() { return 2048; }
+
+SdFile::SdFile() : fd_(-1), is_open_(false), is_dir_(false), position_(0) {
+  path_[0] = 0;
+}
+
+uint8_t SdFile::openRoot(SdVolume* vol) {
+  const char* root = getenv("TWS_SD_ROOT");
+  snprintf(path_, sizeof(path_), "%s", root ? root : ".");
+  is_open_ = true;
+  is_dir_ = true;
+  position_ = 0;
+  return true;
+}
+
+uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
+  if (is_open_ || !dirFile || !dirFile->is_dir_ || !fileName || !*fileName
+      || strchr(fileName, '/')) {
+    return false;
+  }
+  std::vector<std::string> names = list_dir(dirFile->path_);
+  for (size_t i = 0; i < names.size(); i++) {
+    if (!strcasecmp(names[i].c_str(), fileName)) {
+      if (oflag & O_EXCL) {
+        return false;
+      }
+      if (!open(dirFile, (uint16_t)i, oflag)) {
+        return false;
+      }
+      // Leave the directory positioned past the entry, like SdFat.
+      dirFile->position_ = 32 * (i + 1);
+      return true;
+    }
+  }
+  if (!(oflag & O_CREAT)) {
+    return false;
+  }
+  if (snprintf(path_, sizeof(path_), "%s/%s", dirFile->path_, fileName)
+      >= (int)sizeof(path_)) {
+    return false;
+  }
+  fd_ = ::open(path_, kPosixReadWrite | kPosixCreate | kPosixTruncate, 0644);
+  if (fd_ < 0) {
+    return false;
+  }
+  is_open_ = true;
+  is_dir_ = false;
+  position_ = 0;
+  names = list_dir(dirFile->path_);
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] == fileName) {
+      dirFile->position_ = 32 * (i + 1);
+    }
+  }
+  return true;
+}
+
+uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
+  if (is_open_ || !dirFile || !dirFile->is_dir_) {
+    return false;
+  }
+  std::vector<std::string> names = list_dir(dirFile->path_);
+  if (index >= names.size()) {
+    return false;
+  }
+  if (snprintf(path_, sizeof(path_), "%s/%s",
+               dirFile->path_, names[index].c_str()) >= (int)sizeof(path_)) {
+    return false;
+  }
+  struct stat st;
+  if (stat(path_, &st) < 0) {
+    return false;
+  }
+  is_dir_ = S_ISDIR(st.st_mode);
+  position_ = 0;
+  if (!is_dir_) {
+    int flags = (oflag & O_WRITE)
+      ? ((oflag & O_READ) ? kPosixReadWrite : kPosixWrite)
+      : kPosixRead;
+    if (oflag & O_TRUNC) {
+      flags |= kPosixTruncate;
+    }
+    fd_ = ::open(path_, flags);
+    if (fd_ < 0) {
+      return false;
+    }
+    if (oflag & O_APPEND) {
+      position_ = fileSize();
+    }
+  }
+  is_open_ = true;
+  return true;
+}
+
+uint8_t SdFile::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+  fd_ = -1;
+  is_open_ = false;
+  is_dir_ = false;
+  return true;
+}
+
+uint8_t SdFile::remove() {
+  if (!is_open_ || is_dir_) {
+    return false;
+  }
+  close();
+  return unlink(path_) == 0;
+}
+
+uint8_t SdFile::sync() {
+  return is_open_;
+}
+
+uint32_t SdFile::fileSize() const {
+  struct stat st;
+  if (!is_open_ || stat(path_, &st) < 0) {
+    return 0;
+  }
+  return is_dir_ ? 0 : st.st_size;
+}
+
+uint8_t SdFile::seekSet(uint32_t pos) {
+  if (!is_open_ || pos > fileSize()) {
+    return false;
+  }
+  position_ = pos;
+  return true;
+}
+
+uint8_t SdFile::dirEntry(dir_t* dir) {
+  struct stat st;
+  if (!is_open_ || stat(path_, &st) < 0) {
+    return false;
+  }
+  memset(dir, 0, sizeof(*dir));
+  const char* name = strrchr(path_, '/');
+  name = name ? name + 1 : path_;
+  memset(dir->name, ' ', sizeof(dir->name));
+  for (int i = 0, j = 0; name[i] && j < 11; i++) {
+    if (name[i] == '.') {
+      j = 8;
+    } else {
+      dir->name[j++] = toupper(name[i]);
+    }
+  }
+  struct tm tm;
+  gmtime_r(&st.st_mtime, &tm);
+  dir->lastWriteDate = (tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5
+    | tm.tm_mday;
+  dir->lastWriteTime = tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec >> 1;
+  dir->fileSize = is_dir_ ? 0 : st.st_size;
+  return true;
+}
+
+int16_t SdFile::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int16_t SdFile::read(void* buf, uint16_t nbyte) {
+  if (fd_ < 0) {
+    return -1;
+  }
+  ssize_t r = pread(fd_, buf, nbyte, position_);
+  if (r < 0) {
+    return -1;
+  }
+  position_ += r;
+  return r;
+}
+
+size_t SdFile::write(uint8_t b) {
+  return write((const void*)&b, 1) == 1;
+}
+
+int16_t SdFile::write(const void* buf, uint16_t nbyte) {
+  if (fd_ < 0) {
+    return -1;
+  }
+  ssize_t r = pwrite(fd_, buf, nbyte, position_);
+  if (r < 0) {
+    return -1;
+  }
+  position_ += r;
+  return r;
+}
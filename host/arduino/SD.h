@@ -0,0 +1,111 @@
+// -*- c++ -*-
+//
+// Host stand-in for the Arduino SD library (the SdFat based version
+// shipped with Arduino 1.0). The "card" is a directory on the host
+// file system, TWS_SD_ROOT or the current directory by default. File
+// names are matched case insensitively, like on a FAT volume.
+
+#ifndef __HOST_SD_H__
+#define __HOST_SD_H__
+
+#include <Arduino.h>
+
+#undef O_READ
+#undef O_RDONLY
+#undef O_WRITE
+#undef O_WRONLY
+#undef O_RDWR
+#undef O_APPEND
+#undef O_SYNC
+#undef O_CREAT
+#undef O_EXCL
+#undef O_TRUNC
+
+#define O_READ 0x01
+#define O_RDONLY O_READ
+#define O_WRITE 0x02
+#define O_WRONLY O_WRITE
+#define O_RDWR (O_READ | O_WRITE)
+#define O_APPEND 0x04
+#define O_SYNC 0x08
+#define O_CREAT 0x10
+#define O_EXCL 0x20
+#define O_TRUNC 0x40
+
+#define SPI_FULL_SPEED 0
+#define SPI_HALF_SPEED 1
+#define SPI_QUARTER_SPEED 2
+
+// FAT directory entry, reduced to the fields used by TinyWebServer.
+typedef struct directoryEntry {
+  uint8_t name[11];
+  uint8_t attributes;
+  uint16_t lastWriteTime;
+  uint16_t lastWriteDate;
+  uint32_t fileSize;
+} dir_t;
+
+static inline uint16_t FAT_YEAR(uint16_t fatDate) {
+  return 1980 + (fatDate >> 9);
+}
+static inline uint8_t FAT_MONTH(uint16_t fatDate) {
+  return (fatDate >> 5) & 0XF;
+}
+static inline uint8_t FAT_DAY(uint16_t fatDate) {
+  return fatDate & 0X1F;
+}
+static inline uint8_t FAT_HOUR(uint16_t fatTime) {
+  return fatTime >> 11;
+}
+static inline uint8_t FAT_MINUTE(uint16_t fatTime) {
+  return (fatTime >> 5) & 0X3F;
+}
+static inline uint8_t FAT_SECOND(uint16_t fatTime) {
+  return 2*(fatTime & 0X1F);
+}
+
+class Sd2Card {
+public:
+  uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin) { return true; }
+};
+
+class SdVolume {
+public:
+  uint8_t init(Sd2Card* dev) { return true; }
+};
+
+class SdFile : public Print {
+public:
+  SdFile();
+
+  uint8_t openRoot(SdVolume* vol);
+  uint8_t open(SdFile* dirFile, const char* fileName, uint8_t oflag);
+  uint8_t open(SdFile* dirFile, uint16_t index, uint8_t oflag);
+  uint8_t close();
+  uint8_t sync();
+  uint8_t remove();
+
+  uint8_t isOpen() const { return is_open_; }
+  uint8_t isDir() const { return is_dir_; }
+  uint32_t fileSize() const;
+  uint32_t curPosition() const { return position_; }
+  uint8_t seekSet(uint32_t pos);
+  uint8_t dirEntry(dir_t* dir);
+
+  int16_t read();
+  int16_t read(void* buf, uint16_t nbyte);
+  virtual size_t write(uint8_t b);
+  int16_t write(const void* buf, uint16_t nbyte);
+  using Print::write;
+
+private:
+  char path_[1024];
+  int fd_;
+  bool is_open_;
+  bool is_dir_;
+  uint32_t position_;
+};
+
+int FreeRam();
+
+#endif /* __HOST_SD_H__ */
@@ -0,0 +1,3 @@
+// -*- c++ -*-
+//
+// Host stand-in for the Arduino SPI library. Nothing to do here.
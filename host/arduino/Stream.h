@@ -0,0 +1,18 @@
+// -*- c++ -*-
+//
+// Host stand-in for the Arduino Stream class.
+
+#ifndef __HOST_STREAM_H__
+#define __HOST_STREAM_H__
+
+#include "Print.h"
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+};
+
+#endif /* __HOST_STREAM_H__ */
@@ -0,0 +1,31 @@
+// -*- c++ -*-
+//
+// Host stand-in for <avr/pgmspace.h>: program memory is ordinary
+// memory, so every accessor is a plain dereference.
+
+#ifndef __HOST_PGMSPACE_H__
+#define __HOST_PGMSPACE_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+typedef char prog_char;
+
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr) (*(void* const*)(addr))
+
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+
+#endif /* __HOST_PGMSPACE_H__ */
@@ -0,0 +1,10 @@
+// -*- c++ -*-
+//
+// Host stand-in for the board pin definitions.
+
+#ifndef __HOST_PINS_ARDUINO_H__
+#define __HOST_PINS_ARDUINO_H__
+
+#define SS_PIN 10
+
+#endif /* __HOST_PINS_ARDUINO_H__ */
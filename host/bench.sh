@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Runs the BlinkLed example on the host, with its static files as the
+# SD card, and measures it with loadgen on the requests its page
+# makes. Extra arguments are passed to loadgen, e.g. "-d 10".
+#
+#   make bench
+#   BENCH_PORT=8080 ./bench.sh -n 5000
+
+set -e
+cd "$(dirname "$0")"
+
+PORT=${BENCH_PORT:-18080}
+BUILD=${BUILD:-build}
+SD_ROOT=$(mktemp -d)
+trap 'kill $SERVER 2>/dev/null; rm -rf "$SD_ROOT"' EXIT INT TERM
+
+# The SD card holds 8.3 upper case names.
+for f in ../examples/BlinkLed/static/*; do
+  cp "$f" "$SD_ROOT/$(basename "$f" | tr a-z A-Z)"
+done
+
+TWS_PORT=$PORT TWS_SD_ROOT=$SD_ROOT ./$BUILD/BlinkLed >/dev/null &
+SERVER=$!
+sleep 0.5
+
+run() {
+  echo "== $*"
+  ./$BUILD/loadgen "$@" || true
+  echo
+}
+
+HOST=127.0.0.1:$PORT
+run -c 1 -n 2000 "$@" $HOST /ledstatus
+run -c 4 -n 2000 "$@" $HOST /ledstatus
+run -c 1 -n 2000 -1 "$@" $HOST /ledstatus
+run -c 1 -n 1000 -X POST -b led=1 "$@" $HOST /blinkled
+run -c 2 -n 1000 "$@" $HOST / /style.css /main.js
+run -c 2 -n 200 "$@" $HOST /jquery.js
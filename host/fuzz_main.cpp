@@ -0,0 +1,212 @@
+// -*- c++ -*-
+//
+// A small stand-in for libFuzzer's driver, for compilers without
+// -fsanitize=fuzzer. Given files, it runs each of them through
+// LLVMFuzzerTestOneInput(). Otherwise it mutates the inputs of
+// parser_harness.h at random:
+//
+//   parser_fuzz [-runs=N] [-seed=N] [file...]
+//
+// An input that crashes, trips a sanitizer or takes longer than a
+// second is written to crash-<seed>-<run> before the program aborts.
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "parser_harness.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+// Make the sanitizers abort, so the input gets saved.
+extern "C" const char* __asan_default_options() {
+  return "abort_on_error=1";
+}
+
+extern "C" const char* __ubsan_default_options() {
+  return "abort_on_error=1:print_stacktrace=1";
+}
+
+static std::string current;
+static char crash_name[64];
+
+static void save_input(int sig) {
+  FILE* f = fopen(crash_name, "wb");
+  if (f) {
+    fwrite(current.data(), 1, current.size(), f);
+    fclose(f);
+  }
+  fprintf(stderr, "\n%s on input of %zu bytes, saved to %s\n",
+          sig == SIGALRM ? "Timeout" : strsignal(sig), current.size(),
+          crash_name);
+  signal(sig, SIG_DFL);
+  if (sig == SIGALRM) {
+    sig = SIGABRT;
+  }
+  raise(sig);
+}
+
+static void run(const std::string& input) {
+  current = input;
+  alarm(1);
+  LLVMFuzzerTestOneInput((const uint8_t*)input.data(), input.size());
+  alarm(0);
+}
+
+static std::string read_file(const char* name) {
+  std::string s;
+  FILE* f = fopen(name, "rb");
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    s.append(buf, n);
+  }
+  fclose(f);
+  return s;
+}
+
+// The inputs to start from, each with the selector of the function
+// it's meant for.
+static std::vector<std::string> seeds() {
+  std::vector<std::string> v;
+  for (size_t i = 0; i < ARRAY_SIZE(request_line_corpus); i++) {
+    v.push_back(std::string(1, 0) + request_line_corpus[i]);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(url_corpus); i++) {
+    v.push_back(std::string(1, 1) + url_corpus[i]);
+    v.push_back(std::string(1, 5) + url_corpus[i]);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(filename_corpus); i++) {
+    v.push_back(std::string(1, 1) + filename_corpus[i]);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(header_corpus); i++) {
+    v.push_back(std::string(1, 2) + header_corpus[i] + "a=1&b=%41+c");
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(query_corpus); i++) {
+    v.push_back(std::string(1, 3) + query_corpus[i]);
+  }
+  v.push_back(std::string(1, 4 + 9) + "bytes=0-499");
+  v.push_back(std::string(1, 4 + 9) + "bytes=-500");
+  v.push_back(std::string(1, 4) + "bytes=900-");
+  v.push_back(std::string(1, 6) + "<p class=\"{{led_state}}\">{{ a }}</p>{x}");
+  v.push_back(std::string(1, 7) + multipart_body);
+  v.push_back(std::string(1, 7 + 9 * 5) + multipart_body);
+  v.push_back(std::string(1, 8)
+              + std::string((const char*)websocket_frames,
+                            sizeof(websocket_frames)));
+  return v;
+}
+
+static void mutate(std::string& s, const std::vector<std::string>& corpus) {
+  int count = 1 + rand() % 4;
+  for (int i = 0; i < count; i++) {
+    size_t pos = s.empty() ? 0 : rand() % (s.size() + 1);
+    switch (rand() % 6) {
+    case 0:
+      // Flip a bit.
+      if (pos < s.size()) {
+        s[pos] ^= 1 << (rand() % 8);
+      }
+      break;
+    case 1: {
+      // Insert a byte, often one the parsers care about.
+      static const char special[] = "\r\n :%+=&?/{}*,-\"0";
+      char ch = rand() % 2 ? special[rand() % (sizeof(special) - 1)]
+        : (char)rand();
+      s.insert(pos, 1, ch);
+      break;
+    }
+    case 2:
+      // Delete a few bytes.
+      if (pos < s.size()) {
+        s.erase(pos, 1 + rand() % 8);
+      }
+      break;
+    case 3:
+      // Repeat a part, to make things long.
+      if (pos < s.size()) {
+        size_t len = 1 + rand() % (s.size() - pos);
+        std::string part = s.substr(pos, len);
+        for (int n = rand() % 16; n >= 0; n--) {
+          s.insert(pos, part);
+        }
+      }
+      break;
+    case 4: {
+      // Splice in part of another input.
+      const std::string& other = corpus[rand() % corpus.size()];
+      if (other.size() > 1) {
+        size_t start = 1 + rand() % (other.size() - 1);
+        s.insert(pos, other.substr(start, rand() % (other.size() - start + 1)));
+      }
+      break;
+    }
+    case 5:
+      // Change the target function.
+      if (!s.empty()) {
+        s[0] = rand();
+      }
+      break;
+    }
+  }
+  if (s.size() > 4096) {
+    s.resize(4096);
+  }
+}
+
+int main(int argc, char** argv) {
+  long runs = 100000;
+  unsigned seed = time(NULL);
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "-runs=", 6)) {
+      runs = atol(argv[i] + 6);
+    } else if (!strncmp(argv[i], "-seed=", 6)) {
+      seed = atol(argv[i] + 6);
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  signal(SIGSEGV, save_input);
+  signal(SIGABRT, save_input);
+  signal(SIGALRM, save_input);
+  signal(SIGFPE, save_input);
+  strcpy(crash_name, "crash-input");
+
+  if (!files.empty()) {
+    for (size_t i = 0; i < files.size(); i++) {
+      run(read_file(files[i]));
+    }
+    printf("Ran %zu inputs\n", files.size());
+    return 0;
+  }
+
+  srand(seed);
+  std::vector<std::string> corpus = seeds();
+  for (size_t i = 0; i < corpus.size(); i++) {
+    run(corpus[i]);
+  }
+  for (long i = 0; i < runs; i++) {
+    std::string input = corpus[rand() % corpus.size()];
+    mutate(input, corpus);
+    snprintf(crash_name, sizeof(crash_name), "crash-%u-%ld", seed, i);
+    run(input);
+    // Keep some of the mutated inputs to mutate them further.
+    if (corpus.size() < 4096 && rand() % 16 == 0) {
+      corpus.push_back(input);
+    }
+  }
+  printf("Ran %ld inputs with seed %u\n", runs, seed);
+  return 0;
+}
@@ -0,0 +1,365 @@
+// -*- c++ -*-
+//
+// A small HTTP load generator for the host build of the examples. It
+// sends requests over a number of parallel connections, reusing them
+// with keep-alive when the server allows it, and reports the request
+// and byte rates along with the latency percentiles.
+//
+//   loadgen [-c connections] [-n requests] [-d seconds] [-X method]
+//           [-b body] [-1] host:port path...
+//
+// The paths are requested in turn. -1 makes HTTP/1.0 requests without
+// keep-alive, so every request pays for a new connection.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static struct sockaddr_in server_addr;
+static std::string host_header;
+static std::vector<std::string> paths;
+static const char* method = "GET";
+static const char* body = NULL;
+static bool http_10 = false;
+static long max_requests = 1000;
+static double max_seconds = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static long requests_started = 0;
+static double start_time;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What one connection did.
+struct Worker {
+  pthread_t thread;
+  std::vector<uint32_t> latencies;  // In microseconds.
+  uint64_t bytes;
+  long errors;
+  long connects;
+};
+
+// Returns the index of the next request to make, or -1 when done.
+static long next_request() {
+  pthread_mutex_lock(&lock);
+  long n = -1;
+  bool time_left = !max_seconds || now() - start_time < max_seconds;
+  if (time_left && (max_seconds || requests_started < max_requests)) {
+    n = requests_started++;
+  }
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+static int connect_to_server() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  struct timeval tv = { 5, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  if (connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr))) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool send_all(int fd, const char* data, size_t size) {
+  while (size) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Buffered reads from a connection.
+struct Reader {
+  int fd;
+  char buf[16384];
+  size_t pos, len;
+
+  explicit Reader(int fd) : fd(fd), pos(0), len(0) {}
+
+  bool fill() {
+    pos = 0;
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    len = n > 0 ? n : 0;
+    return n > 0;
+  }
+
+  // Reads a line without its CRLF.
+  bool line(std::string& s) {
+    s.clear();
+    while (1) {
+      if (pos == len && !fill()) {
+        return false;
+      }
+      char ch = buf[pos++];
+      if (ch == '\n') {
+        if (!s.empty() && s[s.size() - 1] == '\r') {
+          s.erase(s.size() - 1);
+        }
+        return true;
+      }
+      s += ch;
+    }
+  }
+
+  // Skips `n' bytes, or everything up to the end of the connection if
+  // `n' is negative. Returns the number of bytes skipped.
+  long skip(long n) {
+    long skipped = 0;
+    while (n < 0 || skipped < n) {
+      if (pos == len && !fill()) {
+        break;
+      }
+      size_t k = len - pos;
+      if (n >= 0 && (long)k > n - skipped) {
+        k = n - skipped;
+      }
+      pos += k;
+      skipped += k;
+    }
+    return skipped;
+  }
+};
+
+// Reads a response. Returns its body's size, or -1 on errors, and
+// tells whether the connection can be reused.
+static long read_response(Reader& r, bool* reuse) {
+  std::string line;
+  if (!r.line(line) || line.compare(0, 5, "HTTP/")) {
+    return -1;
+  }
+  bool http_11 = !line.compare(0, 8, "HTTP/1.1");
+  bool close_requested = false;
+  bool chunked = false;
+  long length = -1;
+  while (1) {
+    if (!r.line(line)) {
+      return -1;
+    }
+    if (line.empty()) {
+      break;
+    }
+    const char* h = line.c_str();
+    if (!strncasecmp(h, "Content-Length:", 15)) {
+      length = atol(h + 15);
+    } else if (!strncasecmp(h, "Transfer-Encoding:", 18)) {
+      chunked = strstr(h + 18, "chunked") != NULL;
+    } else if (!strncasecmp(h, "Connection:", 11)) {
+      close_requested = strcasestr(h + 11, "close") != NULL;
+    }
+  }
+
+  long size = 0;
+  if (chunked) {
+    while (1) {
+      if (!r.line(line)) {
+        return -1;
+      }
+      long chunk = strtol(line.c_str(), NULL, 16);
+      if (!chunk) {
+        // Skip the trailer.
+        while (r.line(line) && !line.empty()) {
+        }
+        break;
+      }
+      if (r.skip(chunk) != chunk || !r.line(line)) {
+        return -1;
+      }
+      size += chunk;
+    }
+  } else if (length >= 0) {
+    if (r.skip(length) != length) {
+      return -1;
+    }
+    size = length;
+  } else {
+    size = r.skip(-1);
+    close_requested = true;
+  }
+  *reuse = !http_10 && http_11 && !close_requested;
+  return size;
+}
+
+static void* run_worker(void* arg) {
+  Worker* w = (Worker*)arg;
+  int fd = -1;
+  Reader* r = NULL;
+  std::string request;
+  long n;
+  while ((n = next_request()) >= 0) {
+    const std::string& path = paths[n % paths.size()];
+    request = std::string(method) + " " + path
+      + (http_10 ? " HTTP/1.0\r\n" : " HTTP/1.1\r\n")
+      + "Host: " + host_header + "\r\n";
+    if (body) {
+      char length[32];
+      snprintf(length, sizeof(length), "%zu", strlen(body));
+      request += std::string("Content-Type: application/x-www-form-urlencoded"
+                             "\r\nContent-Length: ") + length + "\r\n";
+    }
+    request += "\r\n";
+    if (body) {
+      request += body;
+    }
+
+    double start = now();
+    bool ok = false;
+    // A reused connection may have been closed by the server in the
+    // meantime, retry once on a new one.
+    for (int attempt = 0; attempt < 2 && !ok; attempt++) {
+      bool fresh = false;
+      if (fd < 0) {
+        fd = connect_to_server();
+        if (fd < 0) {
+          break;
+        }
+        delete r;
+        r = new Reader(fd);
+        w->connects++;
+        fresh = true;
+      }
+      bool reuse = false;
+      long size = -1;
+      if (send_all(fd, request.data(), request.size())) {
+        size = read_response(*r, &reuse);
+      }
+      if (size >= 0) {
+        ok = true;
+        w->bytes += size;
+      }
+      if (size < 0 || !reuse) {
+        close(fd);
+        fd = -1;
+      }
+      if (size < 0 && fresh) {
+        break;
+      }
+    }
+    if (ok) {
+      w->latencies.push_back((now() - start) * 1e6);
+    } else {
+      w->errors++;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  delete r;
+  return NULL;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: loadgen [-c connections] [-n requests] [-d seconds]\n"
+          "               [-X method] [-b body] [-1] host:port path...\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  int connections = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:n:d:X:b:1")) != -1) {
+    switch (opt) {
+    case 'c': connections = atoi(optarg); break;
+    case 'n': max_requests = atol(optarg); break;
+    case 'd': max_seconds = atof(optarg); break;
+    case 'X': method = optarg; break;
+    case 'b': body = optarg; break;
+    case '1': http_10 = true; break;
+    default: usage();
+    }
+  }
+  if (argc - optind < 2 || connections < 1) {
+    usage();
+  }
+
+  host_header = argv[optind];
+  std::string host = host_header;
+  int port = 80;
+  size_t colon = host.rfind(':');
+  if (colon != std::string::npos) {
+    port = atoi(host.c_str() + colon + 1);
+    host.erase(colon);
+  }
+  struct hostent* he = gethostbyname(host.c_str());
+  if (!he) {
+    fprintf(stderr, "loadgen: unknown host %s\n", host.c_str());
+    return 1;
+  }
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  memcpy(&server_addr.sin_addr, he->h_addr, sizeof(server_addr.sin_addr));
+  for (int i = optind + 1; i < argc; i++) {
+    paths.push_back(argv[i]);
+  }
+
+  std::vector<Worker> workers(connections);
+  start_time = now();
+  for (int i = 0; i < connections; i++) {
+    workers[i].bytes = workers[i].errors = workers[i].connects = 0;
+    pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+  }
+  std::vector<uint32_t> latencies;
+  uint64_t bytes = 0;
+  long errors = 0, connects = 0;
+  for (int i = 0; i < connections; i++) {
+    pthread_join(workers[i].thread, NULL);
+    latencies.insert(latencies.end(), workers[i].latencies.begin(),
+                     workers[i].latencies.end());
+    bytes += workers[i].bytes;
+    errors += workers[i].errors;
+    connects += workers[i].connects;
+  }
+  double elapsed = now() - start_time;
+
+  std::sort(latencies.begin(), latencies.end());
+  size_t count = latencies.size();
+  printf("%zu requests in %.2fs over %ld connections, %ld errors\n",
+         count, elapsed, connects, errors);
+  printf("  %.1f requests/s, %.1f KB/s\n", count / elapsed,
+         bytes / elapsed / 1024);
+  if (count) {
+    // The nearest-rank percentiles.
+    const double ranks[] = { 0.5, 0.99, 0.999 };
+    const char* names[] = { "p50", "p99", "p999" };
+    printf("  latency");
+    for (int i = 0; i < 3; i++) {
+      size_t k = (size_t)(ranks[i] * count + 0.999999);
+      k = k ? k - 1 : 0;
+      printf(" %s %.2fms", names[i], latencies[std::min(k, count - 1)] / 1e3);
+    }
+    printf(" max %.2fms\n", latencies[count - 1] / 1e3);
+  }
+  return errors ? 1 : 0;
+}
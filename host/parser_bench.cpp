@@ -0,0 +1,145 @@
+// -*- c++ -*-
+//
+// Times the request parsing functions on the inputs of
+// parser_harness.h, to tell whether a change to them made them faster.
+//
+//   parser_bench [iterations]
+
+#include <time.h>
+
+#include "parser_harness.h"
+
+static boolean dummy_handler(TinyWebServer& web_server) { return true; }
+
+// The routes of the examples put together.
+static TinyWebServer::PathHandler handlers[] = {
+  {"/", TinyWebServer::GET, &dummy_handler},
+  {"/upload/" "*", TinyWebServer::PUT, &dummy_handler},
+  {"/blinkled", TinyWebServer::POST, &dummy_handler},
+  {"/ledstatus", TinyWebServer::GET, &dummy_handler},
+  {"/led/:id/state", TinyWebServer::GET, &dummy_handler},
+  {"/stats", TinyWebServer::GET, &dummy_handler},
+  {"/" "*", TinyWebServer::GET, &dummy_handler},
+  {NULL},
+};
+
+static long iterations = 100000;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keeps the compiler from optimizing the benchmarked calls away.
+static volatile uintptr_t sink;
+
+// Runs `fn' on each of the `count' inputs, `iterations' times, and
+// prints the average time per call.
+static void bench(const char* name, void (*fn)(ParserHarness&, const char*),
+                  ParserHarness& web, const char* const* inputs,
+                  size_t count) {
+  double start = now();
+  for (long i = 0; i < iterations; i++) {
+    for (size_t j = 0; j < count; j++) {
+      fn(web, inputs[j]);
+    }
+  }
+  double elapsed = now() - start;
+  printf("%-28s %9.1f ns/call\n", name,
+         elapsed * 1e9 / (iterations * count));
+}
+
+static void run_get_field(ParserHarness& web, const char* s) {
+  for (int i = 0; i < 3; i++) {
+    char* field = ParserHarness::get_field(s, i, &web.get_arena());
+    sink += (uintptr_t)field;
+  }
+  web.get_arena().reset();
+}
+
+static void run_decode_url_encoded(ParserHarness& web, const char* s) {
+  sink += (uintptr_t)TinyWebServer::decode_url_encoded(s, &web.get_arena());
+  web.get_arena().reset();
+}
+
+static void run_get_file_from_path(ParserHarness& web, const char* s) {
+  sink += (uintptr_t)TinyWebServer::get_file_from_path(s, &web.get_arena());
+  web.get_arena().reset();
+}
+
+static void run_get_mime_type(ParserHarness& web, const char* s) {
+  sink += TinyWebServer::get_mime_type_from_filename(s);
+}
+
+static void run_process_headers(ParserHarness& web, const char* s) {
+  web.set_input(s, strlen(s));
+  sink += web.process_headers();
+  sink += (uintptr_t)web.get_header_value("Content-Type");
+}
+
+static void run_find_handler(ParserHarness& web, const char* s) {
+  char path[64];
+  strncpy(path, s, sizeof(path) - 1);
+  path[sizeof(path) - 1] = 0;
+  sink += web.find_handler(path, TinyWebServer::GET);
+}
+
+static void run_find_query_param(ParserHarness& web, const char* s) {
+  char value[16];
+  sink += ParserHarness::find_query_param(s, "led", value, sizeof(value));
+}
+
+static void ignore_part(TinyWebServer& web_server,
+                        TinyWebPutHandler::PutAction action,
+                        const TinyWebMultipartHandler::Part& part,
+                        char* buffer, int size) {
+  sink += size;
+}
+
+// Parses the body in pieces of 64 bytes, as read from the Ethernet
+// chip by the multipart handler.
+static void run_multipart(ParserHarness& web, const char* s) {
+  char block[TWS_PUT_BLOCK_SIZE];
+  TinyWebMultipartParser parser;
+  parser.begin(multipart_content_type, &ignore_part, block, sizeof(block));
+  size_t size = strlen(s);
+  for (size_t i = 0; i < size; i += 64) {
+    parser.parse(web, (const uint8_t*)s + i, i + 64 < size ? 64 : size - i);
+  }
+  sink += parser.end(web);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    iterations = atol(argv[1]);
+  }
+  ParserHarness web(handlers, harness_headers);
+  // Make sure the headers are parsed completely, rather than timing
+  // the errors.
+  for (size_t i = 0; i < ARRAY_SIZE(header_corpus); i++) {
+    web.set_input(header_corpus[i], strlen(header_corpus[i]));
+    if (!web.process_headers() || !web.get_header_value("Host")) {
+      fprintf(stderr, "Can't parse header_corpus[%zu]\n", i);
+      return 1;
+    }
+  }
+
+  bench("get_field", run_get_field, web,
+        request_line_corpus, ARRAY_SIZE(request_line_corpus));
+  bench("decode_url_encoded", run_decode_url_encoded, web,
+        url_corpus, ARRAY_SIZE(url_corpus));
+  bench("get_file_from_path", run_get_file_from_path, web,
+        url_corpus, ARRAY_SIZE(url_corpus));
+  bench("get_mime_type_from_filename", run_get_mime_type, web,
+        filename_corpus, ARRAY_SIZE(filename_corpus));
+  bench("process_headers", run_process_headers, web,
+        header_corpus, ARRAY_SIZE(header_corpus));
+  bench("find_handler", run_find_handler, web,
+        url_corpus, ARRAY_SIZE(url_corpus));
+  bench("find_query_param", run_find_query_param, web,
+        query_corpus, ARRAY_SIZE(query_corpus));
+  const char* multipart[] = { multipart_body };
+  bench("multipart_parser", run_multipart, web, multipart, 1);
+  return 0;
+}
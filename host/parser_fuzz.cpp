@@ -0,0 +1,231 @@
+// -*- c++ -*-
+//
+// A libFuzzer-style harness for the request parsing functions. The
+// first byte of the input picks the function, the rest is its input.
+// Build it with clang's -fsanitize=fuzzer, or with fuzz_main.cpp for a
+// standalone mutation fuzzer that works with any compiler.
+
+#include "parser_harness.h"
+
+static boolean dummy_handler(TinyWebServer& web_server) { return true; }
+
+static TinyWebServer::PathHandler handlers[] = {
+  {"/", TinyWebServer::GET, &dummy_handler},
+#if TWS_WEBSOCKETS
+  {"/ws", TinyWebServer::GET, &TinyWebSocketHandler::websocket_handler},
+#endif
+  {"/upload/" "*", TinyWebServer::PUT, &dummy_handler},
+  {"/led/:id", TinyWebServer::POST, &dummy_handler},
+  {"/led/:id/:state", TinyWebServer::POST, &dummy_handler},
+  {"/files/:dir/" "*", TinyWebServer::GET, &dummy_handler},
+  {"/" "*", TinyWebServer::GET, &dummy_handler},
+  {NULL},
+};
+
+static void write_value(TinyWebServer& web_server) {
+  web_server << F("value");
+}
+
+static const TinyWebServer::TemplateVariable variables[] = {
+  {"a", &write_value},
+  {"led_state", &write_value},
+  {NULL},
+};
+
+// Aborts, so the fuzzer reports the input, when `condition' is false.
+static void check(bool condition) {
+  if (!condition) {
+    abort();
+  }
+}
+
+static void fuzz_get_field(const char* s, uint8_t which) {
+  char* field = ParserHarness::get_field(s, which & 3);
+  if (field) {
+    check(strlen(field) <= strlen(s));
+    for (char* p = field; *p; p++) {
+      check(!isspace(*p));
+    }
+  }
+  free(field);
+}
+
+static void fuzz_decode(const char* s) {
+  char* decoded = TinyWebServer::decode_url_encoded(s);
+  if (decoded) {
+    check(strlen(decoded) <= strlen(s));
+  }
+  free(decoded);
+  free(TinyWebServer::get_file_from_path(s));
+  TinyWebServer::get_mime_type_from_filename(s);
+  char gzip_name[13];
+  TinyWebServer::get_gzip_file_name(s, gzip_name, sizeof(gzip_name));
+}
+
+static void fuzz_headers(const uint8_t* data, size_t size) {
+  // A new server for every input, so nothing is left over in the
+  // connection's input from the previous one.
+  ParserHarness web(handlers, harness_headers);
+  web.set_input((const char*)data, size);
+  if (!web.process_headers()) {
+    return;
+  }
+  for (int i = 0; harness_headers[i]; i++) {
+    uint16_t length;
+    const char* value = web.get_header_value(harness_headers[i], &length);
+    if (value) {
+      check(strlen(value) == length);
+    }
+  }
+  web.get_header_value("Content-Length");
+  char a[8];
+  char b[1];
+  TinyWebServer::FormField fields[] = {
+    {"a", a, sizeof(a)},
+    {"b", b, sizeof(b)},
+    {"c", NULL, 0},
+    {NULL},
+  };
+  web.read_form(fields);
+  check(strlen(a) < sizeof(a) && !b[0]);
+}
+
+static void fuzz_query(const char* s) {
+  static const char* names[] = { "a", "led", "", "_" };
+  for (size_t i = 0; i < ARRAY_SIZE(names); i++) {
+    char value[8];
+    if (ParserHarness::find_query_param(s, names[i], value, sizeof(value))) {
+      check(strlen(value) < sizeof(value));
+    }
+  }
+}
+
+static void fuzz_range(const char* s, uint8_t which) {
+  uint32_t size = which & 1 ? 1000 : 1;
+  uint32_t first, last;
+  if (ParserHarness::parse_range(s, size, &first, &last)
+      == TinyWebServer::RANGE_SATISFIABLE) {
+    check(first <= last && last < size);
+  }
+}
+
+static void fuzz_find_handler(const char* s) {
+  static ParserHarness web(handlers, harness_headers);
+  char* path = strdup(s);
+  size_t len = strlen(path);
+  int route = web.find_handler(path, TinyWebServer::POST);
+  if (route < 0) {
+    route = web.find_handler(path, TinyWebServer::GET);
+  }
+  if (route >= 0) {
+    for (uint8_t i = 0; i < TWS_MAX_PATH_PARAMS; i++) {
+      uint8_t length;
+      const char* param = web.get_path_param(i, &length);
+      if (param) {
+        check(param >= path && param + length <= path + len);
+      }
+    }
+    uint8_t length;
+    web.get_path_param("id", &length);
+  }
+  free(path);
+}
+
+static void fuzz_template(const char* s) {
+  static ParserHarness web(handlers, harness_headers);
+  web.send_template_P(s, variables);
+}
+
+static void ignore_part(TinyWebServer& web_server,
+                        TinyWebPutHandler::PutAction action,
+                        const TinyWebMultipartHandler::Part& part,
+                        char* buffer, int size) {
+  check(strlen(part.name) < sizeof(part.name)
+        && strlen(part.filename) < sizeof(part.filename)
+        && strlen(part.content_type) < sizeof(part.content_type));
+  check(action != TinyWebPutHandler::WRITE || (size > 0 && size <= 16));
+}
+
+static void fuzz_multipart(const uint8_t* data, size_t size, uint8_t which) {
+  static ParserHarness web(handlers, harness_headers);
+  char block[16];
+  TinyWebMultipartParser parser;
+  if (!parser.begin(multipart_content_type, &ignore_part, block,
+                    sizeof(block))) {
+    abort();
+  }
+  // Feed the body in pieces, so the boundary gets split.
+  size_t piece = 1 + which;
+  for (size_t i = 0; i < size; i += piece) {
+    parser.parse(web, data + i, i + piece < size ? piece : size - i);
+  }
+  parser.end(web);
+}
+
+#if TWS_WEBSOCKETS
+static void check_message(TinyWebServer& web_server, uint8_t opcode,
+                          uint8_t* data, uint16_t size) {
+  if (opcode == TinyWebServer::WS_CLOSE) {
+    check(!data && !size);
+    return;
+  }
+  check(size < TWS_REQUEST_BUFFER_SIZE && !data[size]);
+  // Answer, so frames get written while others are being read.
+  web_server.send_frame(opcode, data, size);
+}
+
+static void fuzz_websocket(const uint8_t* data, size_t size) {
+  static const char handshake[] =
+    "GET /ws HTTP/1.1\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+  TinyWebSocketHandler::message_fn = &check_message;
+  // The frames follow the handshake, often in the same read.
+  size_t length = sizeof(handshake) - 1 + size;
+  char* input = (char*)malloc(length);
+  memcpy(input, handshake, sizeof(handshake) - 1);
+  memcpy(input + sizeof(handshake) - 1, data, size);
+  ParserHarness web(handlers, harness_headers);
+  web.set_input(input, length);
+  EthernetClient client(0);
+  web.accept_client(client);
+  // The WebSocket is closed at the latest once the input runs out.
+  while (web.has_client(client)) {
+    web.process();
+  }
+  free(input);
+}
+#endif
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  if (!size) {
+    return 0;
+  }
+  uint8_t selector = data[0];
+  data++;
+  size--;
+  // Most functions take NUL terminated strings.
+  char* s = (char*)malloc(size + 1);
+  memcpy(s, data, size);
+  s[size] = 0;
+
+  uint8_t which = selector / 9;
+  switch (selector % 9) {
+  case 0: fuzz_get_field(s, which); break;
+  case 1: fuzz_decode(s); break;
+  case 2: fuzz_headers(data, size); break;
+  case 3: fuzz_query(s); break;
+  case 4: fuzz_range(s, which); break;
+  case 5: fuzz_find_handler(s); break;
+  case 6: fuzz_template(s); break;
+  case 7: fuzz_multipart(data, size, which); break;
+#if TWS_WEBSOCKETS
+  case 8: fuzz_websocket(data, size); break;
+#endif
+  }
+  free(s);
+  return 0;
+}
@@ -0,0 +1,203 @@
+// -*- c++ -*-
+//
+// Shared by the parser benchmarks and the fuzzer: a TinyWebServer that
+// reads its request from memory through the read_block() seam and
+// throws its output away, plus a few realistic inputs.
+
+#ifndef __HOST_PARSER_HARNESS_H__
+#define __HOST_PARSER_HARNESS_H__
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <Flash.h>
+#include <SD.h>
+#include <TinyWebServer.h>
+
+class ParserHarness : public TinyWebServer {
+public:
+  ParserHarness(PathHandler handlers[], const char** headers)
+    : TinyWebServer(handlers, headers),
+      data_(NULL), size_(0), pos_(0), eof_(false) {
+    compile_routes();
+  }
+
+  // The request, or what's left of it after the request line, read by
+  // process_headers() and read().
+  void set_input(const char* data, size_t size) {
+    data_ = data;
+    size_ = size;
+    pos_ = 0;
+    eof_ = false;
+  }
+
+  using TinyWebServer::get_field;
+  using TinyWebServer::parse_range;
+  using TinyWebServer::find_query_param;
+  using TinyWebServer::find_handler;
+  using TinyWebServer::accept_client;
+  using TinyWebServer::has_client;
+  using TinyWebServer::write;
+
+  virtual size_t write(uint8_t c) { return 1; }
+  virtual size_t write(const uint8_t* buffer, size_t size) { return size; }
+  virtual void write_block(Client& client, const uint8_t* buffer,
+                           size_t size) {}
+
+  // The client goes away once it's sent all of its input.
+  virtual boolean is_connected(Client& client) { return !eof_; }
+
+protected:
+  // Stop waiting for input once it's all been read, instead of
+  // spinning until the read timeout.
+  virtual boolean should_stop_processing() { return eof_; }
+
+  virtual int read_block(Client& client, uint8_t* buffer, int size) {
+    size_t n = size_ - pos_;
+    if (n > (size_t)size) {
+      n = size;
+    }
+    memcpy(buffer, data_ + pos_, n);
+    pos_ += n;
+    if (!n) {
+      eof_ = true;
+    }
+    return n;
+  }
+
+private:
+  const char* data_;
+  size_t size_;
+  size_t pos_;
+  boolean eof_;
+};
+
+// The headers requested by the harness' handlers, on top of the
+// library's own. Their values share TWS_HEADER_BUFFER_SIZE bytes with
+// those, which leaves no room for a browser's User-Agent.
+static const char* harness_headers[] __attribute__((unused)) = {
+  "Host",
+  "Content-Type",
+  NULL
+};
+
+// Headers as sent by a few common clients, without the request line.
+static const char* const header_corpus[] = {
+  "Host: 192.168.1.177\r\n"
+  "Connection: keep-alive\r\n"
+  "Cache-Control: max-age=0\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+  "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+  "image/avif,image/webp,*/*;q=0.8\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Accept-Language: en-US,en;q=0.9\r\n"
+  "If-None-Match: \"1f4-5a3c2e10\"\r\n"
+  "If-Modified-Since: Tue, 03 Jan 2023 10:20:30 GMT\r\n"
+  "\r\n",
+
+  "Host: arduino\r\n"
+  "User-Agent: curl/8.5.0\r\n"
+  "Accept: */*\r\n"
+  "\r\n",
+
+  "Host: arduino.local\r\n"
+  "User-Agent: Mozilla/5.0 (iPhone; CPU iPhone OS 17_0 like Mac OS X)\r\n"
+  "Accept: */*\r\n"
+  "Content-Type: application/x-www-form-urlencoded; charset=UTF-8\r\n"
+  "X-Requested-With: XMLHttpRequest\r\n"
+  "Content-Length: 5\r\n"
+  "Origin: http://arduino.local\r\n"
+  "Referer: http://arduino.local/\r\n"
+  "\r\n",
+
+  "Host: 10.0.0.2\r\n"
+  "Range: bytes=1024-2047\r\n"
+  "If-Range: \"12000-5a3c2e10\"\r\n"
+  "\r\n",
+
+  "Host: 192.168.1.177\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 "
+  "Firefox/128.0\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+  "*/*;q=0.8\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+  "Content-Type: multipart/form-data; "
+  "boundary=---------------------------2811862383392"
+  "4377124765873541907243859614\r\n"
+  "Content-Length: 5\r\n"
+  "Origin: http://192.168.1.177\r\n"
+  "Connection: keep-alive\r\n"
+  "Referer: http://192.168.1.177/upload.htm\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "Priority: u=0, i\r\n"
+  "\r\n",
+};
+
+// Request lines, as split into fields by get_field().
+static const char* const request_line_corpus[] = {
+  "GET / HTTP/1.1",
+  "GET /ledstatus?_=1700000000000 HTTP/1.1",
+  "POST /blinkled HTTP/1.1",
+  "PUT /upload/IMAGE.JPG HTTP/1.0",
+  "GET /static/js/jquery.min.js?v=3.7.1 HTTP/1.1",
+};
+
+// Paths and file names, with and without escape sequences.
+static const char* const url_corpus[] = {
+  "/index.htm",
+  "/index%2Ehtm",
+  "/upload/My%20Photo%20%281%29.jpg",
+  "/led/12/state",
+  "/a%2",
+  "/style.css",
+  "/%E2%9C%93%E2%9C%93%E2%9C%93.txt",
+};
+
+static const char* const filename_corpus[] = {
+  "INDEX.HTM",
+  "JQUERY.JS",
+  "STYLE.CSS",
+  "LIGHTS.PNG",
+  "FONT.WOFF2",
+  "DATA.JSON",
+  "README",
+  "ARCHIVE.TAR.GZ",
+};
+
+// Query strings, for find_query_param().
+static const char* const query_corpus[] = {
+  "_=1700000000000",
+  "led=1&name=Living+room%21&flag",
+  "a=1&b=2&c=3&d=4&e=5&f=6&g=7&h=8&led=0",
+};
+
+// A multipart/form-data body, as sent by browsers for a form with a
+// text field and a file.
+static const char multipart_content_type[] =
+  "multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW";
+
+static const char multipart_body[] =
+  "------WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+  "Content-Disposition: form-data; name=\"led\"\r\n"
+  "\r\n"
+  "1\r\n"
+  "------WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+  "Content-Disposition: form-data; name=\"file\"; filename=\"DATA.TXT\"\r\n"
+  "Content-Type: text/plain\r\n"
+  "\r\n"
+  "line 1\r\nline 2\r\n--not a boundary\r\n\r\n"
+  "------WebKitFormBoundary7MA4YWxkTrZu0gW--\r\n";
+
+// WebSocket frames as sent by browsers: a masked "Hello", the example
+// of RFC 6455, a ping and a close frame with the status 1000.
+static const uint8_t websocket_frames[] = {
+  0x81, 0x85, 0x37, 0xFA, 0x21, 0x3D, 0x7F, 0x9F, 0x4D, 0x51, 0x58,
+  0x89, 0x82, 0x37, 0xFA, 0x21, 0x3D, 'h' ^ 0x37, 'i' ^ 0xFA,
+  0x88, 0x82, 0x37, 0xFA, 0x21, 0x3D, 0x03 ^ 0x37, 0xE8 ^ 0xFA,
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#endif /* __HOST_PARSER_HARNESS_H__ */
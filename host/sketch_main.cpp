@@ -0,0 +1,18 @@
+// -*- c++ -*-
+//
+// Drives an Arduino sketch on the host: setup() once, then loop()
+// forever.
+
+#include <Arduino.h>
+
+void setup();
+void loop();
+
+int main() {
+  // Show the sketch's Serial output as it's written.
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  setup();
+  for (;;) {
+    loop();
+  }
+}
@@ -0,0 +1,28 @@
+// -*- c++ -*-
+//
+// Runs Unittest/Unittest.ino on the host and turns its failure count
+// into the process exit status.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+
+void setup();
+extern int failures;
+
+int main() {
+  // The tests create their files on the card, which is a directory
+  // of its own unless TWS_SD_ROOT says otherwise.
+  char card[] = "/tmp/tws-unittest-XXXXXX";
+  boolean temporary = !getenv("TWS_SD_ROOT") && mkdtemp(card);
+  if (temporary) {
+    setenv("TWS_SD_ROOT", card, 1);
+  }
+  setup();
+  Serial.flush();
+  if (temporary) {
+    rmdir(card);
+  }
+  return failures ? 1 : 0;
+}